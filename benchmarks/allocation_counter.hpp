@@ -0,0 +1,55 @@
+#ifndef VK_GRAFFITI_BOT_ALLOCATION_COUNTER_HPP
+#define VK_GRAFFITI_BOT_ALLOCATION_COUNTER_HPP
+
+#include <new>
+#include <atomic>
+#include <cstdlib>
+#include <cstddef>
+
+// Replaces the global operator new to count heap allocations,
+// include it in exactly one translation unit of a benchmark target.
+namespace benchmark {
+inline std::atomic<std::size_t> allocations_count = 0;
+
+// allocations made by func, divided by the number of calls
+template <typename Func>
+inline double allocations_per_call(Func&& func, const std::size_t calls = 1000) {
+    // the first call may fill caches and thread-local buffers
+    func();
+    const std::size_t before = allocations_count.load();
+    for (std::size_t i = 0; i < calls; ++i) {
+        func();
+    }
+    return static_cast<double>(allocations_count.load() - before) / static_cast<double>(calls);
+}
+} // benchmark
+
+void* operator new(const std::size_t size) {
+    ++benchmark::allocations_count;
+    if (void* ptr = std::malloc(size ? size : 1)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](const std::size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+#endif // !VK_GRAFFITI_BOT_ALLOCATION_COUNTER_HPP
@@ -0,0 +1,65 @@
+#ifndef VK_GRAFFITI_BOT_BENCHMARK_HPP
+#define VK_GRAFFITI_BOT_BENCHMARK_HPP
+
+#include <chrono>
+#include <string>
+#include <cstdio>
+#include <cstddef>
+#include <algorithm>
+
+// Minimal timing helper for the benchmark targets.
+namespace benchmark {
+struct result {
+    double ns_per_iteration = 0;
+    std::size_t iterations  = 0;
+};
+
+// keeps the compiler from optimizing away the measured work
+template <typename T>
+inline void do_not_optimize(const T& value) {
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile const T* sink;
+    sink = &value;
+#endif
+}
+
+// repeats func until min_time has passed, the best of several rounds is reported
+template <typename Func>
+inline result run(Func&& func, const std::chrono::milliseconds min_time = std::chrono::milliseconds(200)) {
+    using clock = std::chrono::steady_clock;
+    constexpr int rounds = 5;
+    std::size_t iterations = 1;
+    while (true) {
+        const auto start = clock::now();
+        for (std::size_t i = 0; i < iterations; ++i) {
+            func();
+        }
+        if (clock::now() - start >= min_time / rounds || iterations >= (std::size_t(1) << 30)) {
+            break;
+        }
+        iterations *= 2;
+    }
+
+    result best;
+    best.iterations = iterations;
+    for (int round = 0; round < rounds; ++round) {
+        const auto start = clock::now();
+        for (std::size_t i = 0; i < iterations; ++i) {
+            func();
+        }
+        const std::chrono::duration<double, std::nano> elapsed = clock::now() - start;
+        const double ns = elapsed.count() / static_cast<double>(iterations);
+        best.ns_per_iteration = round == 0 ? ns : std::min(best.ns_per_iteration, ns);
+    }
+    return best;
+}
+
+inline void report(const std::string& name, const result& result, const std::string& extra = "") {
+    std::printf("%-48s %14.1f ns %12zu iterations %s\n",
+        name.c_str(), result.ns_per_iteration, result.iterations, extra.c_str());
+}
+} // benchmark
+
+#endif // !VK_GRAFFITI_BOT_BENCHMARK_HPP
@@ -0,0 +1,80 @@
+#include "benchmark.hpp"
+
+#include "blend.hpp"
+
+#include <random>
+#include <vector>
+#include <cstdlib>
+
+using namespace vk_graffiti_bot;
+
+namespace {
+constexpr std::size_t width  = 2560;
+constexpr std::size_t height = 256;
+
+const char* kernel_name(const blend_kernel kernel) {
+    switch (kernel) {
+    case blend_kernel::sse2:
+        return "sse2";
+    case blend_kernel::avx2:
+        return "avx2";
+    default:
+        return "scalar";
+    }
+}
+
+std::vector<std::uint8_t> random_bytes(const std::size_t size, std::mt19937& random) {
+    std::uniform_int_distribution<int> distribution(0, 255);
+    std::vector<std::uint8_t> bytes(size);
+    for (auto& byte : bytes) {
+        byte = static_cast<std::uint8_t>(distribution(random));
+    }
+    return bytes;
+}
+
+void blend_image(const blend_kernel kernel, std::vector<std::uint8_t>& pixels,
+    const std::vector<std::uint8_t>& fill, const std::vector<std::uint8_t>& outline) {
+    const blend_color fill_color{ 255, 255, 255, 255 };
+    const blend_color outline_color{ 0, 0, 0, 200 };
+    for (std::size_t y = 0; y < height; ++y) {
+        blend_coverage_row(kernel, pixels.data() + y * width * 4, fill.data() + y * width,
+            outline.data() + y * width, width, fill_color, outline_color);
+    }
+}
+} // namespace
+
+int main() {
+    std::mt19937 random(42);
+    const auto source_pixels = random_bytes(width * height * 4, random);
+    const auto fill          = random_bytes(width * height, random);
+    const auto outline       = random_bytes(width * height, random);
+
+    auto reference = source_pixels;
+    blend_image(blend_kernel::scalar, reference, fill, outline);
+
+    std::printf("detected kernel: %s\n", kernel_name(detect_blend_kernel()));
+    for (const auto kernel : { blend_kernel::scalar, blend_kernel::sse2, blend_kernel::avx2 }) {
+        if (!is_blend_kernel_supported(kernel)) {
+            std::printf("%s is not supported\n", kernel_name(kernel));
+            continue;
+        }
+
+        // the timings only make sense if the kernel matches the scalar reference
+        auto pixels = source_pixels;
+        blend_image(kernel, pixels, fill, outline);
+        if (pixels != reference) {
+            std::printf("%s result differs from scalar\n", kernel_name(kernel));
+            return EXIT_FAILURE;
+        }
+
+        const auto result = benchmark::run([&] {
+            pixels = source_pixels;
+            blend_image(kernel, pixels, fill, outline);
+            benchmark::do_not_optimize(pixels.data());
+        });
+        const double megapixels = static_cast<double>(width * height) / 1e6;
+        benchmark::report(std::string("blend_coverage_row/") + kernel_name(kernel), result,
+            std::to_string(megapixels / (result.ns_per_iteration / 1e9)) + " Mpx/s");
+    }
+    return EXIT_SUCCESS;
+}
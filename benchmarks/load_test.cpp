@@ -0,0 +1,335 @@
+#include "mock_vk_server.hpp"
+
+#include "graffiti_bot.hpp"
+#include "latency_histogram.hpp"
+
+#include <map>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <condition_variable>
+
+// Replays a mix of messages against the mock server and reports the end-to-end latency
+// (from the message appearing in the long poll to its final reply) and the messages per second.
+//
+// load_test --font PATH --photos DIR [--messages 200] [--rate 0] [--users 0] [--mix 1:80,2:15,4:5]
+//     [--text-only 0.05] [--repeat 0.1] [--api-latency-ms 0] [--workers 4] [--render-concurrency 0]
+//     [--batch-window-ms 20] [--render-mode cpu|render_texture] [--stall-every 0] [--timeout-ms 60000]
+//     [--external]
+//
+// --rate 0 pushes every message at once, --users 0 gives every message its own sender.
+// --mix weighs the number of photos per message, --text-only is the share of messages without photos
+// and --repeat the share that repeats an earlier photo and caption, which the result cache answers.
+// --stall-every N leaves every N-th method call or upload unanswered, the bot gets past it only by
+// timing the transfer out after --timeout-ms and retrying, which the printed retries show.
+// With --external no bot is started, the mock server waits for a bot pointed at the printed api_url.
+
+using namespace vk_graffiti_bot;
+
+namespace {
+struct options {
+    std::string font;
+    std::string photos;
+    std::size_t messages = 200;
+    double rate          = 0;
+    std::size_t users    = 0;
+    std::vector<std::pair<std::size_t, double>> mix = { { 1, 80 }, { 2, 15 }, { 4, 5 } };
+    double text_only      = 0.05;
+    double repeat         = 0.1;
+    long long api_latency_ms  = 0;
+    std::size_t workers       = 4;
+    std::size_t render_concurrency = 0;
+    long long batch_window_ms = 20;
+    std::size_t stall_every   = 0;
+    long long timeout_ms      = 60000;
+    bool cpu_render = true;
+    bool external   = false;
+};
+
+[[noreturn]] void usage(const char* error) {
+    std::fprintf(stderr, "%s\nusage: load_test --font PATH --photos DIR [options], see the top of load_test.cpp\n", error);
+    std::exit(EXIT_FAILURE);
+}
+
+std::vector<std::pair<std::size_t, double>> parse_mix(const std::string& mix) {
+    std::vector<std::pair<std::size_t, double>> result;
+    std::size_t begin = 0;
+    while (begin < mix.size()) {
+        std::size_t end = mix.find(',', begin);
+        if (end == std::string::npos) {
+            end = mix.size();
+        }
+        const std::string part = mix.substr(begin, end - begin);
+        const std::size_t colon = part.find(':');
+        if (colon == std::string::npos) {
+            usage("--mix expects photos:weight pairs");
+        }
+        result.emplace_back(std::stoul(part.substr(0, colon)), std::stod(part.substr(colon + 1)));
+        begin = end + 1;
+    }
+    if (result.empty()) {
+        usage("--mix is empty");
+    }
+    return result;
+}
+
+options parse_options(const int argc, char** argv) {
+    options result;
+    for (int i = 1; i < argc; ++i) {
+        const std::string name = argv[i];
+        if (name == "--external") {
+            result.external = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            usage(("missing value of " + name).c_str());
+        }
+        const std::string value = argv[++i];
+        if (name == "--font") {
+            result.font = value;
+        } else if (name == "--photos") {
+            result.photos = value;
+        } else if (name == "--messages") {
+            result.messages = std::stoul(value);
+        } else if (name == "--rate") {
+            result.rate = std::stod(value);
+        } else if (name == "--users") {
+            result.users = std::stoul(value);
+        } else if (name == "--mix") {
+            result.mix = parse_mix(value);
+        } else if (name == "--text-only") {
+            result.text_only = std::stod(value);
+        } else if (name == "--repeat") {
+            result.repeat = std::stod(value);
+        } else if (name == "--api-latency-ms") {
+            result.api_latency_ms = std::stoll(value);
+        } else if (name == "--workers") {
+            result.workers = std::stoul(value);
+        } else if (name == "--render-concurrency") {
+            result.render_concurrency = std::stoul(value);
+        } else if (name == "--batch-window-ms") {
+            result.batch_window_ms = std::stoll(value);
+        } else if (name == "--stall-every") {
+            result.stall_every = std::stoul(value);
+        } else if (name == "--timeout-ms") {
+            result.timeout_ms = std::stoll(value);
+        } else if (name == "--render-mode") {
+            result.cpu_render = value == "cpu";
+        } else {
+            usage(("unknown option " + name).c_str());
+        }
+    }
+    if (result.photos.empty() || (result.font.empty() && !result.external)) {
+        usage("--font and --photos are required");
+    }
+    return result;
+}
+
+struct planned_message {
+    int from_id = 0;
+    std::string text;
+    std::vector<std::size_t> photos;
+
+    // messages without photos are answered with an error text on purpose
+    [[nodiscard]] inline bool expects_attachment() const noexcept {
+        return !photos.empty();
+    }
+};
+
+// captions of different lengths, some of them in cyrillic and some starting with a character size
+std::vector<planned_message> plan_messages(const options& options, const std::size_t photos_count) {
+    static const char* captions[] = {
+        "Hi",
+        "Hello there",
+        "\xD0\x9F\xD1\x80\xD0\xB8\xD0\xB2\xD0\xB5\xD1\x82, \xD0\xBC\xD0\xB8\xD1\x80!",
+        "72 Long caption that has to be wrapped over several lines of the photo",
+        "A caption with\nseveral\nlines",
+        "24 \xD0\xA2\xD0\xB5\xD0\xBA\xD1\x81\xD1\x82 \xD0\xBF\xD0\xBE\xD0\xB4\xD0\xBB\xD0\xB8\xD0\xBD\xD0\xBD\xD0\xB5\xD0\xB5"
+    };
+    std::mt19937 random(12345);
+    std::uniform_real_distribution<double> share(0, 1);
+    std::vector<double> weights;
+    for (const auto& [count, weight] : options.mix) {
+        weights.push_back(weight);
+    }
+    std::discrete_distribution<std::size_t> mix(weights.begin(), weights.end());
+
+    std::vector<planned_message> plan;
+    for (std::size_t i = 0; i < options.messages; ++i) {
+        planned_message message;
+        message.from_id = static_cast<int>(options.users ? i % options.users : i) + 1;
+        if (!plan.empty() && share(random) < options.repeat) {
+            const auto& earlier = plan[std::uniform_int_distribution<std::size_t>(0, plan.size() - 1)(random)];
+            message.text   = earlier.text;
+            message.photos = earlier.photos;
+        } else {
+            message.text = captions[random() % std::size(captions)];
+            if (share(random) >= options.text_only) {
+                const std::size_t count = options.mix[mix(random)].first;
+                for (std::size_t photo = 0; photo < count; ++photo) {
+                    message.photos.push_back(random() % photos_count);
+                }
+            }
+        }
+        plan.push_back(std::move(message));
+    }
+    return plan;
+}
+
+// matches final replies with the pushed messages, replies to one sender come in order
+class reply_tracker {
+private:
+    struct _pushed {
+        benchmark::mock_vk_server::clock::time_point time;
+        bool expects_attachment = false;
+    };
+
+    std::mutex _mutex;
+    std::condition_variable _changed;
+    std::map<int, std::deque<_pushed>> _pending;
+    std::size_t _pending_count = 0;
+    std::size_t _completed     = 0;
+    std::size_t _failed        = 0;
+    latency_histogram _latency;
+
+public:
+    inline void pushed(const int from_id, const benchmark::mock_vk_server::clock::time_point time,
+        const bool expects_attachment) {
+        std::lock_guard lock(_mutex);
+        _pending[from_id].push_back({ time, expects_attachment });
+        ++_pending_count;
+    }
+
+    inline void replied(const benchmark::mock_reply& reply) {
+        // the notice sent before rendering is not the answer
+        if (reply.attachment.empty() && reply.text.rfind("Photo received!", 0) == 0) {
+            return;
+        }
+        std::lock_guard lock(_mutex);
+        auto& pending = _pending[reply.user_id];
+        if (pending.empty()) {
+            return;
+        }
+        const _pushed message = pending.front();
+        pending.pop_front();
+        _latency.record(reply.received - message.time);
+        --_pending_count;
+        ++_completed;
+        // a message with photos answered without them could not be processed
+        if (message.expects_attachment && reply.attachment.empty()) {
+            ++_failed;
+        }
+        _changed.notify_all();
+    }
+
+    [[nodiscard]] inline bool wait_all(const std::chrono::seconds timeout) {
+        std::unique_lock lock(_mutex);
+        return _changed.wait_for(lock, timeout, [this] { return _pending_count == 0; });
+    }
+
+    [[nodiscard]] inline std::size_t get_completed() {
+        std::lock_guard lock(_mutex);
+        return _completed;
+    }
+
+    [[nodiscard]] inline std::size_t get_failed() {
+        std::lock_guard lock(_mutex);
+        return _failed;
+    }
+
+    [[nodiscard]] inline const latency_histogram& get_latency() const noexcept {
+        return _latency;
+    }
+};
+} // namespace
+
+int main(int argc, char** argv) {
+    const options options = parse_options(argc, argv);
+    curl_global_init(CURL_GLOBAL_ALL);
+
+    benchmark::mock_vk_server server(options.photos);
+    server.set_api_latency(std::chrono::milliseconds(options.api_latency_ms));
+    server.set_stall_every(options.stall_every);
+    reply_tracker tracker;
+    server.set_reply_handler([&tracker](const benchmark::mock_reply& reply) {
+        tracker.replied(reply);
+    });
+    std::printf("mock api_url: %s\n", server.get_api_url().c_str());
+    std::fflush(stdout);
+
+    const auto plan = plan_messages(options, server.get_photos_count());
+
+    curl_multi_engine engine;
+    auto timeouts  = engine.get_handle_pool()->get_timeouts();
+    timeouts.total = std::chrono::milliseconds(options.timeout_ms);
+    engine.get_handle_pool()->set_timeouts(timeouts);
+    curl_wrapper curl(&engine);
+    vk_api api(curl, "mock");
+    api.set_api_url(server.get_api_url());
+    api.scheduler().set_requests_per_second(1e6);
+    if (options.batch_window_ms > 0) {
+        api.enable_batching(std::chrono::milliseconds(options.batch_window_ms));
+    }
+    graffiti_bot bot(api, 1, options.cpu_render ? render_mode::cpu : render_mode::render_texture);
+    std::thread bot_thread;
+    if (!options.external) {
+        bot.load_font(options.font);
+        bot.set_workers_count(options.workers);
+        if (options.render_concurrency != 0) {
+            bot.set_render_concurrency(options.render_concurrency);
+        }
+        bot_thread = std::thread([&bot] {
+            try {
+                bot.start(1);
+            } catch (const std::exception& ex) {
+                log_error(ex.what());
+            }
+        });
+        // the bot takes the long poll ts before the first message is pushed
+        while (server.get_long_polls() == 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    } else {
+        std::printf("waiting for a bot, press enter to start\n");
+        std::fflush(stdout);
+        std::cin.get();
+    }
+
+    using clock = benchmark::mock_vk_server::clock;
+    const auto start = clock::now();
+    for (std::size_t i = 0; i < plan.size(); ++i) {
+        if (options.rate > 0) {
+            std::this_thread::sleep_until(start + std::chrono::duration_cast<clock::duration>(
+                std::chrono::duration<double>(static_cast<double>(i) / options.rate)));
+        }
+        tracker.pushed(plan[i].from_id, clock::now(), plan[i].expects_attachment());
+        server.push_message(plan[i].from_id, plan[i].text, plan[i].photos);
+    }
+    const bool all_answered = tracker.wait_all(std::chrono::seconds(300));
+    const std::chrono::duration<double> elapsed = clock::now() - start;
+
+    if (bot_thread.joinable()) {
+        bot.stop();
+        bot_thread.join();
+    }
+
+    const auto latency = tracker.get_latency().get_snapshot();
+    const std::size_t completed = tracker.get_completed();
+    std::printf("messages %zu, answered %zu, failed %zu%s\n", plan.size(), completed, tracker.get_failed(),
+        all_answered ? "" : " (timed out)");
+    std::printf("elapsed %.2f s, %.1f messages/s, %zu api calls, %zu uploads\n", elapsed.count(),
+        static_cast<double>(completed) / elapsed.count(), server.get_method_calls(), server.get_uploads());
+    std::printf("latency ms: p50 %.1f, p90 %.1f, p99 %.1f, max %.1f, mean %.1f\n",
+        latency.quantile_us(0.5) / 1e3, latency.quantile_us(0.9) / 1e3, latency.quantile_us(0.99) / 1e3,
+        latency.max_us / 1e3, latency.mean_us() / 1e3);
+    if (options.stall_every != 0) {
+        std::printf("stalled requests %zu, retries %zu\n", server.get_stalls(), api.scheduler().get_metrics().retries);
+    }
+    return all_answered ? EXIT_SUCCESS : EXIT_FAILURE;
+}
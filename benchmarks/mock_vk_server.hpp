@@ -0,0 +1,508 @@
+#ifndef VK_GRAFFITI_BOT_MOCK_VK_SERVER_HPP
+#define VK_GRAFFITI_BOT_MOCK_VK_SERVER_HPP
+
+#include "utils.hpp"
+#include "image_header.hpp"
+#include "query_builder.hpp"
+#include <nlohmann/json.hpp>
+
+#include <map>
+#include <set>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include <functional>
+#include <filesystem>
+#include <string_view>
+#include <unordered_map>
+#include <condition_variable>
+
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+// Local stand-in for the parts of the VK API the bot uses, so the bot can be measured without a live group.
+// It answers groups.getLongPollServer, the long poll a_check requests, photos.getMessagesUploadServer,
+// photo uploads, photos.saveMessagesPhoto, messages.send and execute calls made of messages.send,
+// and serves the sample photos the pushed messages are attached with.
+namespace benchmark {
+struct mock_reply {
+    int user_id = 0;
+    std::string text;
+    std::string attachment;
+    std::chrono::steady_clock::time_point received;
+};
+
+class mock_vk_server {
+public:
+    using reply_handler_type = std::function<void(const mock_reply& reply)>;
+    using clock              = std::chrono::steady_clock;
+
+private:
+    struct _photo {
+        std::string data;
+        unsigned width  = 0;
+        unsigned height = 0;
+    };
+
+    struct _request {
+        std::string method;
+        std::string path;
+        std::string query;
+        std::string body;
+        bool keep_alive = true;
+    };
+
+    struct _response {
+        int status = 200;
+        std::string content_type = "application/json";
+        std::string body;
+    };
+
+    int _listener = -1;
+    std::uint16_t _port = 0;
+    std::atomic<bool> _stopped = false;
+    std::thread _accept_thread;
+    std::mutex _connections_mutex;
+    std::set<int> _connections;
+    std::vector<std::thread> _connection_threads;
+
+    std::vector<_photo> _photos;
+    std::chrono::milliseconds _api_latency{ 0 };
+    std::size_t _stall_every = 0;
+    reply_handler_type _reply_handler;
+
+    // every pushed message is one update, the long poll ts is the number of updates
+    std::mutex _updates_mutex;
+    std::condition_variable _updates_changed;
+    std::vector<std::string> _updates;
+    long long _next_message_id = 1;
+
+    std::atomic<std::size_t> _method_calls = 0;
+    std::atomic<std::size_t> _uploads      = 0;
+    std::atomic<std::size_t> _long_polls   = 0;
+    std::atomic<std::size_t> _api_requests = 0;
+    std::atomic<std::size_t> _stalls       = 0;
+    std::atomic<int> _next_photo_id        = 1;
+    std::atomic<int> _next_sent_id         = 1;
+
+    [[nodiscard]] static inline std::unordered_map<std::string, std::string> _parse_form(const std::string_view form) {
+        std::unordered_map<std::string, std::string> params;
+        std::size_t begin = 0;
+        while (begin < form.size()) {
+            std::size_t end = form.find('&', begin);
+            if (end == std::string_view::npos) {
+                end = form.size();
+            }
+            const auto param = form.substr(begin, end - begin);
+            const auto equal = param.find('=');
+            std::string name;
+            std::string value;
+            vk_graffiti_bot::append_url_decoded(name, param.substr(0, equal));
+            if (equal != std::string_view::npos) {
+                vk_graffiti_bot::append_url_decoded(value, param.substr(equal + 1));
+            }
+            params[std::move(name)] = std::move(value);
+            begin = end + 1;
+        }
+        return params;
+    }
+
+    // the objects passed to API.<name>(...) in the code of an execute call, strings may hold any brackets
+    [[nodiscard]] static inline std::vector<std::pair<std::string, nlohmann::json>> _parse_execute_code(
+        const std::string& code) {
+        std::vector<std::pair<std::string, nlohmann::json>> calls;
+        std::size_t pos = 0;
+        while ((pos = code.find("API.", pos)) != std::string::npos) {
+            const std::size_t name_begin = pos + 4;
+            const std::size_t open       = code.find('(', name_begin);
+            if (open == std::string::npos) {
+                break;
+            }
+            std::size_t depth = 0;
+            bool in_string    = false;
+            std::size_t end   = open + 1;
+            for (; end < code.size(); ++end) {
+                const char c = code[end];
+                if (in_string) {
+                    if (c == '\\') {
+                        ++end;
+                    } else if (c == '"') {
+                        in_string = false;
+                    }
+                } else if (c == '"') {
+                    in_string = true;
+                } else if (c == '{') {
+                    ++depth;
+                } else if (c == '}' && --depth == 0) {
+                    break;
+                }
+            }
+            calls.emplace_back(code.substr(name_begin, open - name_begin),
+                nlohmann::json::parse(code.substr(open + 1, end - open)));
+            pos = end;
+        }
+        return calls;
+    }
+
+    [[nodiscard]] static inline nlohmann::json _error(const int code, const std::string& msg) {
+        return { { "error", { { "error_code", code }, { "error_msg", msg } } } };
+    }
+
+    [[nodiscard]] inline std::string _base_url() const {
+        return "http://127.0.0.1:" + std::to_string(_port);
+    }
+
+    inline int _send_message(const std::string& user_id, const std::string& text, const std::string& attachment) {
+        mock_reply reply;
+        reply.user_id    = std::atoi(user_id.c_str());
+        reply.text       = text;
+        reply.attachment = attachment;
+        reply.received   = clock::now();
+        if (_reply_handler) {
+            _reply_handler(reply);
+        }
+        return _next_sent_id++;
+    }
+
+    [[nodiscard]] inline nlohmann::json _call_method(const std::string& name,
+        const std::unordered_map<std::string, std::string>& params) {
+        ++_method_calls;
+        if (_api_latency.count() != 0) {
+            std::this_thread::sleep_for(_api_latency);
+        }
+        const auto param = [&params](const char* key) {
+            const auto it = params.find(key);
+            return it == params.end() ? std::string() : it->second;
+        };
+
+        if (name == "groups.getLongPollServer") {
+            std::lock_guard lock(_updates_mutex);
+            return { { "response", {
+                { "server", _base_url() + "/lp" }, { "key", "mock" }, { "ts", std::to_string(_updates.size()) } } } };
+        }
+        if (name == "photos.getMessagesUploadServer") {
+            return { { "response", {
+                { "upload_url", _base_url() + "/upload" }, { "album_id", -3 }, { "user_id", 0 }, { "group_id", 1 } } } };
+        }
+        if (name == "photos.saveMessagesPhoto") {
+            if (param("hash") != "mock") {
+                return _error(100, "One of the parameters specified was missing or invalid");
+            }
+            return { { "response", nlohmann::json::array({ { { "id", _next_photo_id++ }, { "owner_id", -1 } } }) } };
+        }
+        if (name == "messages.send") {
+            return { { "response", _send_message(param("user_id"), param("message"), param("attachment")) } };
+        }
+        if (name == "execute") {
+            nlohmann::json response = nlohmann::json::array();
+            for (const auto& [call_name, call_params] : _parse_execute_code(param("code"))) {
+                if (call_name != "messages.send") {
+                    response.push_back(false);
+                    continue;
+                }
+                response.push_back(_send_message(call_params.value("user_id", ""),
+                    call_params.value("message", ""), call_params.value("attachment", "")));
+            }
+            return { { "response", response } };
+        }
+        return _error(3, "Unknown method passed");
+    }
+
+    [[nodiscard]] inline _response _long_poll(const std::unordered_map<std::string, std::string>& params) {
+        const auto ts_it   = params.find("ts");
+        const auto wait_it = params.find("wait");
+        const std::size_t ts = ts_it == params.end() ? 0 : std::stoul(ts_it->second);
+        const auto wait = std::chrono::seconds(wait_it == params.end() ? 25 : std::stol(wait_it->second));
+
+        ++_long_polls;
+        std::unique_lock lock(_updates_mutex);
+        if (ts > _updates.size()) {
+            return { 200, "application/json", nlohmann::json{ { "failed", 1 }, { "ts", std::to_string(_updates.size()) } }.dump() };
+        }
+        _updates_changed.wait_for(lock, wait, [this, ts] { return _stopped || _updates.size() > ts; });
+        std::string body = "{\"ts\":\"" + std::to_string(_updates.size()) + "\",\"updates\":[";
+        for (std::size_t i = ts; i < _updates.size(); ++i) {
+            if (i != ts) {
+                body += ',';
+            }
+            body += _updates[i];
+        }
+        body += "]}";
+        return { 200, "application/json", std::move(body) };
+    }
+
+    [[nodiscard]] inline _response _route(const _request& request) {
+        if (request.path.rfind("/method/", 0) == 0) {
+            const auto params = _parse_form(request.method == "POST" ? request.body : request.query);
+            return { 200, "application/json", _call_method(request.path.substr(8), params).dump() };
+        }
+        if (request.path == "/lp") {
+            return _long_poll(_parse_form(request.query));
+        }
+        if (request.path == "/upload") {
+            ++_uploads;
+            if (_api_latency.count() != 0) {
+                std::this_thread::sleep_for(_api_latency);
+            }
+            return { 200, "application/json", R"({"server":1,"photo":"[{\"mock\":1}]","hash":"mock"})" };
+        }
+        if (request.path.rfind("/photos/", 0) == 0) {
+            const std::size_t index = std::strtoul(request.path.c_str() + 8, nullptr, 10);
+            if (index < _photos.size()) {
+                return { 200, "image/jpeg", _photos[index].data };
+            }
+        }
+        return { 404, "text/plain", "not found" };
+    }
+
+    // reads one request, false when the connection is closed
+    [[nodiscard]] inline bool _read_request(const int connection, std::string& buffer, _request& request) {
+        char chunk[16384];
+        std::size_t headers_end = std::string::npos;
+        while ((headers_end = buffer.find("\r\n\r\n")) == std::string::npos) {
+            const auto received = recv(connection, chunk, sizeof(chunk), 0);
+            if (received <= 0) {
+                return false;
+            }
+            buffer.append(chunk, static_cast<std::size_t>(received));
+        }
+
+        const std::string headers = buffer.substr(0, headers_end);
+        buffer.erase(0, headers_end + 4);
+        const std::size_t method_end = headers.find(' ');
+        const std::size_t target_end = headers.find(' ', method_end + 1);
+        request.method = headers.substr(0, method_end);
+        const std::string target = headers.substr(method_end + 1, target_end - method_end - 1);
+        const std::size_t query_begin = target.find('?');
+        request.path  = target.substr(0, query_begin);
+        request.query = query_begin == std::string::npos ? std::string() : target.substr(query_begin + 1);
+
+        std::string lower_headers = headers;
+        std::transform(lower_headers.begin(), lower_headers.end(), lower_headers.begin(), [](const unsigned char c) {
+            return static_cast<char>(std::tolower(c));
+        });
+        std::size_t content_length = 0;
+        if (const auto length_pos = lower_headers.find("\r\ncontent-length:"); length_pos != std::string::npos) {
+            content_length = std::strtoul(lower_headers.c_str() + length_pos + 17, nullptr, 10);
+        }
+        request.keep_alive = lower_headers.find("\r\nconnection: close") == std::string::npos;
+        if (lower_headers.find("\r\nexpect: 100-continue") != std::string::npos) {
+            static constexpr char continue_answer[] = "HTTP/1.1 100 Continue\r\n\r\n";
+            send(connection, continue_answer, sizeof(continue_answer) - 1, MSG_NOSIGNAL);
+        }
+
+        while (buffer.size() < content_length) {
+            const auto received = recv(connection, chunk, sizeof(chunk), 0);
+            if (received <= 0) {
+                return false;
+            }
+            buffer.append(chunk, static_cast<std::size_t>(received));
+        }
+        request.body = buffer.substr(0, content_length);
+        buffer.erase(0, content_length);
+        return true;
+    }
+
+    // every stall_every-th method call or upload is never answered, the connection stays open
+    // until the server stops, so only a client timeout gets the caller out of it
+    [[nodiscard]] inline bool _stall(const _request& request) {
+        const bool api_request = request.path.rfind("/method/", 0) == 0 || request.path == "/upload";
+        if (_stall_every == 0 || !api_request || ++_api_requests % _stall_every != 0) {
+            return false;
+        }
+        ++_stalls;
+        std::unique_lock lock(_updates_mutex);
+        _updates_changed.wait(lock, [this] { return _stopped.load(); });
+        return true;
+    }
+
+    inline void _serve(const int connection) {
+        std::string buffer;
+        _request request;
+        while (!_stopped && _read_request(connection, buffer, request)) {
+            if (_stall(request)) {
+                break;
+            }
+            _response response;
+            try {
+                response = _route(request);
+            } catch (const std::exception& ex) {
+                response = { 500, "text/plain", ex.what() };
+            }
+            std::string answer = "HTTP/1.1 " + std::to_string(response.status) +
+                (response.status == 200 ? " OK" : " Error") + "\r\nContent-Type: " + response.content_type +
+                "\r\nContent-Length: " + std::to_string(response.body.size()) + "\r\n\r\n";
+            answer += response.body;
+            std::size_t sent_total = 0;
+            while (sent_total < answer.size()) {
+                const auto sent = send(connection, answer.data() + sent_total, answer.size() - sent_total, MSG_NOSIGNAL);
+                if (sent <= 0) {
+                    break;
+                }
+                sent_total += static_cast<std::size_t>(sent);
+            }
+            if (!request.keep_alive) {
+                break;
+            }
+        }
+        std::lock_guard lock(_connections_mutex);
+        _connections.erase(connection);
+        ::close(connection);
+    }
+
+    inline void _accept() {
+        pollfd fd{};
+        fd.fd     = _listener;
+        fd.events = POLLIN;
+        while (!_stopped) {
+            if (poll(&fd, 1, 100) <= 0) {
+                continue;
+            }
+            const int connection = accept(_listener, nullptr, nullptr);
+            if (connection == -1) {
+                continue;
+            }
+            std::lock_guard lock(_connections_mutex);
+            _connections.insert(connection);
+            _connection_threads.emplace_back(&mock_vk_server::_serve, this, connection);
+        }
+    }
+
+public:
+    // every file of photos_dir that is a jpeg or a png can be attached to pushed messages,
+    // port 0 picks a free port
+    inline explicit mock_vk_server(const std::filesystem::path& photos_dir, const std::uint16_t port = 0) {
+        for (const auto& entry : std::filesystem::directory_iterator(photos_dir)) {
+            if (!entry.is_regular_file()) {
+                continue;
+            }
+            const auto data = vk_graffiti_bot::read_file(entry.path());
+            vk_graffiti_bot::image_header header;
+            if (vk_graffiti_bot::probe_image_header(reinterpret_cast<const std::byte*>(data.data()), data.size(), header) !=
+                vk_graffiti_bot::image_probe_status::ok) {
+                continue;
+            }
+            _photos.push_back({ std::string(data.begin(), data.end()), header.width, header.height });
+        }
+        if (_photos.empty()) {
+            throw std::runtime_error("no photos in " + photos_dir.string());
+        }
+
+        _listener = socket(AF_INET, SOCK_STREAM, 0);
+        const int reuse = 1;
+        setsockopt(_listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        sockaddr_in address{};
+        address.sin_family      = AF_INET;
+        address.sin_port        = htons(port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(_listener, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 ||
+            listen(_listener, 128) != 0) {
+            ::close(_listener);
+            throw std::runtime_error("mock server bind error on port " + std::to_string(port));
+        }
+        socklen_t address_size = sizeof(address);
+        getsockname(_listener, reinterpret_cast<sockaddr*>(&address), &address_size);
+        _port = ntohs(address.sin_port);
+        _accept_thread = std::thread(&mock_vk_server::_accept, this);
+    }
+
+    mock_vk_server(const mock_vk_server&)            = delete;
+    mock_vk_server& operator=(const mock_vk_server&) = delete;
+
+    inline ~mock_vk_server() {
+        {
+            std::lock_guard lock(_updates_mutex);
+            _stopped = true;
+        }
+        _updates_changed.notify_all();
+        _accept_thread.join();
+        {
+            std::lock_guard lock(_connections_mutex);
+            for (const int connection : _connections) {
+                shutdown(connection, SHUT_RDWR);
+            }
+        }
+        for (auto& thread : _connection_threads) {
+            thread.join();
+        }
+        ::close(_listener);
+    }
+
+    [[nodiscard]] inline std::uint16_t get_port() const noexcept {
+        return _port;
+    }
+
+    // to be passed to base_vk_api::set_api_url
+    [[nodiscard]] inline std::string get_api_url() const {
+        return _base_url() + "/method/";
+    }
+
+    [[nodiscard]] inline std::size_t get_photos_count() const noexcept {
+        return _photos.size();
+    }
+
+    [[nodiscard]] inline std::size_t get_method_calls() const noexcept {
+        return _method_calls;
+    }
+
+    [[nodiscard]] inline std::size_t get_uploads() const noexcept {
+        return _uploads;
+    }
+
+    // a bot that has made a long poll request has its ts, messages pushed from then on reach it
+    [[nodiscard]] inline std::size_t get_long_polls() const noexcept {
+        return _long_polls;
+    }
+
+    // called on a connection thread for every message the bot sends, must be set before the bot starts
+    inline void set_reply_handler(reply_handler_type handler) {
+        _reply_handler = std::move(handler);
+    }
+
+    // added to every method call and upload, the real api answers in tens of milliseconds
+    inline void set_api_latency(const std::chrono::milliseconds latency) noexcept {
+        _api_latency = latency;
+    }
+
+    // 0 answers every request, must be set before the bot starts
+    inline void set_stall_every(const std::size_t stall_every) noexcept {
+        _stall_every = stall_every;
+    }
+
+    [[nodiscard]] inline std::size_t get_stalls() const noexcept {
+        return _stalls;
+    }
+
+    // makes a message_new update visible to the long poll, photos are indexes of the sample photos
+    inline void push_message(const int from_id, const std::string& text, const std::vector<std::size_t>& photos) {
+        nlohmann::json attachments = nlohmann::json::array();
+        for (const std::size_t index : photos) {
+            const _photo& photo = _photos.at(index);
+            attachments.push_back({ { "type", "photo" }, { "photo", {
+                { "id", static_cast<long long>(index) + 1 }, { "owner_id", from_id }, { "access_key", "mock" },
+                { "sizes", nlohmann::json::array({ {
+                    { "type", "w" }, { "url", _base_url() + "/photos/" + std::to_string(index) },
+                    { "width", photo.width }, { "height", photo.height } } }) } } } });
+        }
+
+        std::lock_guard lock(_updates_mutex);
+        const nlohmann::json update = { { "type", "message_new" }, { "object", { { "message", {
+            { "id", _next_message_id++ }, { "from_id", from_id }, { "peer_id", from_id },
+            { "text", text }, { "attachments", attachments } } } } } };
+        _updates.push_back(update.dump());
+        _updates_changed.notify_all();
+    }
+};
+} // benchmark
+
+#endif // !VK_GRAFFITI_BOT_MOCK_VK_SERVER_HPP
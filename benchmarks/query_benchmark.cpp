@@ -0,0 +1,113 @@
+#include "benchmark.hpp"
+#include "allocation_counter.hpp"
+
+#include "vk_api.hpp"
+
+#include <string>
+#include <cstdlib>
+
+using namespace vk_graffiti_bot;
+
+namespace {
+const std::string token(85, 'a');
+const vk_api_version version;
+const std::string text = "Here is your photo! \xD0\x92\xD0\xBE\xD1\x82 \xD1\x82\xD0\xB2\xD0\xBE\xD1\x91 \xD1\x84\xD0\xBE\xD1\x82\xD0\xBE";
+
+// the way urls were built before query_builder, kept as the baseline
+namespace legacy {
+class method {
+private:
+    std::string _string;
+
+public:
+    inline method(const std::string& name) :
+        _string("method/" + name + '?') {}
+
+    inline void add_param(const std::string name, const std::string& value) {
+        _string += name + '=' + value + '&';
+    }
+
+    [[nodiscard]] inline const std::string& to_string() const noexcept {
+        return _string;
+    }
+};
+
+// curl_wrapper::encode_url returned a new string, curl's own malloc is not counted here
+std::string encode_url(const std::string& value) {
+    std::string encoded;
+    append_url_encoded(encoded, value);
+    return encoded;
+}
+
+std::string send_url() {
+    method method("messages.send");
+    method.add_param("user_id", std::to_string(123456789));
+    method.add_param("random_id", "0");
+    method.add_param("message", encode_url(text));
+    return "https://api.vk.com/" + method.to_string() + "access_token=" + token + "&v=" + version.to_string();
+}
+
+std::string long_poll_url(const long_poll_server& server, const std::size_t wait) {
+    return server.server + "?act=a_check&key=" + server.key + "&ts=" + server.ts + "&wait=" + std::to_string(wait);
+}
+} // legacy
+
+// the url and the post body are built into buffers kept between calls
+const std::string& send_request() {
+    thread_local std::string url;
+    thread_local std::string body;
+    thread_local std::string request;
+    url.clear();
+    body.clear();
+    method method("messages.send");
+    method.add_param("user_id", 123456789);
+    method.add_param("random_id", 0);
+    method.add_param("message", text);
+    append_method_url(url, method);
+    append_method_body(body, method, token, version);
+    // joined only to compare with the old url, the bot sends body separately
+    request.assign(url).append(1, '?').append(body);
+    return request;
+}
+
+const std::string& long_poll_url(const long_poll_server& server, const std::size_t wait) {
+    thread_local std::string url;
+    url.clear();
+    append_long_poll_url(url, server, wait);
+    return url;
+}
+
+template <typename Func>
+void measure(const std::string& name, Func&& func) {
+    const double allocations = benchmark::allocations_per_call(func);
+    const auto result        = benchmark::run(func);
+    benchmark::report(name, result, std::to_string(allocations) + " allocations per call");
+}
+} // namespace
+
+int main() {
+    // both builders have to produce the same url
+    if (legacy::send_url() != send_request()) {
+        std::printf("requests differ:\n%s\n%s\n", legacy::send_url().c_str(), send_request().c_str());
+        return EXIT_FAILURE;
+    }
+
+    long_poll_server server;
+    server.server = "https://lp.vk.com/wh123456789";
+    server.key    = std::string(40, 'k');
+    server.ts     = "1234";
+
+    measure("messages.send url/legacy", [] {
+        benchmark::do_not_optimize(legacy::send_url());
+    });
+    measure("messages.send request/query_builder", [] {
+        benchmark::do_not_optimize(send_request());
+    });
+    measure("long poll url/legacy", [&] {
+        benchmark::do_not_optimize(legacy::long_poll_url(server, 25));
+    });
+    measure("long poll url/thread_local buffer", [&] {
+        benchmark::do_not_optimize(long_poll_url(server, 25));
+    });
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,240 @@
+#include "benchmark.hpp"
+#include "allocation_counter.hpp"
+
+#include "graffiti_bot.hpp"
+
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+
+// Measures the steps a photo goes through between the download and the upload:
+// caption parsing and conversion, rasterizing, compositing, and jpeg decoding and encoding.
+//
+// render_benchmark --font PATH [--render-texture]
+//
+// Images from 640x480 to 2560x1440 are generated, the character size is scaled with the image
+// the way the bot does it. --render-texture also measures render_mode::render_texture,
+// which needs an OpenGL context.
+
+using namespace vk_graffiti_bot;
+
+namespace benchmark {
+// forwards to the private render steps of graffiti_bot
+struct graffiti_bot_access {
+    using info_type = graffiti_bot::_graffiti_info;
+
+    static constexpr float outline_thickness = graffiti_bot::_outline_thickness;
+
+    [[nodiscard]] static inline info_type parse_text(const std::string& text) {
+        return graffiti_bot::_parse_text(text);
+    }
+
+    [[nodiscard]] static inline std::wstring string_to_wstring(const std::string& string) {
+        return graffiti_bot::string_to_wstring(string);
+    }
+
+    [[nodiscard]] static inline std::u32string string_to_u32string(const std::string& string) {
+        return graffiti_bot::string_to_u32string(string);
+    }
+
+    static inline void process_image_cpu(graffiti_bot& bot, text_rasterizer& rasterizer,
+        sf::Image& image, const info_type& info) {
+        bot._process_image_cpu(rasterizer, image, info);
+    }
+
+    static inline void process_image(sf::Text& text, sf::Image& image, const info_type& info) {
+        graffiti_bot::_process_image(text, image, info);
+    }
+};
+} // benchmark
+
+namespace {
+using access = benchmark::graffiti_bot_access;
+
+struct caption {
+    const char* name;
+    std::string text;
+};
+
+struct image_size {
+    unsigned width;
+    unsigned height;
+};
+
+const std::vector<caption> captions = {
+    { "short", "Hi" },
+    { "medium", "72 \xD0\x9F\xD1\x80\xD0\xB8\xD0\xB2\xD0\xB5\xD1\x82, \xD0\xBC\xD0\xB8\xD1\x80! Hello there" },
+    { "long", "24 Long caption that has to be drawn over the whole photo, "
+        "\xD0\xB4\xD0\xBB\xD0\xB8\xD0\xBD\xD0\xBD\xD0\xB0\xD1\x8F \xD0\xBF\xD0\xBE\xD0\xB4\xD0\xBF\xD0\xB8\xD1\x81\xD1\x8C "
+        "\xD0\xBD\xD0\xB0 \xD0\xB2\xD1\x81\xD1\x8E \xD1\x84\xD0\xBE\xD1\x82\xD0\xBE\xD0\xB3\xD1\x80\xD0\xB0\xD1\x84\xD0\xB8\xD1\x8E "
+        "with several words in it and some more words after them" }
+};
+
+const image_size image_sizes[] = { { 640, 480 }, { 1280, 960 }, { 1920, 1080 }, { 2560, 1440 } };
+
+// heavy steps are counted over a few calls only
+constexpr std::size_t image_allocation_calls = 5;
+
+[[noreturn]] void usage(const char* error) {
+    std::fprintf(stderr, "%s\nusage: render_benchmark --font PATH [--render-texture]\n", error);
+    std::exit(EXIT_FAILURE);
+}
+
+std::vector<char> read_file(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        usage(("can't open " + path).c_str());
+    }
+    return std::vector<char>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+// a gradient with noise, so the jpeg encoder has some detail to work on
+sf::Image make_image(const image_size size, std::mt19937& random) {
+    std::uniform_int_distribution<int> noise(0, 31);
+    std::vector<sf::Uint8> pixels(static_cast<std::size_t>(size.width) * size.height * 4);
+    for (unsigned y = 0; y < size.height; ++y) {
+        for (unsigned x = 0; x < size.width; ++x) {
+            auto pixel = pixels.data() + (static_cast<std::size_t>(y) * size.width + x) * 4;
+            pixel[0] = static_cast<sf::Uint8>(x * 224 / size.width + noise(random));
+            pixel[1] = static_cast<sf::Uint8>(y * 224 / size.height + noise(random));
+            pixel[2] = static_cast<sf::Uint8>((x + y) * 112 / (size.width + size.height) + noise(random));
+            pixel[3] = 255;
+        }
+    }
+    sf::Image image;
+    image.create(size.width, size.height, pixels.data());
+    return image;
+}
+
+// the bot scales the default size of 100 from the 1280 px target dimension
+float character_size(const image_size size) {
+    return std::max(1.f, std::round(100.f * static_cast<float>(std::max(size.width, size.height)) / 1280.f));
+}
+
+std::string size_name(const image_size size) {
+    return std::to_string(size.width) + 'x' + std::to_string(size.height);
+}
+
+std::string allocations_text(const double allocations) {
+    char buffer[64];
+    std::snprintf(buffer, sizeof(buffer), "%.1f allocations per call", allocations);
+    return buffer;
+}
+
+std::string throughput_text(const benchmark::result& result, const image_size size, const double allocations) {
+    const double megapixels = static_cast<double>(size.width) * size.height / 1e6;
+    char buffer[96];
+    std::snprintf(buffer, sizeof(buffer), "%8.1f Mpx/s, ", megapixels / (result.ns_per_iteration / 1e9));
+    return buffer + allocations_text(allocations);
+}
+
+template <typename Func>
+void measure(const std::string& name, Func&& func) {
+    const double allocations = benchmark::allocations_per_call(func);
+    benchmark::report(name, benchmark::run(func), allocations_text(allocations));
+}
+
+template <typename Func>
+void measure_image(const std::string& name, const image_size size, Func&& func) {
+    const double allocations = benchmark::allocations_per_call(func, image_allocation_calls);
+    const auto result        = benchmark::run(func);
+    benchmark::report(name, result, throughput_text(result, size, allocations));
+}
+} // namespace
+
+int main(int argc, char** argv) {
+    std::string font_path;
+    bool render_texture = false;
+    for (int i = 1; i < argc; ++i) {
+        const std::string name = argv[i];
+        if (name == "--render-texture") {
+            render_texture = true;
+        } else if (name == "--font" && i + 1 < argc) {
+            font_path = argv[++i];
+        } else {
+            usage(("unknown option " + name).c_str());
+        }
+    }
+    if (font_path.empty()) {
+        usage("--font is required");
+    }
+    const auto font_data = read_file(font_path);
+
+    for (const auto& caption : captions) {
+        measure("parse_text/" + std::string(caption.name), [&] {
+            benchmark::do_not_optimize(access::parse_text(caption.text));
+        });
+        measure("string_to_wstring/" + std::string(caption.name), [&] {
+            benchmark::do_not_optimize(access::string_to_wstring(caption.text));
+        });
+        measure("string_to_u32string/" + std::string(caption.name), [&] {
+            benchmark::do_not_optimize(access::string_to_u32string(caption.text));
+        });
+    }
+
+    curl_wrapper curl;
+    vk_api api(curl, "benchmark");
+    graffiti_bot bot(api, 1, render_mode::cpu);
+    text_rasterizer rasterizer(font_data.data(), font_data.size(), access::outline_thickness);
+
+    sf::Font font;
+    sf::Text text;
+    if (render_texture) {
+        if (!font.loadFromMemory(font_data.data(), font_data.size())) {
+            usage("load font error");
+        }
+        text.setFont(font);
+        text.setFillColor(sf::Color::White);
+        text.setOutlineThickness(access::outline_thickness);
+        text.setOutlineColor(sf::Color::Black);
+    }
+
+    std::mt19937 random(42);
+    for (const auto size : image_sizes) {
+        const auto source = make_image(size, random);
+        const auto jpeg   = encode_jpeg(source, bot.get_jpeg_quality());
+
+        measure_image("decode/" + size_name(size), size, [&] {
+            sf::Image image;
+            if (!image.loadFromMemory(jpeg.data(), jpeg.size())) {
+                usage("decode error");
+            }
+            benchmark::do_not_optimize(image.getPixelsPtr());
+        });
+
+        for (const auto& caption : captions) {
+            auto info = access::parse_text(caption.text);
+            info.character_size = character_size(size);
+            const std::string suffix = '/' + size_name(size) + '/' + caption.name;
+
+            // the glyphs stay cached in the rasterizer, this is the cost of a caption missing the mask cache
+            const auto u32text = access::string_to_u32string(info.text);
+            measure("rasterize" + suffix, [&] {
+                benchmark::do_not_optimize(rasterizer.rasterize(u32text, static_cast<unsigned>(*info.character_size)));
+            });
+
+            // the caption is drawn over and over on the same image, its mask comes from the cache
+            auto image = source;
+            measure_image("composite_cpu" + suffix, size, [&] {
+                access::process_image_cpu(bot, rasterizer, image, info);
+                benchmark::do_not_optimize(image.getPixelsPtr());
+            });
+
+            if (render_texture) {
+                measure_image("composite_render_texture" + suffix, size, [&] {
+                    image = source;
+                    access::process_image(text, image, info);
+                    benchmark::do_not_optimize(image.getPixelsPtr());
+                });
+            }
+        }
+
+        measure_image("encode_jpeg/" + size_name(size), size, [&] {
+            benchmark::do_not_optimize(encode_jpeg(source, bot.get_jpeg_quality()));
+        });
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,281 @@
+#ifndef VK_GRAFFITI_BOT_API_SCHEDULER_HPP
+#define VK_GRAFFITI_BOT_API_SCHEDULER_HPP
+
+#include "utils.hpp"
+
+#include <array>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <random>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <condition_variable>
+
+VK_GRAFFITI_BOT_BEGIN
+// higher priority calls are sent first when the rate limit is reached
+enum class call_priority {
+    high,
+    normal,
+    low
+};
+
+struct retry_policy {
+    // the first try included
+    std::size_t max_attempts = 4;
+    std::chrono::milliseconds base_delay{ 250 };
+    std::chrono::milliseconds max_delay{ 8000 };
+
+    // exponential backoff with jitter, so throttled workers do not retry all at once
+    [[nodiscard]] inline std::chrono::milliseconds delay(const std::size_t attempt) const {
+        thread_local std::minstd_rand random(std::random_device{}());
+        const auto shift   = static_cast<unsigned>(std::min<std::size_t>(attempt, 16));
+        const auto ceiling = std::min(max_delay.count(), base_delay.count() << shift);
+        const auto half    = ceiling / 2;
+        std::uniform_int_distribution<long long> jitter(0, half);
+        return std::chrono::milliseconds(ceiling - half + jitter(random));
+    }
+};
+
+struct api_scheduler_metrics {
+    std::size_t queue_depth     = 0;
+    std::size_t max_queue_depth = 0;
+    std::size_t sent            = 0;
+    // calls that had to wait for the token bucket
+    std::size_t throttled       = 0;
+    std::chrono::microseconds throttle_time{ 0 };
+    std::size_t retries         = 0;
+    std::size_t rate_limit_errors = 0;
+};
+
+// Token bucket shared by every api that uses the same token.
+// Calls are started on the scheduler thread in priority order as tokens become available,
+// delayed calls (retries) join the queue once their delay is over.
+class api_scheduler {
+public:
+    using clock     = std::chrono::steady_clock;
+    using task_type = std::function<void()>;
+
+private:
+    struct _entry {
+        clock::time_point not_before;
+        clock::time_point enqueued;
+        call_priority priority;
+        task_type start;
+    };
+
+    static constexpr std::size_t _priorities_count = 3;
+
+    std::mutex _mutex;
+    std::condition_variable _changed;
+    std::array<std::deque<_entry>, _priorities_count> _ready;
+    std::vector<_entry> _delayed;
+    double _requests_per_second;
+    double _burst;
+    double _tokens;
+    clock::time_point _last_refill = clock::now();
+    bool _stopped = false;
+
+    std::size_t _queue_depth     = 0;
+    std::size_t _max_queue_depth = 0;
+    std::atomic<std::size_t> _sent      = 0;
+    std::atomic<std::size_t> _throttled = 0;
+    std::atomic<long long> _throttle_time_us   = 0;
+    std::atomic<std::size_t> _retries           = 0;
+    std::atomic<std::size_t> _rate_limit_errors = 0;
+    std::thread _thread;
+
+    [[nodiscard]] static inline bool _later(const _entry& lhs, const _entry& rhs) noexcept {
+        return lhs.not_before > rhs.not_before;
+    }
+
+    inline void _refill(const clock::time_point now) noexcept {
+        const std::chrono::duration<double> elapsed = now - _last_refill;
+        _tokens      = std::min(_burst, _tokens + elapsed.count() * _requests_per_second);
+        _last_refill = now;
+    }
+
+    inline void _move_due_delayed(const clock::time_point now) {
+        while (!_delayed.empty() && _delayed.front().not_before <= now) {
+            std::pop_heap(_delayed.begin(), _delayed.end(), _later);
+            auto& entry = _delayed.back();
+            entry.enqueued = now;
+            _ready[static_cast<std::size_t>(entry.priority)].push_back(std::move(entry));
+            _delayed.pop_back();
+        }
+    }
+
+    [[nodiscard]] inline std::deque<_entry>* _first_ready() noexcept {
+        for (auto& queue : _ready) {
+            if (!queue.empty()) {
+                return &queue;
+            }
+        }
+        return nullptr;
+    }
+
+    static inline void _start(const task_type& start) noexcept {
+        try {
+            start();
+        } catch (const std::exception& ex) {
+            log_error(ex.what());
+        }
+    }
+
+    inline void _run() {
+        std::unique_lock lock(_mutex);
+        while (!_stopped) {
+            const auto now = clock::now();
+            _move_due_delayed(now);
+            auto* queue = _first_ready();
+            if (!queue) {
+                if (_delayed.empty()) {
+                    _changed.wait(lock);
+                } else {
+                    _changed.wait_until(lock, _delayed.front().not_before);
+                }
+                continue;
+            }
+
+            _refill(now);
+            if (_tokens < 1) {
+                const auto wait = std::chrono::duration<double>((1 - _tokens) / _requests_per_second);
+                _changed.wait_until(lock, now + std::chrono::duration_cast<clock::duration>(wait));
+                continue;
+            }
+            _tokens -= 1;
+
+            _entry entry = std::move(queue->front());
+            queue->pop_front();
+            --_queue_depth;
+            const auto waited = std::chrono::duration_cast<std::chrono::microseconds>(now - entry.enqueued);
+            // anything under a millisecond is just the hand-off between threads
+            if (waited >= std::chrono::milliseconds(1)) {
+                ++_throttled;
+                _throttle_time_us += waited.count();
+            }
+            ++_sent;
+
+            lock.unlock();
+            _start(entry.start);
+            lock.lock();
+        }
+
+        // nothing is dropped on shutdown, the calls still waiting are started right away
+        for (auto& queue : _ready) {
+            for (auto& entry : queue) {
+                _start(entry.start);
+            }
+            queue.clear();
+        }
+        for (auto& entry : _delayed) {
+            _start(entry.start);
+        }
+        _delayed.clear();
+        _queue_depth = 0;
+    }
+
+public:
+    inline explicit api_scheduler(const double requests_per_second = 20, const double burst = 0) :
+        _requests_per_second(requests_per_second),
+        _burst(burst > 0 ? burst : requests_per_second),
+        _tokens(_burst) {
+        if (requests_per_second <= 0) {
+            throw std::invalid_argument(VK_GRAFFITI_BOT_FUNC_MSG("requests per second must be positive"));
+        }
+        _thread = std::thread(&api_scheduler::_run, this);
+    }
+
+    api_scheduler(const api_scheduler&)            = delete;
+    api_scheduler& operator=(const api_scheduler&) = delete;
+
+    inline ~api_scheduler() {
+        {
+            std::lock_guard lock(_mutex);
+            _stopped = true;
+        }
+        _changed.notify_all();
+        if (_thread.joinable()) {
+            _thread.join();
+        }
+    }
+
+    // start is called on the scheduler thread and must not block
+    inline void schedule(const call_priority priority, task_type start,
+        const std::chrono::milliseconds delay = std::chrono::milliseconds(0)) {
+        {
+            std::lock_guard lock(_mutex);
+            if (_stopped) {
+                throw std::runtime_error(VK_GRAFFITI_BOT_FUNC_MSG("scheduler is stopped"));
+            }
+            const auto now = clock::now();
+            _entry entry{ now + delay, now, priority, std::move(start) };
+            if (delay.count() > 0) {
+                _delayed.push_back(std::move(entry));
+                std::push_heap(_delayed.begin(), _delayed.end(), _later);
+            } else {
+                _ready[static_cast<std::size_t>(priority)].push_back(std::move(entry));
+            }
+            _max_queue_depth = std::max(_max_queue_depth, ++_queue_depth);
+        }
+        _changed.notify_one();
+    }
+
+    // blocks until the call may be sent
+    inline void acquire(const call_priority priority) {
+        std::promise<void> granted;
+        auto future = granted.get_future();
+        schedule(priority, [&granted] {
+            granted.set_value();
+        });
+        future.get();
+    }
+
+    inline void record_retry(const bool rate_limited) noexcept {
+        ++_retries;
+        if (rate_limited) {
+            ++_rate_limit_errors;
+        }
+    }
+
+    [[nodiscard]] inline double get_requests_per_second() {
+        std::lock_guard lock(_mutex);
+        return _requests_per_second;
+    }
+
+    inline void set_requests_per_second(const double requests_per_second, const double burst = 0) {
+        if (requests_per_second <= 0) {
+            throw std::invalid_argument(VK_GRAFFITI_BOT_FUNC_MSG("requests per second must be positive"));
+        }
+        {
+            std::lock_guard lock(_mutex);
+            _refill(clock::now());
+            _requests_per_second = requests_per_second;
+            _burst  = burst > 0 ? burst : requests_per_second;
+            _tokens = std::min(_tokens, _burst);
+        }
+        _changed.notify_one();
+    }
+
+    [[nodiscard]] inline api_scheduler_metrics get_metrics() {
+        api_scheduler_metrics metrics;
+        {
+            std::lock_guard lock(_mutex);
+            metrics.queue_depth     = _queue_depth;
+            metrics.max_queue_depth = _max_queue_depth;
+        }
+        metrics.sent              = _sent;
+        metrics.throttled         = _throttled;
+        metrics.throttle_time     = std::chrono::microseconds(_throttle_time_us.load());
+        metrics.retries           = _retries;
+        metrics.rate_limit_errors = _rate_limit_errors;
+        return metrics;
+    }
+};
+VK_GRAFFITI_BOT_END
+
+#endif // !VK_GRAFFITI_BOT_API_SCHEDULER_HPP
@@ -2,56 +2,202 @@
 #define VK_GRAFFITI_BOT_BASE_VK_BOT_HPP
 
 #include "vk_api.hpp"
+#include "worker_pool.hpp"
+#include "cursor_store.hpp"
+
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <cstdint>
+#include <optional>
+#include <algorithm>
+#include <condition_variable>
 
 VK_GRAFFITI_BOT_BEGIN
+// Connection state owned by a single worker thread.
+class bot_worker {
+private:
+    std::size_t _index;
+    curl_wrapper _curl;
+    vk_api _api;
+
+public:
+    inline bot_worker(const std::size_t index, const base_vk_api& api) :
+        _index(index),
+        _curl(api.curl().get_handle_pool(), api.curl().get_engine()),
+        _api(_curl, api) {}
+
+    bot_worker(const bot_worker&)            = delete;
+    bot_worker& operator=(const bot_worker&) = delete;
+
+    [[nodiscard]] inline std::size_t index() const noexcept {
+        return _index;
+    }
+
+    [[nodiscard]] inline curl_wrapper& curl() noexcept {
+        return _curl;
+    }
+
+    [[nodiscard]] inline vk_api& api() noexcept {
+        return _api;
+    }
+};
+
 class base_vk_bot {
 private:
+    // the worker pool of all bots made with the sharing constructor,
+    // it is created by the first of them to start and stopped by the last one to stop
+    struct _shared_pool {
+        std::mutex mutex;
+        std::shared_ptr<worker_pool> pool;
+        std::size_t running = 0;
+    };
+
     vk_api& _api;
     int _group_id;
+    std::size_t _workers_count  = 4;
+    std::size_t _queue_capacity = 256;
+    std::vector<std::unique_ptr<bot_worker>> _workers;
+    std::shared_ptr<_shared_pool> _shared_pool_state = std::make_shared<_shared_pool>();
+    std::shared_ptr<worker_pool> _pool;
+    std::atomic<bool> _stop_requested = false;
 
-    inline void _process_updates(const nlohmann::json& updates) {
-        for (const auto& update : updates) {
-            if (update["type"].get<std::string>() == "message_new") {
-                const auto message_json = update["object"]["message"];
-                const auto from_id      = message_json["from_id"].get<int>();
-                const auto text         = message_json["text"].get<std::string>();
-                const auto attachment   = message_json["attachments"].dump();
-                on_new_message(from_id, { text, attachment });
-            }
+    // messages of this bot queued or running in the pool, other bots may still use the pool when it stops
+    std::mutex _pending_mutex;
+    std::condition_variable _pending_done;
+    std::size_t _pending_messages = 0;
+
+    // The ts of a long poll answer is stored only after its messages and the messages
+    // of all earlier answers are handled, so a restart never skips a message.
+    struct _poll_batch {
+        std::string ts;
+        std::size_t remaining = 0;
+    };
+
+    std::unique_ptr<cursor_store> _cursor_store;
+    std::mutex _batches_mutex;
+    std::map<std::uint64_t, _poll_batch> _batches;
+    std::uint64_t _next_batch = 0;
+
+    // expects _batches_mutex to be locked
+    inline void _acknowledge_finished_batches() {
+        std::string ts;
+        while (!_batches.empty() && _batches.begin()->second.remaining == 0) {
+            ts = std::move(_batches.begin()->second.ts);
+            _batches.erase(_batches.begin());
+        }
+        if (!ts.empty()) {
+            _cursor_store->set_ts(ts);
         }
     }
 
-protected:
-    [[nodiscard]] inline vk_api& api() noexcept {
-        return _api;
+    inline void _finish_message(const std::uint64_t batch, const long long message_id) {
+        if (message_id != 0) {
+            _cursor_store->mark_done(message_id);
+        }
+        std::lock_guard lock(_batches_mutex);
+        --_batches[batch].remaining;
+        _acknowledge_finished_batches();
     }
 
-    virtual inline void on_new_message(const int from_id, const message& message_recv) {}
+    // senders are serialized per group, a user writing to two groups is handled by both at once
+    [[nodiscard]] inline worker_pool::key_type _pool_key(const int from_id) const noexcept {
+        return (static_cast<worker_pool::key_type>(_group_id) << 32) | static_cast<std::uint32_t>(from_id);
+    }
 
-public:
-    inline base_vk_bot(vk_api& api, const int group_id) noexcept :
-        _api(api),
-        _group_id(group_id) {}
+    // batch is the long poll answer the message came in, when there is a cursor file
+    inline void _push_message(incoming_message message_recv, const std::optional<std::uint64_t> batch) {
+        {
+            std::lock_guard lock(_pending_mutex);
+            ++_pending_messages;
+        }
+        const int from_id = message_recv.from_id;
+        try {
+            _pool->push_deferred(_pool_key(from_id), [this, batch, message_recv = std::move(message_recv)](
+                const std::size_t index, worker_pool::key_release release) {
+                log_request_scope request_scope(message_recv.id);
+                message_done done(nullptr, [this, batch, message_id = message_recv.id,
+                    release = std::move(release)](void*) mutable {
+                    if (batch) {
+                        try {
+                            _finish_message(*batch, message_id);
+                        } catch (const std::exception& ex) {
+                            log_error(ex.what());
+                        }
+                    }
+                    release.reset();
+                    _finish_pending();
+                });
+                try {
+                    on_new_message(*_workers[index], message_recv, std::move(done));
+                } catch (const std::exception& ex) {
+                    log_error(ex.what());
+                } catch (...) {
+                    log_error(VK_GRAFFITI_BOT_FUNC_MSG("unknown exception in message handler"));
+                }
+            });
+        } catch (...) {
+            _finish_pending();
+            throw;
+        }
+    }
 
-    [[nodiscard]] inline int get_group_id() const noexcept {
-        return _group_id;
+    inline void _finish_pending() {
+        std::lock_guard lock(_pending_mutex);
+        if (--_pending_messages == 0) {
+            _pending_done.notify_all();
+        }
     }
 
-    inline void set_group_id(const int group_id) noexcept {
-        _group_id = group_id;
+    inline void _process_updates(std::vector<incoming_message>& messages, const std::string& ts) {
+        if (!_cursor_store) {
+            for (auto& message_recv : messages) {
+                _push_message(std::move(message_recv), std::nullopt);
+            }
+            return;
+        }
+
+        // messages replayed after a restart that were already handled are skipped
+        messages.erase(std::remove_if(messages.begin(), messages.end(), [this](const incoming_message& message_recv) {
+            return message_recv.id != 0 && _cursor_store->is_done(message_recv.id);
+        }), messages.end());
+        const std::uint64_t batch = _next_batch++;
+        {
+            std::lock_guard lock(_batches_mutex);
+            _batches[batch] = { ts, messages.size() };
+            _acknowledge_finished_batches();
+        }
+        for (auto& message_recv : messages) {
+            _push_message(std::move(message_recv), batch);
+        }
     }
 
-    inline void start(const std::size_t wait = 25) {
+    inline void _poll(const std::size_t wait) {
         auto groups = _api.groups();
         auto server = groups.get_long_poll_server(_group_id);
-        while (true) {
-            const auto answer = _api.connect_to_long_poll_server(server, wait);
+        if (_cursor_store) {
+            if (auto ts = _cursor_store->get_ts()) {
+                server.ts = std::move(*ts);
+            }
+        }
+        while (!_stop_requested) {
+            long_poll_response answer;
+            try {
+                answer = _api.poll_long_poll_server(server, wait);
+            } catch (const std::exception& ex) {
+                // a timed out or broken poll is made again with the same ts, no update is lost
+                log_warning(ex.what());
+                std::this_thread::sleep_for(std::chrono::seconds(1));
+                continue;
+            }
 
-            if (answer.contains("failed")) {
-                const int code = answer["failed"];
-                switch(code) {
+            if (answer.failed) {
+                switch(*answer.failed) {
                 case 1:
-                    server.ts = answer["ts"].get<std::string>();
+                    server.ts = answer.ts;
                     continue;
                 break;
                 case 2:
@@ -65,9 +211,137 @@ public:
                 }
             }
 
-            _process_updates(answer["updates"]);
-            server.ts = answer["ts"].get<std::string>();
+            _process_updates(answer.messages, answer.ts);
+            server.ts = answer.ts;
+        }
+    }
+
+    // waits for the messages of this bot, the last bot to stop stops the pool
+    inline void _stop_pool() {
+        {
+            std::unique_lock lock(_pending_mutex);
+            _pending_done.wait(lock, [this] { return _pending_messages == 0; });
         }
+        try {
+            on_stop();
+        } catch (const std::exception& ex) {
+            log_error(ex.what());
+        }
+        std::shared_ptr<worker_pool> pool;
+        {
+            std::lock_guard lock(_shared_pool_state->mutex);
+            if (--_shared_pool_state->running == 0) {
+                pool = std::move(_shared_pool_state->pool);
+            }
+        }
+        _pool.reset();
+        if (pool) {
+            pool->stop();
+        }
+    }
+
+protected:
+    // Copies of it travel with the work started for a message, the message is handled once the last one
+    // is destroyed: the cursor may move past it and the next message of the same sender starts.
+    using message_done = std::shared_ptr<void>;
+
+    [[nodiscard]] inline vk_api& api() noexcept {
+        return _api;
+    }
+
+    // called from start before the workers begin to receive messages
+    virtual inline void on_start(const std::size_t workers_count) {}
+
+    // called from start once the messages of this bot are handled
+    virtual inline void on_stop() {}
+
+    // Called on one of the worker threads, messages from the same sender are handled in order.
+    // Work that outlives the call keeps a copy of done, so the worker is free for other senders meanwhile.
+    virtual inline void on_new_message(bot_worker& worker, const incoming_message& message_recv,
+        message_done done) {}
+
+public:
+    inline base_vk_bot(vk_api& api, const int group_id) :
+        _api(api),
+        _group_id(group_id) {}
+
+    // polls another group through api but hands the messages to the worker pool of shared_bot,
+    // so several groups are served by one set of threads, the pool settings are taken from shared_bot
+    inline base_vk_bot(vk_api& api, const int group_id, const base_vk_bot& shared_bot) :
+        _api(api),
+        _group_id(group_id),
+        _workers_count(shared_bot._workers_count),
+        _queue_capacity(shared_bot._queue_capacity),
+        _shared_pool_state(shared_bot._shared_pool_state) {}
+
+    virtual ~base_vk_bot() = default;
+
+    [[nodiscard]] inline int get_group_id() const noexcept {
+        return _group_id;
+    }
+
+    inline void set_group_id(const int group_id) noexcept {
+        _group_id = group_id;
+    }
+
+    [[nodiscard]] inline std::size_t get_workers_count() const noexcept {
+        return _workers_count;
+    }
+
+    [[nodiscard]] inline std::size_t get_queue_capacity() const noexcept {
+        return _queue_capacity;
+    }
+
+    inline void set_workers_count(const std::size_t count) {
+        if (count == 0) {
+            throw std::invalid_argument(VK_GRAFFITI_BOT_FUNC_MSG("workers count must be positive"));
+        }
+        _workers_count = count;
+    }
+
+    inline void set_queue_capacity(const std::size_t capacity) {
+        if (capacity == 0) {
+            throw std::invalid_argument(VK_GRAFFITI_BOT_FUNC_MSG("queue capacity must be positive"));
+        }
+        _queue_capacity = capacity;
+    }
+
+    // the bot resumes from the ts stored in the file and does not handle the same message twice,
+    // must be set before start
+    inline void set_cursor_file(const std::filesystem::path& path) {
+        _cursor_store = std::make_unique<cursor_store>(path);
+    }
+
+    // polls until stop is called, the messages received by then are handled before it returns.
+    // Bots sharing a pool are started from threads of their own, the first one to start creates the pool.
+    inline void start(const std::size_t wait = 25) {
+        _stop_requested = false;
+        {
+            std::lock_guard lock(_shared_pool_state->mutex);
+            if (_shared_pool_state->running == 0) {
+                _shared_pool_state->pool = std::make_shared<worker_pool>(_workers_count, _queue_capacity);
+            }
+            ++_shared_pool_state->running;
+            _pool = _shared_pool_state->pool;
+        }
+        try {
+            // every bot has its own connections for each thread of the pool
+            _workers.clear();
+            for (std::size_t i = 0; i < _pool->get_workers_count(); ++i) {
+                _workers.push_back(std::make_unique<bot_worker>(i, _api));
+            }
+            on_start(_workers.size());
+            _poll(wait);
+        } catch (...) {
+            _stop_pool();
+            throw;
+        }
+        _stop_pool();
+    }
+
+    // start returns once the current long poll request ends, which takes up to its wait time
+    inline void stop() noexcept {
+        _stop_requested = true;
     }
 };
 VK_GRAFFITI_BOT_END
@@ -0,0 +1,235 @@
+#ifndef VK_GRAFFITI_BOT_BLEND_HPP
+#define VK_GRAFFITI_BOT_BLEND_HPP
+
+#include "utils.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+
+#if !defined(VK_GRAFFITI_BOT_DISABLE_SIMD)
+# if (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+#  define VK_GRAFFITI_BOT_BLEND_X86
+#  define VK_GRAFFITI_BOT_TARGET_AVX2 __attribute__((target("avx2")))
+# elif defined(_MSC_VER) && defined(_M_X64)
+#  define VK_GRAFFITI_BOT_BLEND_X86
+#  define VK_GRAFFITI_BOT_TARGET_AVX2
+#  include <intrin.h>
+# endif
+#endif
+
+#if defined(VK_GRAFFITI_BOT_BLEND_X86)
+# include <immintrin.h>
+#endif
+
+VK_GRAFFITI_BOT_BEGIN
+// Blends "solid color x 8-bit coverage" over RGBA8 pixels: first the outline layer, then the fill layer.
+// Every kernel uses the same integer arithmetic, so all of them give bit-identical results.
+enum class blend_kernel {
+    scalar,
+    sse2,
+    avx2
+};
+
+struct blend_color {
+    std::uint8_t r = 0;
+    std::uint8_t g = 0;
+    std::uint8_t b = 0;
+    std::uint8_t a = 255;
+};
+
+namespace details {
+// x / 255 rounded to nearest, exact for x in [0, 255 * 255]
+[[nodiscard]] constexpr unsigned div_255(const unsigned x) noexcept {
+    return ((x + 128) + ((x + 128) >> 8)) >> 8;
+}
+
+inline void blend_layer_scalar(std::uint8_t* pixel, const blend_color& color, const unsigned coverage) noexcept {
+    const unsigned alpha = div_255(coverage * color.a);
+    const unsigned inv   = 255 - alpha;
+    pixel[0] = static_cast<std::uint8_t>(div_255(pixel[0] * inv + color.r * alpha));
+    pixel[1] = static_cast<std::uint8_t>(div_255(pixel[1] * inv + color.g * alpha));
+    pixel[2] = static_cast<std::uint8_t>(div_255(pixel[2] * inv + color.b * alpha));
+    pixel[3] = static_cast<std::uint8_t>(div_255(pixel[3] * inv + 255 * alpha));
+}
+
+inline void blend_row_scalar(std::uint8_t* pixels, const std::uint8_t* fill, const std::uint8_t* outline,
+    const std::size_t count, const blend_color& fill_color, const blend_color& outline_color) noexcept {
+    for (std::size_t i = 0; i < count; ++i, pixels += 4) {
+        if (outline && outline[i]) {
+            blend_layer_scalar(pixels, outline_color, outline[i]);
+        }
+        if (fill[i]) {
+            blend_layer_scalar(pixels, fill_color, fill[i]);
+        }
+    }
+}
+
+#if defined(VK_GRAFFITI_BOT_BLEND_X86)
+[[nodiscard]] inline __m128i div_255_sse2(const __m128i x) noexcept {
+    const __m128i rounded = _mm_add_epi16(x, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(rounded, _mm_srli_epi16(rounded, 8)), 8);
+}
+
+// pixels and coverage are 16-bit lanes of two pixels
+[[nodiscard]] inline __m128i blend_layer_sse2(const __m128i pixels, const __m128i coverage,
+    const __m128i color, const __m128i color_alpha) noexcept {
+    const __m128i alpha = div_255_sse2(_mm_mullo_epi16(coverage, color_alpha));
+    const __m128i inv   = _mm_sub_epi16(_mm_set1_epi16(255), alpha);
+    return div_255_sse2(_mm_add_epi16(_mm_mullo_epi16(pixels, inv), _mm_mullo_epi16(color, alpha)));
+}
+
+// every coverage byte of the four pixels is repeated for the four channels
+[[nodiscard]] inline __m128i load_coverage_sse2(const std::uint8_t* coverage) noexcept {
+    std::int32_t packed = 0;
+    std::memcpy(&packed, coverage, sizeof(packed));
+    const __m128i bytes = _mm_cvtsi32_si128(packed);
+    const __m128i pairs = _mm_unpacklo_epi8(bytes, bytes);
+    return _mm_unpacklo_epi16(pairs, pairs);
+}
+
+inline void blend_row_sse2(std::uint8_t* pixels, const std::uint8_t* fill, const std::uint8_t* outline,
+    const std::size_t count, const blend_color& fill_color, const blend_color& outline_color) noexcept {
+    const __m128i zero           = _mm_setzero_si128();
+    const __m128i fill_rgba      = _mm_setr_epi16(fill_color.r, fill_color.g, fill_color.b, 255,
+        fill_color.r, fill_color.g, fill_color.b, 255);
+    const __m128i fill_alpha     = _mm_set1_epi16(fill_color.a);
+    const __m128i outline_rgba   = _mm_setr_epi16(outline_color.r, outline_color.g, outline_color.b, 255,
+        outline_color.r, outline_color.g, outline_color.b, 255);
+    const __m128i outline_alpha  = _mm_set1_epi16(outline_color.a);
+
+    std::size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        std::uint8_t* first = pixels + i * 4;
+        const __m128i packed = _mm_loadu_si128(reinterpret_cast<const __m128i*>(first));
+        __m128i low  = _mm_unpacklo_epi8(packed, zero);
+        __m128i high = _mm_unpackhi_epi8(packed, zero);
+        if (outline) {
+            const __m128i coverage = load_coverage_sse2(outline + i);
+            low  = blend_layer_sse2(low, _mm_unpacklo_epi8(coverage, zero), outline_rgba, outline_alpha);
+            high = blend_layer_sse2(high, _mm_unpackhi_epi8(coverage, zero), outline_rgba, outline_alpha);
+        }
+        const __m128i coverage = load_coverage_sse2(fill + i);
+        low  = blend_layer_sse2(low, _mm_unpacklo_epi8(coverage, zero), fill_rgba, fill_alpha);
+        high = blend_layer_sse2(high, _mm_unpackhi_epi8(coverage, zero), fill_rgba, fill_alpha);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(first), _mm_packus_epi16(low, high));
+    }
+    blend_row_scalar(pixels + i * 4, fill + i, outline ? outline + i : nullptr, count - i, fill_color, outline_color);
+}
+
+[[nodiscard]] VK_GRAFFITI_BOT_TARGET_AVX2 inline __m256i div_255_avx2(const __m256i x) noexcept {
+    const __m256i rounded = _mm256_add_epi16(x, _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(rounded, _mm256_srli_epi16(rounded, 8)), 8);
+}
+
+[[nodiscard]] VK_GRAFFITI_BOT_TARGET_AVX2 inline __m256i blend_layer_avx2(const __m256i pixels,
+    const __m256i coverage, const __m256i color, const __m256i color_alpha) noexcept {
+    const __m256i alpha = div_255_avx2(_mm256_mullo_epi16(coverage, color_alpha));
+    const __m256i inv   = _mm256_sub_epi16(_mm256_set1_epi16(255), alpha);
+    return div_255_avx2(_mm256_add_epi16(_mm256_mullo_epi16(pixels, inv), _mm256_mullo_epi16(color, alpha)));
+}
+
+[[nodiscard]] VK_GRAFFITI_BOT_TARGET_AVX2 inline __m256i load_coverage_avx2(const std::uint8_t* coverage) noexcept {
+    const __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(coverage));
+    return _mm256_mullo_epi32(_mm256_cvtepu8_epi32(bytes), _mm256_set1_epi32(0x01010101));
+}
+
+VK_GRAFFITI_BOT_TARGET_AVX2 inline void blend_row_avx2(std::uint8_t* pixels, const std::uint8_t* fill,
+    const std::uint8_t* outline, const std::size_t count,
+    const blend_color& fill_color, const blend_color& outline_color) noexcept {
+    const __m256i zero          = _mm256_setzero_si256();
+    const __m256i fill_rgba     = _mm256_setr_epi16(fill_color.r, fill_color.g, fill_color.b, 255,
+        fill_color.r, fill_color.g, fill_color.b, 255, fill_color.r, fill_color.g, fill_color.b, 255,
+        fill_color.r, fill_color.g, fill_color.b, 255);
+    const __m256i fill_alpha    = _mm256_set1_epi16(fill_color.a);
+    const __m256i outline_rgba  = _mm256_setr_epi16(outline_color.r, outline_color.g, outline_color.b, 255,
+        outline_color.r, outline_color.g, outline_color.b, 255, outline_color.r, outline_color.g, outline_color.b, 255,
+        outline_color.r, outline_color.g, outline_color.b, 255);
+    const __m256i outline_alpha = _mm256_set1_epi16(outline_color.a);
+
+    std::size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        std::uint8_t* first = pixels + i * 4;
+        const __m256i packed = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(first));
+        __m256i low  = _mm256_unpacklo_epi8(packed, zero);
+        __m256i high = _mm256_unpackhi_epi8(packed, zero);
+        if (outline) {
+            const __m256i coverage = load_coverage_avx2(outline + i);
+            low  = blend_layer_avx2(low, _mm256_unpacklo_epi8(coverage, zero), outline_rgba, outline_alpha);
+            high = blend_layer_avx2(high, _mm256_unpackhi_epi8(coverage, zero), outline_rgba, outline_alpha);
+        }
+        const __m256i coverage = load_coverage_avx2(fill + i);
+        low  = blend_layer_avx2(low, _mm256_unpacklo_epi8(coverage, zero), fill_rgba, fill_alpha);
+        high = blend_layer_avx2(high, _mm256_unpackhi_epi8(coverage, zero), fill_rgba, fill_alpha);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(first), _mm256_packus_epi16(low, high));
+    }
+    blend_row_sse2(pixels + i * 4, fill + i, outline ? outline + i : nullptr, count - i, fill_color, outline_color);
+}
+
+[[nodiscard]] inline bool cpu_supports_avx2() noexcept {
+# if defined(_MSC_VER)
+    int info[4] = {};
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+# else
+    return __builtin_cpu_supports("avx2");
+# endif
+}
+#endif
+} // details
+
+// the best kernel available on the running CPU
+[[nodiscard]] inline blend_kernel detect_blend_kernel() noexcept {
+#if defined(VK_GRAFFITI_BOT_BLEND_X86)
+    return details::cpu_supports_avx2() ? blend_kernel::avx2 : blend_kernel::sse2;
+#else
+    return blend_kernel::scalar;
+#endif
+}
+
+[[nodiscard]] inline bool is_blend_kernel_supported(const blend_kernel kernel) noexcept {
+    switch (kernel) {
+    case blend_kernel::scalar:
+        return true;
+#if defined(VK_GRAFFITI_BOT_BLEND_X86)
+    case blend_kernel::sse2:
+        return true;
+    case blend_kernel::avx2:
+        return details::cpu_supports_avx2();
+#endif
+    default:
+        return false;
+    }
+}
+
+// outline may be nullptr when the text has no outline
+inline void blend_coverage_row(const blend_kernel kernel, std::uint8_t* pixels, const std::uint8_t* fill,
+    const std::uint8_t* outline, const std::size_t count,
+    const blend_color& fill_color, const blend_color& outline_color) noexcept {
+    switch (kernel) {
+#if defined(VK_GRAFFITI_BOT_BLEND_X86)
+    case blend_kernel::avx2:
+        details::blend_row_avx2(pixels, fill, outline, count, fill_color, outline_color);
+    break;
+    case blend_kernel::sse2:
+        details::blend_row_sse2(pixels, fill, outline, count, fill_color, outline_color);
+    break;
+#endif
+    default:
+        details::blend_row_scalar(pixels, fill, outline, count, fill_color, outline_color);
+    break;
+    }
+}
+
+inline void blend_coverage_row(std::uint8_t* pixels, const std::uint8_t* fill, const std::uint8_t* outline,
+    const std::size_t count, const blend_color& fill_color, const blend_color& outline_color) noexcept {
+    static const blend_kernel kernel = detect_blend_kernel();
+    blend_coverage_row(kernel, pixels, fill, outline, count, fill_color, outline_color);
+}
+VK_GRAFFITI_BOT_END
+
+#endif // !VK_GRAFFITI_BOT_BLEND_HPP
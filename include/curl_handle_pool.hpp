@@ -0,0 +1,219 @@
+#ifndef VK_GRAFFITI_BOT_CURL_HANDLE_POOL_HPP
+#define VK_GRAFFITI_BOT_CURL_HANDLE_POOL_HPP
+
+#include "utils.hpp"
+
+#include <curl/curl.h>
+
+#include <array>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <utility>
+#include <stdexcept>
+
+VK_GRAFFITI_BOT_BEGIN
+// Limits every transfer of a pool has, so a stalled server fails the transfer instead of holding
+// its thread forever. Zero turns a limit off.
+struct curl_timeouts {
+    std::chrono::milliseconds connect{ 10000 };
+    std::chrono::milliseconds total{ 60000 };
+    // a transfer slower than low_speed_limit bytes per second for low_speed_time is aborted
+    long low_speed_limit = 1;
+    std::chrono::seconds low_speed_time{ 20 };
+};
+
+// Easy handles handed out one transfer at a time, so any number of threads can make requests
+// through one wrapper. A returned handle keeps its open connections for the next transfer,
+// and all handles of a pool are linked by one share object with the DNS cache and the TLS sessions,
+// so even a new connection skips the lookup and resumes the TLS session instead of a full handshake.
+// The connection cache itself is not shared, libcurl does not support sharing it between threads;
+// transfers run through curl_multi_engine share the connections (and HTTP/2 streams) of its multi handle.
+class curl_handle_pool {
+public:
+    // returns the handle to the pool when destroyed, the transfer must be finished by then
+    class handle {
+    private:
+        curl_handle_pool* _pool = nullptr;
+        CURL* _handle = nullptr;
+
+    public:
+        inline handle() noexcept = default;
+
+        inline handle(curl_handle_pool* pool, CURL* curl_handle) noexcept :
+            _pool(pool),
+            _handle(curl_handle) {}
+
+        handle(const handle&)            = delete;
+        handle& operator=(const handle&) = delete;
+
+        inline handle(handle&& other) noexcept {
+            std::swap(_pool, other._pool);
+            std::swap(_handle, other._handle);
+        }
+
+        inline handle& operator=(handle&& other) noexcept {
+            if (this != &other) {
+                reset();
+                std::swap(_pool, other._pool);
+                std::swap(_handle, other._handle);
+            }
+            return *this;
+        }
+
+        inline ~handle() {
+            reset();
+        }
+
+        [[nodiscard]] inline CURL* get() const noexcept {
+            return _handle;
+        }
+
+        inline void reset() noexcept {
+            if (_pool) {
+                _pool->_release(_handle);
+                _pool   = nullptr;
+                _handle = nullptr;
+            }
+        }
+    };
+
+private:
+    CURLSH* _share = nullptr;
+    // one lock for every kind of shared data, so a dns lookup does not wait for a tls session
+    std::array<std::mutex, CURL_LOCK_DATA_LAST> _share_mutexes;
+    std::size_t _max_idle;
+    std::mutex _mutex;
+    std::vector<CURL*> _idle;
+    curl_timeouts _timeouts;
+    std::atomic<std::size_t> _created = 0;
+
+    static inline void _lock(CURL*, const curl_lock_data data, curl_lock_access, void* pool) {
+        static_cast<curl_handle_pool*>(pool)->_share_mutexes[data].lock();
+    }
+
+    static inline void _unlock(CURL*, const curl_lock_data data, void* pool) {
+        static_cast<curl_handle_pool*>(pool)->_share_mutexes[data].unlock();
+    }
+
+    inline void _check_share_code(const CURLSHcode code) {
+        if (code != CURLSHE_OK) {
+            if (_share) {
+                curl_share_cleanup(_share);
+                _share = nullptr;
+            }
+            throw std::runtime_error(VK_GRAFFITI_BOT_FUNC_MSG(curl_share_strerror(code)));
+        }
+    }
+
+    static inline void _set_timeouts(CURL* curl_handle, const curl_timeouts& timeouts) noexcept {
+        curl_easy_setopt(curl_handle, CURLOPT_CONNECTTIMEOUT_MS, static_cast<long>(timeouts.connect.count()));
+        curl_easy_setopt(curl_handle, CURLOPT_TIMEOUT_MS, static_cast<long>(timeouts.total.count()));
+        curl_easy_setopt(curl_handle, CURLOPT_LOW_SPEED_LIMIT, timeouts.low_speed_limit);
+        curl_easy_setopt(curl_handle, CURLOPT_LOW_SPEED_TIME, static_cast<long>(timeouts.low_speed_time.count()));
+    }
+
+    // set again after every reset, curl_easy_reset clears them along with the transfer options,
+    // called with _mutex locked
+    inline void _set_defaults(CURL* curl_handle) noexcept {
+        curl_easy_setopt(curl_handle, CURLOPT_SHARE, _share);
+        curl_easy_setopt(curl_handle, CURLOPT_HTTP_VERSION, static_cast<long>(CURL_HTTP_VERSION_2TLS));
+        // a new transfer to a host waits for an HTTP/2 connection being opened instead of opening its own
+        curl_easy_setopt(curl_handle, CURLOPT_PIPEWAIT, 1l);
+        curl_easy_setopt(curl_handle, CURLOPT_TCP_KEEPALIVE, 1l);
+        curl_easy_setopt(curl_handle, CURLOPT_NOSIGNAL, 1l);
+        _set_timeouts(curl_handle, _timeouts);
+    }
+
+    inline void _release(CURL* curl_handle) noexcept {
+        curl_easy_reset(curl_handle);
+        {
+            std::lock_guard lock(_mutex);
+            _set_defaults(curl_handle);
+            if (_idle.size() < _max_idle) {
+                _idle.push_back(curl_handle);
+                return;
+            }
+        }
+        curl_easy_cleanup(curl_handle);
+    }
+
+public:
+    // max_idle handles are kept for reuse, more can be checked out at once but are freed when returned
+    inline explicit curl_handle_pool(const std::size_t max_idle = 64) :
+        _max_idle(max_idle) {
+        _share = curl_share_init();
+        if (!_share) {
+            throw std::runtime_error(VK_GRAFFITI_BOT_FUNC_MSG("share init error"));
+        }
+        _check_share_code(curl_share_setopt(_share, CURLSHOPT_LOCKFUNC, _lock));
+        _check_share_code(curl_share_setopt(_share, CURLSHOPT_UNLOCKFUNC, _unlock));
+        _check_share_code(curl_share_setopt(_share, CURLSHOPT_USERDATA, static_cast<void*>(this)));
+        _check_share_code(curl_share_setopt(_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS));
+        _check_share_code(curl_share_setopt(_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION));
+    }
+
+    curl_handle_pool(const curl_handle_pool&)            = delete;
+    curl_handle_pool& operator=(const curl_handle_pool&) = delete;
+
+    // every handle must be returned before the pool is destroyed
+    inline ~curl_handle_pool() {
+        for (CURL* curl_handle : _idle) {
+            curl_easy_cleanup(curl_handle);
+        }
+        curl_share_cleanup(_share);
+    }
+
+    [[nodiscard]] inline handle acquire() {
+        {
+            std::lock_guard lock(_mutex);
+            if (!_idle.empty()) {
+                CURL* curl_handle = _idle.back();
+                _idle.pop_back();
+                return handle(this, curl_handle);
+            }
+        }
+        CURL* curl_handle = curl_easy_init();
+        if (!curl_handle) {
+            throw std::runtime_error(VK_GRAFFITI_BOT_FUNC_MSG("init error"));
+        }
+        {
+            std::lock_guard lock(_mutex);
+            _set_defaults(curl_handle);
+        }
+        ++_created;
+        return handle(this, curl_handle);
+    }
+
+    // handles made over the lifetime of the pool, stays near the peak number of concurrent transfers
+    [[nodiscard]] inline std::size_t get_created_count() const noexcept {
+        return _created;
+    }
+
+    [[nodiscard]] inline std::size_t get_idle_count() {
+        std::lock_guard lock(_mutex);
+        return _idle.size();
+    }
+
+    [[nodiscard]] inline std::size_t get_max_idle() const noexcept {
+        return _max_idle;
+    }
+
+    [[nodiscard]] inline curl_timeouts get_timeouts() {
+        std::lock_guard lock(_mutex);
+        return _timeouts;
+    }
+
+    // handles checked out at the moment get the new limits once they are returned
+    inline void set_timeouts(const curl_timeouts& timeouts) {
+        std::lock_guard lock(_mutex);
+        _timeouts = timeouts;
+        for (CURL* curl_handle : _idle) {
+            _set_timeouts(curl_handle, _timeouts);
+        }
+    }
+};
+VK_GRAFFITI_BOT_END
+
+#endif // !VK_GRAFFITI_BOT_CURL_HANDLE_POOL_HPP
@@ -0,0 +1,311 @@
+#ifndef VK_GRAFFITI_BOT_CURL_MULTI_ENGINE_HPP
+#define VK_GRAFFITI_BOT_CURL_MULTI_ENGINE_HPP
+
+#include "utils.hpp"
+#include "metrics.hpp"
+#include "curl_handle_pool.hpp"
+
+#include <curl/curl.h>
+
+#include <mutex>
+#include <atomic>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <functional>
+#include <string_view>
+#include <unordered_map>
+
+VK_GRAFFITI_BOT_BEGIN
+namespace details {
+// Series of one kind of transfer ("get", "post", "download" or "upload").
+// Connection phases are only recorded for transfers that opened a new connection.
+struct transfer_metrics {
+    metrics_counter& transfers;
+    metrics_counter& errors;
+    metrics_counter& new_connections;
+    metrics_counter& received_bytes;
+    metrics_counter& sent_bytes;
+    latency_histogram& dns_time;
+    latency_histogram& connect_time;
+    latency_histogram& tls_time;
+    latency_histogram& total_time;
+
+    inline explicit transfer_metrics(const std::string_view kind, metrics_registry& registry = global_metrics()) :
+        transfers(registry.counter("vk_graffiti_bot_http_transfers_total",
+            "Finished HTTP transfers.", metrics_label("kind", kind))),
+        errors(registry.counter("vk_graffiti_bot_http_errors_total",
+            "HTTP transfers failed on the curl level.", metrics_label("kind", kind))),
+        new_connections(registry.counter("vk_graffiti_bot_http_new_connections_total",
+            "HTTP transfers that could not reuse a connection.", metrics_label("kind", kind))),
+        received_bytes(registry.counter("vk_graffiti_bot_http_received_bytes_total",
+            "Bytes of HTTP answer bodies.", metrics_label("kind", kind))),
+        sent_bytes(registry.counter("vk_graffiti_bot_http_sent_bytes_total",
+            "Bytes of HTTP request bodies.", metrics_label("kind", kind))),
+        dns_time(registry.histogram("vk_graffiti_bot_http_dns_seconds",
+            "Name resolution time of new connections.", metrics_label("kind", kind))),
+        connect_time(registry.histogram("vk_graffiti_bot_http_connect_seconds",
+            "TCP connect time of new connections.", metrics_label("kind", kind))),
+        tls_time(registry.histogram("vk_graffiti_bot_http_tls_seconds",
+            "TLS handshake time of new connections.", metrics_label("kind", kind))),
+        total_time(registry.histogram("vk_graffiti_bot_http_total_seconds",
+            "Total HTTP transfer time.", metrics_label("kind", kind))) {}
+};
+
+// reads the transfer info, so it must be called before the handle is reset or reused
+inline void record_transfer(CURL* handle, const CURLcode code, transfer_metrics& metrics) noexcept {
+    metrics.transfers.add();
+    if (code != CURLE_OK) {
+        metrics.errors.add();
+    }
+    curl_off_t value = 0;
+    if (curl_easy_getinfo(handle, CURLINFO_SIZE_DOWNLOAD_T, &value) == CURLE_OK && value > 0) {
+        metrics.received_bytes.add(static_cast<std::uint64_t>(value));
+    }
+    if (curl_easy_getinfo(handle, CURLINFO_SIZE_UPLOAD_T, &value) == CURLE_OK && value > 0) {
+        metrics.sent_bytes.add(static_cast<std::uint64_t>(value));
+    }
+    if (curl_easy_getinfo(handle, CURLINFO_TOTAL_TIME_T, &value) == CURLE_OK) {
+        metrics.total_time.record_us(static_cast<std::uint64_t>(std::max<curl_off_t>(value, 0)));
+    }
+
+    long connects = 0;
+    if (curl_easy_getinfo(handle, CURLINFO_NUM_CONNECTS, &connects) != CURLE_OK || connects == 0) {
+        return;
+    }
+    metrics.new_connections.add();
+    // the times are counted from the start of the transfer, each phase is the difference to the previous one
+    curl_off_t name_lookup = 0;
+    curl_off_t connect     = 0;
+    curl_off_t app_connect = 0;
+    curl_easy_getinfo(handle, CURLINFO_NAMELOOKUP_TIME_T, &name_lookup);
+    curl_easy_getinfo(handle, CURLINFO_CONNECT_TIME_T, &connect);
+    curl_easy_getinfo(handle, CURLINFO_APPCONNECT_TIME_T, &app_connect);
+    metrics.dns_time.record_us(static_cast<std::uint64_t>(std::max<curl_off_t>(name_lookup, 0)));
+    if (connect >= name_lookup) {
+        metrics.connect_time.record_us(static_cast<std::uint64_t>(connect - name_lookup));
+    }
+    if (app_connect > 0 && app_connect >= connect) {
+        metrics.tls_time.record_us(static_cast<std::uint64_t>(app_connect - connect));
+    }
+}
+} // details
+
+// Drives many easy handles at once on a single event-loop thread.
+// All transfers share the multi handle connection cache, so connections to the same host are reused
+// between requests and multiplexed over HTTP/2 when possible. The handles come from one pool,
+// which also shares the DNS cache and TLS sessions with the blocking wrappers made on the engine.
+class curl_multi_engine {
+public:
+    using completion_type = std::function<void(const CURLcode code)>;
+    using answer_callback_type = std::function<void(const CURLcode code, std::string&& answer)>;
+
+private:
+    struct _transfer {
+        CURL* handle = nullptr;
+        completion_type on_done;
+    };
+
+    struct _owned_transfer {
+        curl_handle_pool::handle handle;
+        std::string body;
+        std::string answer;
+        answer_callback_type on_done;
+    };
+
+    // shared with the curl wrappers made on this engine, outlives the multi handle
+    std::shared_ptr<curl_handle_pool> _handles;
+    CURLM* _multi = nullptr;
+    std::mutex _mutex;
+    std::vector<_transfer> _submitted;
+    std::unordered_map<CURL*, completion_type> _running;
+    std::atomic<bool> _stopped = false;
+    std::thread _thread;
+
+    static inline void _check_code(const CURLMcode code) {
+        if (code != CURLM_OK) {
+            throw std::runtime_error(VK_GRAFFITI_BOT_FUNC_MSG(curl_multi_strerror(code)));
+        }
+    }
+
+    static inline std::size_t _write_to_string(
+        const void* data_src, const std::size_t size, const std::size_t count, void* data_dst) {
+        const std::size_t bytes = size * count;
+        static_cast<std::string*>(data_dst)->append(static_cast<const char*>(data_src), bytes);
+        return bytes;
+    }
+
+    inline void _add_submitted() {
+        std::vector<_transfer> submitted;
+        {
+            std::lock_guard lock(_mutex);
+            submitted.swap(_submitted);
+        }
+        for (auto& transfer : submitted) {
+            const CURLMcode code = curl_multi_add_handle(_multi, transfer.handle);
+            if (code != CURLM_OK) {
+                transfer.on_done(CURLE_FAILED_INIT);
+                continue;
+            }
+            _running.emplace(transfer.handle, std::move(transfer.on_done));
+        }
+    }
+
+    inline void _finish_done() {
+        int messages_left = 0;
+        while (CURLMsg* msg = curl_multi_info_read(_multi, &messages_left)) {
+            if (msg->msg != CURLMSG_DONE) {
+                continue;
+            }
+            CURL* handle        = msg->easy_handle;
+            const CURLcode code = msg->data.result;
+            curl_multi_remove_handle(_multi, handle);
+            const auto running_it = _running.find(handle);
+            auto on_done = std::move(running_it->second);
+            _running.erase(running_it);
+            try {
+                on_done(code);
+            } catch (const std::exception& ex) {
+                log_error(ex.what());
+            }
+        }
+    }
+
+    inline void _run() {
+        while (!_stopped) {
+            _add_submitted();
+            int running_count = 0;
+            curl_multi_perform(_multi, &running_count);
+            _finish_done();
+            curl_multi_poll(_multi, nullptr, 0, 1000, nullptr);
+        }
+
+        for (auto& [handle, on_done] : _running) {
+            curl_multi_remove_handle(_multi, handle);
+            on_done(CURLE_ABORTED_BY_CALLBACK);
+        }
+        _running.clear();
+        std::vector<_transfer> submitted;
+        {
+            std::lock_guard lock(_mutex);
+            submitted.swap(_submitted);
+        }
+        for (auto& transfer : submitted) {
+            transfer.on_done(CURLE_ABORTED_BY_CALLBACK);
+        }
+    }
+
+public:
+    inline explicit curl_multi_engine(std::shared_ptr<curl_handle_pool> handles = std::make_shared<curl_handle_pool>()) :
+        _handles(std::move(handles)) {
+        if (!_handles) {
+            throw std::invalid_argument(VK_GRAFFITI_BOT_FUNC_MSG("handle pool was nullptr"));
+        }
+        _multi = curl_multi_init();
+        if (!_multi) {
+            throw std::runtime_error(VK_GRAFFITI_BOT_FUNC_MSG("init error"));
+        }
+        _check_code(curl_multi_setopt(_multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX));
+        _thread = std::thread(&curl_multi_engine::_run, this);
+    }
+
+    curl_multi_engine(const curl_multi_engine&)            = delete;
+    curl_multi_engine& operator=(const curl_multi_engine&) = delete;
+
+    inline ~curl_multi_engine() {
+        {
+            std::lock_guard lock(_mutex);
+            _stopped = true;
+        }
+        curl_multi_wakeup(_multi);
+        if (_thread.joinable()) {
+            _thread.join();
+        }
+        curl_multi_cleanup(_multi);
+    }
+
+    [[nodiscard]] inline const std::shared_ptr<curl_handle_pool>& get_handle_pool() const noexcept {
+        return _handles;
+    }
+
+    // the handle must stay alive and untouched until on_done is called on the engine thread
+    inline void submit(CURL* handle, completion_type on_done) {
+        if (!handle) {
+            throw std::invalid_argument(VK_GRAFFITI_BOT_FUNC_MSG("handle was nullptr"));
+        }
+        {
+            std::lock_guard lock(_mutex);
+            if (_stopped) {
+                throw std::runtime_error(VK_GRAFFITI_BOT_FUNC_MSG("engine is stopped"));
+            }
+            _submitted.push_back({ handle, std::move(on_done) });
+        }
+        curl_multi_wakeup(_multi);
+    }
+
+    [[nodiscard]] inline std::future<CURLcode> submit(CURL* handle) {
+        auto promise = std::make_shared<std::promise<CURLcode>>();
+        auto future  = promise->get_future();
+        submit(handle, [promise](const CURLcode code) {
+            promise->set_value(code);
+        });
+        return future;
+    }
+
+    // GET request on an engine owned handle, on_done is called on the engine thread
+    inline void perform_async(const std::string& url, answer_callback_type on_done) {
+        _start_owned_transfer(url, nullptr, std::move(on_done));
+    }
+
+    // application/x-www-form-urlencoded POST, the transfer keeps the body until it is done
+    inline void post_async(const std::string& url, std::string body, answer_callback_type on_done) {
+        _start_owned_transfer(url, &body, std::move(on_done));
+    }
+
+private:
+    inline void _start_owned_transfer(const std::string& url, std::string* body, answer_callback_type on_done) {
+        auto transfer     = std::make_shared<_owned_transfer>();
+        transfer->handle  = _handles->acquire();
+        transfer->on_done = std::move(on_done);
+        CURL* handle      = transfer->handle.get();
+        if (body) {
+            transfer->body = std::move(*body);
+            curl_easy_setopt(handle, CURLOPT_POSTFIELDSIZE_LARGE, static_cast<curl_off_t>(transfer->body.size()));
+            curl_easy_setopt(handle, CURLOPT_POSTFIELDS, transfer->body.c_str());
+        }
+        curl_easy_setopt(handle, CURLOPT_URL, url.c_str());
+        curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, _write_to_string);
+        curl_easy_setopt(handle, CURLOPT_WRITEDATA, static_cast<void*>(&transfer->answer));
+        const bool is_post = body != nullptr;
+        submit(handle, [handle, transfer, is_post](const CURLcode code) {
+            static details::transfer_metrics get_metrics("get");
+            static details::transfer_metrics post_metrics("post");
+            details::record_transfer(handle, code, is_post ? post_metrics : get_metrics);
+            transfer->handle.reset();
+            transfer->on_done(code, std::move(transfer->answer));
+        });
+    }
+
+public:
+
+    [[nodiscard]] inline std::future<std::string> perform_async(const std::string& url) {
+        auto promise = std::make_shared<std::promise<std::string>>();
+        auto future  = promise->get_future();
+        perform_async(url, [promise](const CURLcode code, std::string&& answer) {
+            if (code != CURLE_OK) {
+                promise->set_exception(std::make_exception_ptr(
+                    std::runtime_error(VK_GRAFFITI_BOT_FUNC_MSG(curl_easy_strerror(code)))));
+                return;
+            }
+            promise->set_value(std::move(answer));
+        });
+        return future;
+    }
+};
+VK_GRAFFITI_BOT_END
+
+#endif // !VK_GRAFFITI_BOT_CURL_MULTI_ENGINE_HPP
@@ -2,9 +2,14 @@
 #define VK_GRAFFITI_BOT_CURL_WRAPPER_HPP
 
 #include "utils.hpp"
+#include "curl_handle_pool.hpp"
+#include "curl_multi_engine.hpp"
+#include "image_header.hpp"
 
 #include <curl/curl.h>
 
+#include <chrono>
+#include <memory>
 #include <string>
 #include <vector>
 #include <stdexcept>
@@ -15,19 +20,32 @@
 #include <SFML/Graphics/Image.hpp>
 
 VK_GRAFFITI_BOT_BEGIN
+// VK keeps photos no larger than 2560 pixels a side, the dimension limits leave room for that
+// while one decoded photo stays within 64 MB
+struct image_download_limits {
+    std::size_t max_bytes = 32 * 1024 * 1024;
+    unsigned max_width    = 4096;
+    unsigned max_height   = 4096;
+};
+
+// Blocking HTTP requests. Every request checks out a handle from the pool and returns it when done,
+// so one wrapper can be used from several threads at once and its connections are kept by the pool.
 class curl_wrapper {
 private:
-    using _image_data_type     = std::vector<std::byte>;
     using _write_function_type = std::size_t(*)(const void*, const std::size_t, const std::size_t, void*);
 
-    enum class _write_state {
-        none,
-        to_string,
-        to_image
+    struct _image_download {
+        CURL* handle = nullptr;
+        image_download_limits limits;
+        std::vector<std::byte> data;
+        bool size_checked = false;
+        image_probe_status header_status = image_probe_status::need_more_data;
+        // set when the transfer is aborted from the write callback
+        std::string error;
     };
 
-    CURL* _handle = nullptr;
-    _write_state _write_state_curr = _write_state::none;
+    std::shared_ptr<curl_handle_pool> _handles;
+    curl_multi_engine* _engine = nullptr;
 
     static constexpr void _check_code(const CURLcode code) {
         if (code != CURLE_OK) {
@@ -49,78 +67,158 @@ private:
         return bytes;
     }
 
-    inline void _set_write_function(const _write_function_type& func) {
-        const CURLcode code = curl_easy_setopt(_handle, CURLOPT_WRITEFUNCTION, func);
-        _check_code(code);
-    }
+    // validates the image while it arrives, returning less than bytes aborts the transfer
+    static inline std::size_t _write_to_image_download(
+        const void* data_src, const std::size_t size, const std::size_t count, void* data_dst) {
+        const std::size_t bytes   = size * count;
+        _image_download& download = *static_cast<_image_download*>(data_dst);
 
-    inline void _set_write_data(void* data) {
-        const CURLcode code = curl_easy_setopt(_handle, CURLOPT_WRITEDATA, data);
-        _check_code(code);
-    }
+        if (!download.size_checked) {
+            download.size_checked = true;
+            curl_off_t content_length = -1;
+            curl_easy_getinfo(download.handle, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &content_length);
+            if (content_length > 0) {
+                if (static_cast<std::size_t>(content_length) > download.limits.max_bytes) {
+                    download.error = "image is too large";
+                    return 0;
+                }
+                download.data.reserve(static_cast<std::size_t>(content_length));
+            }
+        }
 
-    inline void _set_write_state(const _write_state state) {
-        if (_write_state_curr == state) {
-            return;
+        if (download.data.size() + bytes > download.limits.max_bytes) {
+            download.error = "image is too large";
+            return 0;
         }
+        const auto data_src_first = static_cast<const std::byte*>(data_src);
+        download.data.insert(download.data.end(), data_src_first, data_src_first + bytes);
 
-        switch (state) {
-        case _write_state::to_string:
-            _set_write_function(_write_to_container<std::string>);
-        break;
-        case _write_state::to_image:
-            _set_write_function(_write_to_container<_image_data_type>);
-        break;
-        default:
-            throw std::runtime_error(VK_GRAFFITI_BOT_FUNC_MSG("not correct write state"));
+        if (download.header_status == image_probe_status::need_more_data) {
+            image_header header;
+            download.header_status = probe_image_header(download.data.data(), download.data.size(), header);
+            if (download.header_status == image_probe_status::unknown_format) {
+                download.error = "downloaded data is not a supported image";
+                return 0;
+            }
+            if (download.header_status == image_probe_status::ok &&
+                (header.width > download.limits.max_width || header.height > download.limits.max_height)) {
+                download.error = "image dimensions are too large";
+                return 0;
+            }
         }
+        return bytes;
+    }
 
-        _write_state_curr = state;
+    static inline void _set_write(CURL* handle, const _write_function_type func, void* data) {
+        _check_code(curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, func));
+        _check_code(curl_easy_setopt(handle, CURLOPT_WRITEDATA, data));
     }
 
-    inline void _set_http_get() {
-        const CURLcode code = curl_easy_setopt(_handle, CURLOPT_HTTPGET, 1l);
+    inline void _perform(CURL* handle, const std::string& url, details::transfer_metrics& metrics) {
+        CURLcode code = curl_easy_setopt(handle, CURLOPT_URL, url.c_str());
+        _check_code(code);
+        code = _engine ? _engine->submit(handle).get() : curl_easy_perform(handle);
+        details::record_transfer(handle, code, metrics);
         _check_code(code);
     }
 
-    inline void _set_http_post(curl_httppost* form_post_first) {
-        const CURLcode code = curl_easy_setopt(_handle, CURLOPT_HTTPPOST, form_post_first);
-        _check_code(code);
+    inline void _perform_to_string(CURL* handle, const std::string& url, std::string& answer,
+        details::transfer_metrics& metrics) {
+        _set_write(handle, _write_to_container<std::string>, static_cast<void*>(&answer));
+        _perform(handle, url, metrics);
     }
 
-    inline void _perform(const std::string& url) {
-        CURLcode code = curl_easy_setopt(_handle, CURLOPT_URL, url.c_str());
-        _check_code(code);
-        code = curl_easy_perform(_handle);
-        _check_code(code);
+    [[nodiscard]] static inline std::string _coded_url_process(char* result_c_str) {
+        if (!result_c_str) {
+            throw std::runtime_error(VK_GRAFFITI_BOT_FUNC_MSG("error of url code process"));
+        }
+        const std::string result(result_c_str);
+        curl_free(result_c_str);
+        return result;
     }
 
 public:
-    inline ~curl_wrapper() {
-        if (_handle) {
-            curl_easy_cleanup(_handle);
-            _handle = nullptr;
+    // with an engine every perform is a thin blocking wrapper over an engine transfer
+    // and the handles come from the engine pool, shared with all its other wrappers
+    inline explicit curl_wrapper(curl_multi_engine* engine = nullptr) :
+        _handles(engine ? engine->get_handle_pool() : std::make_shared<curl_handle_pool>()),
+        _engine(engine) {}
+
+    // takes the handles, and so the connections, of another wrapper
+    inline curl_wrapper(std::shared_ptr<curl_handle_pool> handles, curl_multi_engine* engine) :
+        _handles(std::move(handles)),
+        _engine(engine) {
+        if (!_handles) {
+            throw std::invalid_argument(VK_GRAFFITI_BOT_FUNC_MSG("handle pool was nullptr"));
         }
     }
 
-    inline curl_wrapper() {
-        _handle = curl_easy_init();
-        if (!_handle) {
-            throw std::runtime_error(VK_GRAFFITI_BOT_FUNC_MSG("init error"));
-        }
+    curl_wrapper(const curl_wrapper&)            = delete;
+    curl_wrapper& operator=(const curl_wrapper&) = delete;
+
+    [[nodiscard]] inline curl_multi_engine* get_engine() const noexcept {
+        return _engine;
+    }
+
+    [[nodiscard]] inline const std::shared_ptr<curl_handle_pool>& get_handle_pool() const noexcept {
+        return _handles;
     }
 
     inline void perform(const std::string& url, std::string& answer) {
-        _set_write_state(_write_state::to_string);
-        _set_write_data(static_cast<void*>(&answer));
-        _perform(url);
+        static details::transfer_metrics metrics("get");
+        const auto handle = _handles->acquire();
+        _perform_to_string(handle.get(), url, answer, metrics);
     }
 
-    inline void perform(const std::string& url, sf::Image& answer) {
-        _set_write_state(_write_state::to_image);
-        _image_data_type image_data;
-        _set_write_data(static_cast<void*>(&image_data));
-        _perform(url);
+    // For requests the server holds open on purpose, like a long poll: the whole request may take
+    // up to timeout and no data arriving meanwhile is not a stall.
+    inline void perform(const std::string& url, std::string& answer, const std::chrono::milliseconds timeout) {
+        static details::transfer_metrics metrics("get");
+        const auto handle = _handles->acquire();
+        _check_code(curl_easy_setopt(handle.get(), CURLOPT_TIMEOUT_MS, static_cast<long>(timeout.count())));
+        _check_code(curl_easy_setopt(handle.get(), CURLOPT_LOW_SPEED_LIMIT, 0l));
+        _perform_to_string(handle.get(), url, answer, metrics);
+    }
+
+    // application/x-www-form-urlencoded post, the body is sent straight from the caller buffer
+    inline void perform_post(const std::string& url, const std::string& body, std::string& answer) {
+        static details::transfer_metrics metrics("post");
+        const auto handle = _handles->acquire();
+        _check_code(curl_easy_setopt(handle.get(), CURLOPT_POSTFIELDSIZE_LARGE, static_cast<curl_off_t>(body.size())));
+        _check_code(curl_easy_setopt(handle.get(), CURLOPT_POSTFIELDS, body.c_str()));
+        _perform_to_string(handle.get(), url, answer, metrics);
+    }
+
+    // Downloads an image without decoding it, oversized or non-image payloads are aborted
+    // as soon as their header arrives. image_data holds a complete image of a known format afterwards.
+    inline void perform(const std::string& url, std::vector<std::byte>& image_data, const image_download_limits& limits) {
+        static details::transfer_metrics metrics("download");
+        const auto handle = _handles->acquire();
+        _image_download download;
+        download.handle = handle.get();
+        download.limits = limits;
+        download.data   = std::move(image_data);
+        download.data.clear();
+        _set_write(handle.get(), _write_to_image_download, static_cast<void*>(&download));
+        _check_code(curl_easy_setopt(handle.get(), CURLOPT_MAXFILESIZE_LARGE, static_cast<curl_off_t>(limits.max_bytes)));
+        try {
+            _perform(handle.get(), url, metrics);
+        } catch (...) {
+            if (!download.error.empty()) {
+                throw std::runtime_error(VK_GRAFFITI_BOT_FUNC_MSG(download.error));
+            }
+            throw;
+        }
+
+        if (download.header_status != image_probe_status::ok) {
+            throw std::runtime_error(VK_GRAFFITI_BOT_FUNC_MSG("downloaded data is not a complete image"));
+        }
+        image_data = std::move(download.data);
+    }
+
+    inline void perform(const std::string& url, sf::Image& answer, const image_download_limits& limits = {}) {
+        std::vector<std::byte> image_data;
+        perform(url, image_data, limits);
         const bool load_image_result =
             answer.loadFromMemory(static_cast<const void*>(image_data.data()), image_data.size());
         if (!load_image_result) {
@@ -129,7 +227,7 @@ public:
     }
 
     inline void perform(const std::string& url, std::string& answer,
-        const std::string& field_name, const std::filesystem::path& file_path, const bool reset_to_http_get = true) {
+        const std::string& field_name, const std::filesystem::path& file_path) {
         if (!std::filesystem::exists(file_path)) {
             throw std::runtime_error(VK_GRAFFITI_BOT_FUNC_MSG("file does not exist"));
         }
@@ -138,35 +236,47 @@ public:
         curl_httppost* form_post_last  = nullptr;
         curl_formadd(&form_post_first, &form_post_last, CURLFORM_COPYNAME,
             field_name.c_str(), CURLFORM_FILE, file_path.c_str(), CURLFORM_END);
-        _set_http_post(form_post_first);
-        perform(url, answer);
-        if (reset_to_http_get) {
-            _set_http_get();
-        }
-        curl_formfree(form_post_first);
+        using form_ptr = std::unique_ptr<curl_httppost, decltype(&curl_formfree)>;
+        const form_ptr form(form_post_first, &curl_formfree);
+        static details::transfer_metrics metrics("upload");
+        // declared after the form, so the handle is returned before the form is freed
+        const auto handle = _handles->acquire();
+        _check_code(curl_easy_setopt(handle.get(), CURLOPT_HTTPPOST, form.get()));
+        _perform_to_string(handle.get(), url, answer, metrics);
     }
 
-private:
-    [[nodiscard]] inline std::string _coded_url_process(const char* result_c_str) {
-        if (!result_c_str) {
-            throw std::runtime_error(VK_GRAFFITI_BOT_FUNC_MSG("error of url code process"));
+    // posts a multipart form with a single part filled from memory, the data is not written anywhere
+    inline void perform(const std::string& url, std::string& answer, const std::string& field_name,
+        const void* data, const std::size_t data_size, const std::string& file_name) {
+        static details::transfer_metrics metrics("upload");
+        const auto handle = _handles->acquire();
+        using mime_ptr = std::unique_ptr<curl_mime, decltype(&curl_mime_free)>;
+        // freed before the handle is returned, which resets the handle options pointing to it
+        const mime_ptr mime(curl_mime_init(handle.get()), &curl_mime_free);
+        if (!mime) {
+            throw std::runtime_error(VK_GRAFFITI_BOT_FUNC_MSG("mime init error"));
         }
-        const std::string result(result_c_str);
-        delete[] result_c_str;
-        return result;
+        curl_mimepart* part = curl_mime_addpart(mime.get());
+        if (!part) {
+            throw std::runtime_error(VK_GRAFFITI_BOT_FUNC_MSG("mime add part error"));
+        }
+        _check_code(curl_mime_name(part, field_name.c_str()));
+        _check_code(curl_mime_filename(part, file_name.c_str()));
+        _check_code(curl_mime_data(part, static_cast<const char*>(data), data_size));
+        _check_code(curl_easy_setopt(handle.get(), CURLOPT_MIMEPOST, mime.get()));
+        _perform_to_string(handle.get(), url, answer, metrics);
     }
 
-
-public:
     [[nodiscard]] inline std::string encode_url(const std::string& url) {
-        const char* result_c_str = curl_easy_escape(_handle, url.c_str(), url.length());
-        return _coded_url_process(result_c_str);
+        const auto handle = _handles->acquire();
+        return _coded_url_process(curl_easy_escape(handle.get(), url.c_str(), static_cast<int>(url.length())));
     }
 
     [[nodiscard]] inline std::string decode_url(const std::string& url) {
+        const auto handle = _handles->acquire();
         [[maybe_unused]] int decoded_str_length = 0;
-        const auto result_c_str = curl_easy_unescape(_handle, url.c_str(), url.length(), &decoded_str_length);
-        return _coded_url_process(result_c_str);
+        return _coded_url_process(curl_easy_unescape(handle.get(), url.c_str(),
+            static_cast<int>(url.length()), &decoded_str_length));
     }
 };
 VK_GRAFFITI_BOT_END
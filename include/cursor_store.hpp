@@ -0,0 +1,239 @@
+#ifndef VK_GRAFFITI_BOT_CURSOR_STORE_HPP
+#define VK_GRAFFITI_BOT_CURSOR_STORE_HPP
+
+#include "utils.hpp"
+
+#include <deque>
+#include <mutex>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <optional>
+#include <filesystem>
+#include <unordered_set>
+#include <condition_variable>
+
+#if defined(_WIN32)
+# include <io.h>
+#else
+# include <unistd.h>
+#endif
+
+VK_GRAFFITI_BOT_BEGIN
+namespace details {
+[[nodiscard]] inline bool sync_file(std::FILE* file) noexcept {
+    if (std::fflush(file) != 0) {
+        return false;
+    }
+#if defined(_WIN32)
+    return _commit(_fileno(file)) == 0;
+#else
+    return fsync(fileno(file)) == 0;
+#endif
+}
+} // details
+
+// Keeps the long poll ts and the ids of recently handled messages across restarts.
+// Records are appended to a text file ("t <ts>" and "m <id>" lines) and synced to disk in batches,
+// the file is rewritten with only the current state once it grows too long.
+class cursor_store {
+private:
+    std::filesystem::path _path;
+    std::FILE* _file = nullptr;
+    std::mutex _mutex;
+    std::condition_variable _stop_requested;
+    std::string _ts;
+    std::deque<long long> _recent_order;
+    std::unordered_set<long long> _recent;
+    std::size_t _max_recent;
+    std::size_t _records = 0;
+    std::chrono::milliseconds _sync_interval;
+    bool _dirty   = false;
+    bool _stopped = false;
+    std::thread _thread;
+
+    inline void _remember(const long long message_id) {
+        if (!_recent.insert(message_id).second) {
+            return;
+        }
+        _recent_order.push_back(message_id);
+        if (_recent_order.size() > _max_recent) {
+            _recent.erase(_recent_order.front());
+            _recent_order.pop_front();
+        }
+    }
+
+    // a torn last line after a crash is ignored, true is returned when there is one
+    [[nodiscard]] inline bool _load() {
+        std::FILE* file = std::fopen(_path.string().c_str(), "r");
+        if (!file) {
+            return false;
+        }
+        char line[256];
+        bool torn = false;
+        while (std::fgets(line, sizeof(line), file)) {
+            const std::string record(line);
+            torn = record.back() != '\n';
+            if (record.size() < 3 || torn || record[1] != ' ') {
+                continue;
+            }
+            const std::string value = record.substr(2, record.size() - 3);
+            if (record[0] == 't') {
+                _ts = value;
+            } else if (record[0] == 'm') {
+                try {
+                    _remember(std::stoll(value));
+                } catch (const std::exception&) {
+                    continue;
+                }
+            }
+            ++_records;
+        }
+        std::fclose(file);
+        return torn;
+    }
+
+    inline void _open_for_append() {
+        _file = std::fopen(_path.string().c_str(), "a");
+        if (!_file) {
+            throw std::runtime_error(VK_GRAFFITI_BOT_FUNC_MSG("open cursor file error: " + _path.string()));
+        }
+    }
+
+    inline void _append(const char kind, const std::string& value) {
+        if (std::fprintf(_file, "%c %s\n", kind, value.c_str()) < 0) {
+            log_error(VK_GRAFFITI_BOT_FUNC_MSG("cursor file write error"));
+        }
+        _dirty = true;
+        ++_records;
+    }
+
+    inline void _sync() {
+        if (_dirty && !details::sync_file(_file)) {
+            log_error(VK_GRAFFITI_BOT_FUNC_MSG("cursor file sync error"));
+        }
+        _dirty = false;
+    }
+
+    // writes the current state to a new file and replaces the log with it
+    inline void _compact() {
+        const auto tmp_path = _path.string() + ".tmp";
+        std::FILE* tmp = std::fopen(tmp_path.c_str(), "w");
+        if (!tmp) {
+            log_error(VK_GRAFFITI_BOT_FUNC_MSG("open cursor file error: " + tmp_path));
+            return;
+        }
+        if (!_ts.empty()) {
+            std::fprintf(tmp, "t %s\n", _ts.c_str());
+        }
+        for (const long long message_id : _recent_order) {
+            std::fprintf(tmp, "m %lld\n", message_id);
+        }
+        const bool synced = details::sync_file(tmp);
+        std::fclose(tmp);
+        if (!synced) {
+            log_error(VK_GRAFFITI_BOT_FUNC_MSG("cursor file sync error"));
+            return;
+        }
+
+        _sync();
+        std::error_code error;
+        std::filesystem::rename(tmp_path, _path, error);
+        if (error) {
+            log_error(VK_GRAFFITI_BOT_FUNC_MSG("cursor file rename error: " + error.message()));
+            return;
+        }
+        std::FILE* file = std::fopen(_path.string().c_str(), "a");
+        if (!file) {
+            log_error(VK_GRAFFITI_BOT_FUNC_MSG("open cursor file error: " + _path.string()));
+            return;
+        }
+        std::fclose(_file);
+        _file    = file;
+        _records = _recent_order.size() + (_ts.empty() ? 0 : 1);
+    }
+
+    inline void _run() {
+        std::unique_lock lock(_mutex);
+        while (!_stopped) {
+            _stop_requested.wait_for(lock, _sync_interval);
+            _sync();
+            if (_records > 4 * _max_recent) {
+                _compact();
+            }
+        }
+        _sync();
+    }
+
+public:
+    inline explicit cursor_store(const std::filesystem::path& path, const std::size_t max_recent = 4096,
+        const std::chrono::milliseconds sync_interval = std::chrono::milliseconds(200)) :
+        _path(path),
+        _max_recent(max_recent ? max_recent : 1),
+        _sync_interval(sync_interval) {
+        const bool torn = _load();
+        _open_for_append();
+        if (torn) {
+            // so the next record starts on its own line
+            std::fputc('\n', _file);
+        }
+        _thread = std::thread(&cursor_store::_run, this);
+    }
+
+    cursor_store(const cursor_store&)            = delete;
+    cursor_store& operator=(const cursor_store&) = delete;
+
+    inline ~cursor_store() {
+        {
+            std::lock_guard lock(_mutex);
+            _stopped = true;
+        }
+        _stop_requested.notify_all();
+        if (_thread.joinable()) {
+            _thread.join();
+        }
+        std::fclose(_file);
+    }
+
+    // the last acknowledged ts, nullopt when the store is new
+    [[nodiscard]] inline std::optional<std::string> get_ts() {
+        std::lock_guard lock(_mutex);
+        if (_ts.empty()) {
+            return std::nullopt;
+        }
+        return _ts;
+    }
+
+    inline void set_ts(const std::string& ts) {
+        std::lock_guard lock(_mutex);
+        if (ts == _ts || ts.empty()) {
+            return;
+        }
+        _ts = ts;
+        _append('t', ts);
+    }
+
+    [[nodiscard]] inline bool is_done(const long long message_id) {
+        std::lock_guard lock(_mutex);
+        return _recent.count(message_id) != 0;
+    }
+
+    inline void mark_done(const long long message_id) {
+        std::lock_guard lock(_mutex);
+        if (_recent.count(message_id) != 0) {
+            return;
+        }
+        _remember(message_id);
+        _append('m', std::to_string(message_id));
+    }
+
+    // writes everything recorded so far to disk right away
+    inline void sync() {
+        std::lock_guard lock(_mutex);
+        _sync();
+    }
+};
+VK_GRAFFITI_BOT_END
+
+#endif // !VK_GRAFFITI_BOT_CURSOR_STORE_HPP
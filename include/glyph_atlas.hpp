@@ -0,0 +1,329 @@
+#ifndef VK_GRAFFITI_BOT_GLYPH_ATLAS_HPP
+#define VK_GRAFFITI_BOT_GLYPH_ATLAS_HPP
+
+#include "mapped_file.hpp"
+
+#include <limits>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <algorithm>
+#include <stdexcept>
+#include <filesystem>
+
+VK_GRAFFITI_BOT_BEGIN
+// 8-bit coverage of a glyph, left and top are relative to the pen position on the baseline
+struct glyph_bitmap {
+    int left   = 0;
+    int top    = 0;
+    int width  = 0;
+    int height = 0;
+    std::vector<std::uint8_t> coverage;
+};
+
+struct rasterized_glyph {
+    float advance = 0;
+    glyph_bitmap fill;
+    glyph_bitmap outline;
+};
+
+// printable ascii and the basic cyrillic block, what nearly every caption is made of
+[[nodiscard]] inline std::u32string warm_up_characters() {
+    std::u32string characters;
+    for (char32_t codepoint = 0x20; codepoint <= 0x7E; ++codepoint) {
+        characters += codepoint;
+    }
+    for (char32_t codepoint = 0x400; codepoint <= 0x45F; ++codepoint) {
+        characters += codepoint;
+    }
+    return characters;
+}
+
+// FNV-1a of the font file, an atlas is only used with the font it was rendered from
+[[nodiscard]] inline std::uint64_t glyph_atlas_font_hash(const void* font_data, const std::size_t font_data_size) noexcept {
+    std::uint64_t hash = 0xCBF29CE484222325ull;
+    const auto bytes = static_cast<const unsigned char*>(font_data);
+    for (std::size_t i = 0; i < font_data_size; ++i) {
+        hash = (hash ^ bytes[i]) * 0x100000001B3ull;
+    }
+    return hash;
+}
+
+// Rasterized glyphs of one font and outline thickness at a few character sizes, in a layout
+// that is used as it is, either built in memory or mapped from a file saved by an earlier run.
+// The file is a header, the glyph entries sorted by character size and codepoint, then the coverage.
+// It is never changed once made, so one atlas is read by any number of threads.
+class glyph_atlas {
+private:
+    static constexpr char _magic[8] = { 'V', 'K', 'G', 'B', 'G', 'A', '0', '1' };
+
+    struct _header {
+        char magic[8];
+        std::uint64_t font_hash;
+        float outline_thickness;
+        std::uint32_t glyphs_count;
+        std::uint64_t coverage_size;
+        char reserved[32];
+    };
+
+    struct _bitmap_entry {
+        std::int16_t left;
+        std::int16_t top;
+        std::uint16_t width;
+        std::uint16_t height;
+        // from the start of the coverage
+        std::uint32_t offset;
+    };
+
+    struct _entry {
+        std::uint32_t character_size;
+        std::uint32_t codepoint;
+        float advance;
+        _bitmap_entry fill;
+        _bitmap_entry outline;
+    };
+
+    static_assert(sizeof(_header) == 64 && sizeof(_entry) == 36, "atlas layout must not depend on the compiler");
+
+    mapped_file _file;
+    std::vector<char> _buffer;
+    const _header* _header_data    = nullptr;
+    const _entry* _entries         = nullptr;
+    const std::uint8_t* _coverage  = nullptr;
+
+    [[nodiscard]] static inline bool _less(const _entry& entry, const std::uint32_t character_size,
+        const std::uint32_t codepoint) noexcept {
+        return entry.character_size != character_size ?
+            entry.character_size < character_size : entry.codepoint < codepoint;
+    }
+
+    [[nodiscard]] static inline bool _is_valid(const _bitmap_entry& bitmap, const std::uint64_t coverage_size) noexcept {
+        return static_cast<std::uint64_t>(bitmap.offset) + static_cast<std::uint64_t>(bitmap.width) * bitmap.height <=
+            coverage_size;
+    }
+
+    static inline _bitmap_entry _add_bitmap(std::vector<std::uint8_t>& coverage, const glyph_bitmap& bitmap) {
+        using limits = std::numeric_limits<std::int16_t>;
+        if (bitmap.left < limits::min() || bitmap.left > limits::max() ||
+            bitmap.top < limits::min() || bitmap.top > limits::max() ||
+            bitmap.width > std::numeric_limits<std::uint16_t>::max() ||
+            bitmap.height > std::numeric_limits<std::uint16_t>::max() ||
+            coverage.size() + bitmap.coverage.size() > std::numeric_limits<std::uint32_t>::max()) {
+            throw std::invalid_argument(VK_GRAFFITI_BOT_FUNC_MSG("glyph is too large for the atlas"));
+        }
+        _bitmap_entry entry;
+        entry.left   = static_cast<std::int16_t>(bitmap.left);
+        entry.top    = static_cast<std::int16_t>(bitmap.top);
+        entry.width  = static_cast<std::uint16_t>(bitmap.width);
+        entry.height = static_cast<std::uint16_t>(bitmap.height);
+        entry.offset = static_cast<std::uint32_t>(coverage.size());
+        coverage.insert(coverage.end(), bitmap.coverage.begin(), bitmap.coverage.end());
+        return entry;
+    }
+
+    [[nodiscard]] inline glyph_bitmap _to_bitmap(const _bitmap_entry& entry) const {
+        glyph_bitmap bitmap;
+        bitmap.left   = entry.left;
+        bitmap.top    = entry.top;
+        bitmap.width  = entry.width;
+        bitmap.height = entry.height;
+        const auto first = _coverage + entry.offset;
+        bitmap.coverage.assign(first, first + static_cast<std::size_t>(entry.width) * entry.height);
+        return bitmap;
+    }
+
+    // points the views at the layout in data, false if it is not a whole atlas
+    [[nodiscard]] inline bool _attach(const char* data, const std::size_t size) noexcept {
+        if (size < sizeof(_header)) {
+            return false;
+        }
+        const auto header = reinterpret_cast<const _header*>(data);
+        if (std::memcmp(header->magic, _magic, sizeof(_magic)) != 0) {
+            return false;
+        }
+        const std::uint64_t entries_size = static_cast<std::uint64_t>(header->glyphs_count) * sizeof(_entry);
+        if (size != sizeof(_header) + entries_size + header->coverage_size) {
+            return false;
+        }
+        const auto entries = reinterpret_cast<const _entry*>(data + sizeof(_header));
+        for (std::uint32_t i = 0; i < header->glyphs_count; ++i) {
+            if (!_is_valid(entries[i].fill, header->coverage_size) ||
+                !_is_valid(entries[i].outline, header->coverage_size)) {
+                return false;
+            }
+        }
+        _header_data = header;
+        _entries     = entries;
+        _coverage    = reinterpret_cast<const std::uint8_t*>(data + sizeof(_header) + entries_size);
+        return true;
+    }
+
+public:
+    inline glyph_atlas() noexcept = default;
+
+    // Renders every character at every size with glyph(codepoint, character_size),
+    // which returns a rasterized_glyph of the font the hash is taken from.
+    template <typename GlyphFunc>
+    [[nodiscard]] static inline glyph_atlas build(const std::uint64_t font_hash, const float outline_thickness,
+        std::vector<unsigned> character_sizes, std::u32string characters, GlyphFunc&& glyph) {
+        std::sort(character_sizes.begin(), character_sizes.end());
+        character_sizes.erase(std::unique(character_sizes.begin(), character_sizes.end()), character_sizes.end());
+        std::sort(characters.begin(), characters.end());
+        characters.erase(std::unique(characters.begin(), characters.end()), characters.end());
+
+        std::vector<_entry> entries;
+        entries.reserve(character_sizes.size() * characters.size());
+        std::vector<std::uint8_t> coverage;
+        for (const unsigned character_size : character_sizes) {
+            for (const char32_t codepoint : characters) {
+                const rasterized_glyph current = glyph(codepoint, character_size);
+                _entry entry;
+                entry.character_size = character_size;
+                entry.codepoint      = static_cast<std::uint32_t>(codepoint);
+                entry.advance        = current.advance;
+                entry.fill           = _add_bitmap(coverage, current.fill);
+                entry.outline        = _add_bitmap(coverage, current.outline);
+                entries.push_back(entry);
+            }
+        }
+
+        _header header{};
+        std::memcpy(header.magic, _magic, sizeof(_magic));
+        header.font_hash         = font_hash;
+        header.outline_thickness = outline_thickness;
+        header.glyphs_count      = static_cast<std::uint32_t>(entries.size());
+        header.coverage_size     = coverage.size();
+
+        glyph_atlas atlas;
+        auto& buffer = atlas._buffer;
+        buffer.resize(sizeof(_header) + entries.size() * sizeof(_entry) + coverage.size());
+        std::memcpy(buffer.data(), &header, sizeof(header));
+        std::memcpy(buffer.data() + sizeof(_header), entries.data(), entries.size() * sizeof(_entry));
+        std::memcpy(buffer.data() + sizeof(_header) + entries.size() * sizeof(_entry), coverage.data(), coverage.size());
+        if (!atlas._attach(buffer.data(), buffer.size())) {
+            throw std::logic_error(VK_GRAFFITI_BOT_FUNC_MSG("built atlas is invalid"));
+        }
+        return atlas;
+    }
+
+    // Maps an atlas saved earlier. Nothing is returned if there is no file,
+    // or if it is damaged or was made for another font or outline thickness.
+    [[nodiscard]] static inline std::optional<glyph_atlas> load(const std::filesystem::path& path,
+        const std::uint64_t font_hash, const float outline_thickness) {
+        std::error_code error;
+        if (!std::filesystem::exists(path, error)) {
+            return std::nullopt;
+        }
+        glyph_atlas atlas;
+        try {
+            atlas._file = mapped_file(path);
+        } catch (const std::exception& ex) {
+            log_warning(ex.what());
+            return std::nullopt;
+        }
+        if (!atlas._attach(static_cast<const char*>(atlas._file.data()), atlas._file.size())) {
+            log_warning(VK_GRAFFITI_BOT_FUNC_MSG("glyph atlas file is damaged: " + path.string()));
+            return std::nullopt;
+        }
+        if (atlas._header_data->font_hash != font_hash || atlas._header_data->outline_thickness != outline_thickness) {
+            log_info("glyph atlas file was made for another font", log_field("path", path.string()));
+            return std::nullopt;
+        }
+        return atlas;
+    }
+
+    glyph_atlas(const glyph_atlas&)            = delete;
+    glyph_atlas& operator=(const glyph_atlas&) = delete;
+
+    // the views point into the heap buffer or the mapping, both keep their address when moved
+    glyph_atlas(glyph_atlas&&) noexcept            = default;
+    glyph_atlas& operator=(glyph_atlas&&) noexcept = default;
+
+    // written to a temporary file that replaces the old one, so a crash never leaves half an atlas
+    inline void save(const std::filesystem::path& path) const {
+        if (!_header_data) {
+            throw std::logic_error(VK_GRAFFITI_BOT_FUNC_MSG("atlas is empty"));
+        }
+        const auto tmp_path = path.string() + ".tmp";
+        std::FILE* tmp = std::fopen(tmp_path.c_str(), "wb");
+        if (!tmp) {
+            throw std::runtime_error(VK_GRAFFITI_BOT_FUNC_MSG("open glyph atlas file error: " + tmp_path));
+        }
+        const std::size_t size = get_size_bytes();
+        const bool written = std::fwrite(_header_data, 1, size, tmp) == size;
+        if (std::fclose(tmp) != 0 || !written) {
+            std::remove(tmp_path.c_str());
+            throw std::runtime_error(VK_GRAFFITI_BOT_FUNC_MSG("glyph atlas file write error: " + tmp_path));
+        }
+        std::error_code error;
+        std::filesystem::rename(tmp_path, path, error);
+        if (error) {
+            std::remove(tmp_path.c_str());
+            throw std::runtime_error(VK_GRAFFITI_BOT_FUNC_MSG("glyph atlas file rename error: " + error.message()));
+        }
+    }
+
+    [[nodiscard]] inline bool empty() const noexcept {
+        return !_header_data || _header_data->glyphs_count == 0;
+    }
+
+    [[nodiscard]] inline std::uint64_t get_font_hash() const noexcept {
+        return _header_data ? _header_data->font_hash : 0;
+    }
+
+    [[nodiscard]] inline float get_outline_thickness() const noexcept {
+        return _header_data ? _header_data->outline_thickness : 0;
+    }
+
+    [[nodiscard]] inline std::size_t get_glyphs_count() const noexcept {
+        return _header_data ? _header_data->glyphs_count : 0;
+    }
+
+    [[nodiscard]] inline std::size_t get_size_bytes() const noexcept {
+        return _header_data ? sizeof(_header) + get_glyphs_count() * sizeof(_entry) + _header_data->coverage_size : 0;
+    }
+
+    // the character sizes the atlas has glyphs for, in ascending order
+    [[nodiscard]] inline std::vector<unsigned> get_character_sizes() const {
+        std::vector<unsigned> sizes;
+        for (std::size_t i = 0; i < get_glyphs_count(); ++i) {
+            if (sizes.empty() || sizes.back() != _entries[i].character_size) {
+                sizes.push_back(_entries[i].character_size);
+            }
+        }
+        return sizes;
+    }
+
+    [[nodiscard]] inline bool has_character_size(const unsigned character_size) const noexcept {
+        const auto last  = _entries + get_glyphs_count();
+        const auto entry = std::lower_bound(_entries, last, character_size,
+            [](const _entry& current, const unsigned size) {
+                return current.character_size < size;
+            });
+        return entry != last && entry->character_size == character_size;
+    }
+
+    // a copy of the glyph, nothing if the atlas does not have it
+    [[nodiscard]] inline std::optional<rasterized_glyph> find(const char32_t codepoint,
+        const unsigned character_size) const {
+        const auto last  = _entries + get_glyphs_count();
+        const auto entry = std::lower_bound(_entries, last, character_size,
+            [codepoint](const _entry& current, const unsigned size) {
+                return _less(current, size, static_cast<std::uint32_t>(codepoint));
+            });
+        if (entry == last || entry->character_size != character_size || entry->codepoint != codepoint) {
+            return std::nullopt;
+        }
+        rasterized_glyph glyph;
+        glyph.advance = entry->advance;
+        glyph.fill    = _to_bitmap(entry->fill);
+        glyph.outline = _to_bitmap(entry->outline);
+        return glyph;
+    }
+};
+VK_GRAFFITI_BOT_END
+
+#endif // !VK_GRAFFITI_BOT_GLYPH_ATLAS_HPP
@@ -2,7 +2,20 @@
 #define VK_GRAFFITI_BOT_HPP
 
 #include "base_vk_bot.hpp"
+#include "image_encoder.hpp"
+#include "text_mask_cache.hpp"
+#include "glyph_atlas.hpp"
+#include "result_cache.hpp"
+#include "pipeline_stage.hpp"
+#include "metrics.hpp"
 
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <mutex>
+#include <future>
+#include <thread>
+#include <algorithm>
 #include <codecvt>
 #include <utility>
 #include <optional>
@@ -10,48 +23,258 @@
 
 #include <SFML/Graphics.hpp>
 
+namespace benchmark {
+struct graffiti_bot_access;
+} // benchmark
+
 VK_GRAFFITI_BOT_BEGIN
+enum class render_mode {
+    // draws through sf::RenderTexture, needs an OpenGL context
+    render_texture,
+    // rasterizes the text with FreeType and blends it into the image pixels, works without display or GL
+    cpu
+};
+
+// stages a photo goes through, in order
+enum class graffiti_stage {
+    fetch,
+    decode,
+    composite,
+    encode,
+    upload,
+    reply
+};
+
+[[nodiscard]] inline const char* to_string(const graffiti_stage stage) noexcept {
+    static constexpr const char* names[] = { "fetch", "decode", "composite", "encode", "upload", "reply" };
+    return names[static_cast<std::size_t>(stage)];
+}
+
 class graffiti_bot : public base_vk_bot {
+    // the render benchmark measures the private steps one by one
+    friend struct benchmark::graffiti_bot_access;
+
+public:
+    static constexpr std::size_t stages_count = 6;
+
 private:
-    sf::Text _text;
-    sf::Font _font;
-    std::filesystem::path _img_cach_path;
+    static constexpr float _outline_thickness = 1.5f;
+    // character sizes come from the users, a glyph is never rendered larger than this or than the photo
+    static constexpr int _max_character_size = 1000;
+
+    // sf::Font, sf::Text and FreeType faces are not thread-safe, so each composite thread renders with its own copy
+    struct _render_state {
+        sf::Font font;
+        sf::Text text;
+        std::unique_ptr<text_rasterizer> rasterizer;
+    };
+
+    // The font, the rendered captions and the stages of all bots made with the sharing constructor.
+    // The render states and the stages are created by the first of them to start and destroyed by the last to stop.
+    struct _shared_state {
+        render_mode mode;
+        std::vector<char> font_data;
+        text_mask_cache text_masks;
+        // network stages run many transfers at once, cpu stages as many as there are cores
+        std::size_t network_concurrency  = 16;
+        std::size_t render_concurrency   = std::max(1u, std::thread::hardware_concurrency());
+        std::size_t stage_queue_capacity = 64;
+        // glyphs rendered before the first message, the atlas of render_mode::cpu outlives restarts
+        std::vector<unsigned> warm_up_sizes;
+        std::filesystem::path glyph_atlas_path;
+        std::shared_ptr<const glyph_atlas> atlas;
+        std::mutex mutex;
+        // the started bots, their caches and rate limits are exported with a group label
+        std::vector<graffiti_bot*> running;
+        std::vector<std::unique_ptr<_render_state>> render_states;
+        // declared after the render states, so the stage threads stop before the state they use is destroyed
+        std::array<std::unique_ptr<pipeline_stage>, stages_count> stages;
+        // exports the stages and caches, removed before the stages are destroyed
+        metrics_registry::collector_handle metrics_collector;
+
+        inline explicit _shared_state(const render_mode mode) :
+            mode(mode) {}
+    };
+
     float _default_character_size = 100;
+    int _jpeg_quality             = 90;
+    // larger side of the photo the character sizes are given for, 0 means the largest available photo
+    std::size_t _target_photo_dimension = 1280;
+    image_download_limits _photo_download_limits;
+    // attachments belong to the group that uploaded them, so every group caches its own
+    result_cache _result_cache;
+    // connections of the fetch, upload and reply threads, indexed by stage and slot
+    std::array<std::vector<std::unique_ptr<bot_worker>>, stages_count> _stage_workers;
+    // declared last, so the stage threads stop before the connections they use are destroyed
+    std::shared_ptr<_shared_state> _shared;
+
+    [[nodiscard]] inline std::string _group_label() const {
+        return metrics_label("group", std::to_string(get_group_id()));
+    }
+
+    static inline void _collect_metrics(_shared_state& shared, metrics_writer& writer) {
+        std::lock_guard lock(shared.mutex);
+        // the stages are being destroyed by the last bot to stop
+        if (shared.running.empty()) {
+            return;
+        }
+        const auto& stages = shared.stages;
+        for (const auto& stage : stages) {
+            writer.gauge("vk_graffiti_bot_stage_queue_depth", "Photos waiting for a stage.",
+                metrics_label("stage", stage->get_name()), static_cast<double>(stage->get_queue_depth()));
+        }
+        for (const auto& stage : stages) {
+            writer.gauge("vk_graffiti_bot_stage_active", "Photos a stage is working on.",
+                metrics_label("stage", stage->get_name()), static_cast<double>(stage->get_active_count()));
+        }
+        for (const auto& stage : stages) {
+            writer.histogram("vk_graffiti_bot_stage_wait_seconds", "Time photos wait in the queue of a stage.",
+                metrics_label("stage", stage->get_name()), stage->get_wait_time().get_snapshot());
+        }
+        for (const auto& stage : stages) {
+            writer.histogram("vk_graffiti_bot_stage_run_seconds", "Time a stage spends on a photo.",
+                metrics_label("stage", stage->get_name()), stage->get_run_time().get_snapshot());
+        }
+        writer.counter("vk_graffiti_bot_text_cache_hits_total", "Captions taken from the text mask cache.",
+            {}, shared.text_masks.get_hits());
+        writer.counter("vk_graffiti_bot_text_cache_misses_total", "Captions that had to be rasterized.",
+            {}, shared.text_masks.get_misses());
+
+        // samples of one family go together, so every family walks over all groups
+        for (const auto bot : shared.running) {
+            writer.counter("vk_graffiti_bot_result_cache_hits_total", "Photos answered from the result cache.",
+                bot->_group_label(), bot->_result_cache.get_hits());
+        }
+        for (const auto bot : shared.running) {
+            writer.counter("vk_graffiti_bot_result_cache_misses_total", "Photos that had to be rendered.",
+                bot->_group_label(), bot->_result_cache.get_misses());
+        }
+
+        std::vector<api_scheduler_metrics> schedulers;
+        for (const auto bot : shared.running) {
+            schedulers.push_back(bot->api().scheduler().get_metrics());
+        }
+        for (std::size_t i = 0; i < schedulers.size(); ++i) {
+            writer.gauge("vk_graffiti_bot_api_queue_depth", "VK API calls waiting for the rate limit.",
+                shared.running[i]->_group_label(), static_cast<double>(schedulers[i].queue_depth));
+        }
+        for (std::size_t i = 0; i < schedulers.size(); ++i) {
+            writer.counter("vk_graffiti_bot_api_throttled_total", "VK API calls that waited for the rate limit.",
+                shared.running[i]->_group_label(), schedulers[i].throttled);
+        }
+        for (std::size_t i = 0; i < schedulers.size(); ++i) {
+            writer.counter("vk_graffiti_bot_api_retries_total", "Retried VK API calls.",
+                shared.running[i]->_group_label(), schedulers[i].retries);
+        }
+        for (std::size_t i = 0; i < schedulers.size(); ++i) {
+            writer.counter("vk_graffiti_bot_api_rate_limit_errors_total", "Too many requests per second errors.",
+                shared.running[i]->_group_label(), schedulers[i].rate_limit_errors);
+        }
+    }
 
     [[nodiscard]] static inline std::wstring string_to_wstring(const std::string& string) {
         std::wstring_convert<std::codecvt_utf8<wchar_t>> converter;
         return converter.from_bytes(string);
     }
 
-    [[nodiscard]] static inline std::string _max_size_photo_url(const nlohmann::json& sizes) {
-        const auto max_it = std::max_element(sizes.begin(), sizes.end(), [](const auto& left, const auto& right) {
-            const auto left_area  =
-                left["width"].template get<std::size_t>() * left["height"].template get<std::size_t>();
-            const auto right_area =
-                right["width"].template get<std::size_t>() * right["height"].template get<std::size_t>();
-            return left_area < right_area;
-        });
-        return (*max_it)["url"].get<std::string>();
+    [[nodiscard]] static inline std::u32string string_to_u32string(const std::string& string) {
+        std::wstring_convert<std::codecvt_utf8<char32_t>, char32_t> converter;
+        return converter.from_bytes(string);
     }
 
-    [[nodiscard]] inline std::string _get_img_cach_attachment(const int peer_id) {
-        // get server to load
-        const auto upload_server = api().photos().get_messages_upload_server(peer_id);
+    // upper bounds of the larger side of vk size types, used when the sizes come without dimensions
+    [[nodiscard]] static inline std::size_t _photo_type_max_dimension(const std::string& type) noexcept {
+        static const std::pair<const char*, std::size_t> dimensions[] = {
+            { "s", 75 }, { "m", 130 }, { "x", 604 }, { "o", 130 }, { "p", 200 }, { "q", 320 },
+            { "r", 510 }, { "y", 807 }, { "z", 1080 }, { "w", 2560 }
+        };
+        for (const auto& [name, dimension] : dimensions) {
+            if (type == name) {
+                return dimension;
+            }
+        }
+        return 0;
+    }
 
-        // load to server
-        std::string answer;
-        api().curl().perform(upload_server.upload_url, answer, "photo", _img_cach_path);
+    // o, p, q and r may be cropped, they are only used when nothing else is available
+    [[nodiscard]] static inline bool _is_cropped_photo_type(const std::string& type) noexcept {
+        return type == "o" || type == "p" || type == "q" || type == "r";
+    }
+
+    // the smallest size whose larger side reaches target_dimension, or the largest one when none does,
+    // target_dimension 0 always selects the largest size
+    [[nodiscard]] static inline photo_size _select_photo_size(
+        const std::vector<photo_size>& sizes, const std::size_t target_dimension) {
+        std::vector<photo_size> candidates;
+        bool has_uncropped = false;
+        for (photo_size size : sizes) {
+            if (size.width == 0 || size.height == 0) {
+                size.width = size.height = _photo_type_max_dimension(size.type);
+            }
+            has_uncropped = has_uncropped || !_is_cropped_photo_type(size.type);
+            candidates.push_back(std::move(size));
+        }
+        if (has_uncropped) {
+            candidates.erase(std::remove_if(candidates.begin(), candidates.end(), [](const auto& size) {
+                return _is_cropped_photo_type(size.type);
+            }), candidates.end());
+        }
+        if (candidates.empty()) {
+            throw std::runtime_error(VK_GRAFFITI_BOT_FUNC_MSG("photo has no sizes"));
+        }
+
+        const auto by_area = [](const auto& left, const auto& right) {
+            return left.area() < right.area();
+        };
+        std::sort(candidates.begin(), candidates.end(), by_area);
+        if (target_dimension != 0) {
+            for (auto& size : candidates) {
+                if (size.max_dimension() >= target_dimension) {
+                    return std::move(size);
+                }
+            }
+        }
+        return std::move(candidates.back());
+    }
+
+    // the upload answer, or nullopt when the upload server did not accept the photo
+    [[nodiscard]] static inline std::optional<nlohmann::json> _upload_photo(
+        vk_api& api, const std::string& upload_url, const std::vector<unsigned char>& photo_data) {
+        try {
+            std::string answer;
+            api.curl().perform(upload_url, answer, "photo", photo_data.data(), photo_data.size(), "photo.jpg");
+            auto answer_json = nlohmann::json::parse(answer);
+            if (answer_json.contains("error") || !answer_json.contains("photo") || answer_json["photo"] == "[]") {
+                return std::nullopt;
+            }
+            return answer_json;
+        } catch (const std::exception& ex) {
+            log_warning(ex.what());
+            return std::nullopt;
+        }
+    }
+
+    [[nodiscard]] static inline std::string _upload_photo_attachment(
+        vk_api& api, const int peer_id, const std::vector<unsigned char>& photo_data) {
+        // load to the cached server first, the server is requested again only if that fails
+        auto answer_json = _upload_photo(api, api.photos().get_messages_upload_server(peer_id).upload_url, photo_data);
+        if (!answer_json) {
+            api.photos().invalidate_messages_upload_server(peer_id);
+            answer_json = _upload_photo(api, api.photos().get_messages_upload_server(peer_id).upload_url, photo_data);
+            if (!answer_json) {
+                throw std::runtime_error(VK_GRAFFITI_BOT_FUNC_MSG("photo upload error"));
+            }
+        }
 
         // save on server
-        nlohmann::json answer_json = nlohmann::json::parse(answer);
-        answer_json = api().photos().save_messages_photo(answer_json["photo"].get<std::string>(),
-            answer_json["server"].get<int>(), answer_json["hash"].get<std::string>());
-        if (answer_json.contains("error")) {
-            throw std::runtime_error(VK_GRAFFITI_BOT_FUNC_MSG(answer_json["error"]["error_msg"].get<std::string>()));
+        answer_json = api.photos().save_messages_photo((*answer_json)["photo"].get<std::string>(),
+            (*answer_json)["server"].get<int>(), (*answer_json)["hash"].get<std::string>());
+        if (answer_json->contains("error")) {
+            throw std::runtime_error(VK_GRAFFITI_BOT_FUNC_MSG((*answer_json)["error"]["error_msg"].get<std::string>()));
         }
 
         // construct attachment
-        const auto answer_json_response_first = answer_json["response"][0];
+        const auto answer_json_response_first = (*answer_json)["response"][0];
         const auto owner_id = answer_json_response_first["owner_id"].get<int>();
         const auto photo_id = answer_json_response_first["id"].get<int>();
         return "photo" + std::to_string(owner_id) + '_' + std::to_string(photo_id);
@@ -62,25 +285,39 @@ private:
         std::optional<float> character_size;
     };
 
+    // the source photo, the caption and the settings that change the rendered result
+    [[nodiscard]] inline result_cache_key _make_result_cache_key(const photo_attachment& photo,
+        const photo_size& size, const _graffiti_info& info) const {
+        result_cache_key_builder builder;
+        builder.add(photo.owner_id).add(photo.id).add(size.url);
+        builder.add(info.text).add(std::llround(info.character_size.value_or(0) * 100));
+        builder.add(static_cast<long long>(_target_photo_dimension)).add(_jpeg_quality);
+        builder.add(static_cast<long long>(_shared->mode));
+        return builder.get();
+    }
+
     [[nodiscard]] static inline _graffiti_info _parse_text(const std::string& text) {
         _graffiti_info info;
         if (text.empty()) {
             return info;
         }
 
-        std::string character_size_str;
-        bool looking_for_digit = true;
+        int character_size = 0;
+        bool has_character_size = false;
+        bool looking_for_digit  = true;
         for (const auto ch : text) {
             if (looking_for_digit) {
                 if (ch == ' ') {
                     continue;;
                 }
 
-                if (std::isdigit(ch)) {
-                    character_size_str += ch;
+                if (std::isdigit(static_cast<unsigned char>(ch))) {
+                    // saturates instead of overflowing on a long run of digits
+                    character_size = std::min(character_size * 10 + (ch - '0'), _max_character_size);
+                    has_character_size = true;
                 } else {
-                    if (!character_size_str.empty()) {
-                        info.character_size = std::make_optional(std::stoi(character_size_str));
+                    if (has_character_size) {
+                        info.character_size = static_cast<float>(std::max(character_size, 1));
                     }
                     info.text += ch;
                     looking_for_digit = false;
@@ -93,7 +330,27 @@ private:
         return info;
     }
 
-    inline void _process_image(sf::Image& image, const _graffiti_info& info) {
+    [[nodiscard]] static inline sf::Vector2f _text_position(
+        const sf::Vector2f& image_size, const float text_width, const float text_height) noexcept {
+        return { image_size.x / 2 - text_width / 2, (image_size.y - image_size.y / 3.5f) - text_height / 2 };
+    }
+
+    inline void _process_image_cpu(text_rasterizer& rasterizer, sf::Image& image, const _graffiti_info& info) {
+        const sf::Vector2f image_size(image.getSize());
+        // a mask larger than the photo would mostly be cut off, it is refused before its memory is taken
+        const std::size_t max_pixels = static_cast<std::size_t>(image.getSize().x) * image.getSize().y;
+        const auto mask = _shared->text_masks.get_or_rasterize(rasterizer, string_to_u32string(info.text),
+            static_cast<unsigned>(*info.character_size), max_pixels);
+        if (static_cast<std::size_t>(mask->width) * mask->height > max_pixels) {
+            throw std::runtime_error(VK_GRAFFITI_BOT_FUNC_MSG("text is too large"));
+        }
+        const auto position = _text_position(image_size, static_cast<float>(mask->width),
+            static_cast<float>(mask->height));
+        blend_text_mask(image, *mask, static_cast<int>(position.x), static_cast<int>(position.y),
+            sf::Color::White, sf::Color::Black);
+    }
+
+    static inline void _process_image(sf::Text& text, sf::Image& image, const _graffiti_info& info) {
         const sf::Vector2f image_size(image.getSize());
         sf::Texture texture;
         if (!texture.loadFromImage(image)) {
@@ -104,88 +361,573 @@ private:
         sf::RenderTexture render_texture;
         render_texture.create(image_size.x, image_size.y);
 
-        _text.setString(string_to_wstring(info.text));
-        _text.setCharacterSize(*info.character_size);
-        const auto text_local_bounds = _text.getLocalBounds();
-        _text.setPosition(image_size.x / 2 - text_local_bounds.width / 2,
-            (image_size.y - image_size.y / 3.5f) - text_local_bounds.height / 2);
+        text.setString(string_to_wstring(info.text));
+        text.setCharacterSize(*info.character_size);
+        const auto text_local_bounds = text.getLocalBounds();
+        const auto position = _text_position(image_size, text_local_bounds.width, text_local_bounds.height);
+        text.setPosition(position.x, position.y);
 
         render_texture.draw(sprite);
-        render_texture.draw(_text);
+        render_texture.draw(text);
         render_texture.display();
 
         image = render_texture.getTexture().copyToImage();
     }
 
-    inline void on_new_message(const int from_id, const message& message_recv) override {
-        message message_answer;
+    [[nodiscard]] inline std::size_t _stage_concurrency(const graffiti_stage stage) const noexcept {
+        switch (stage) {
+        case graffiti_stage::fetch:
+        case graffiti_stage::upload:
+        case graffiti_stage::reply:
+            return _shared->network_concurrency;
+        default:
+            return _shared->render_concurrency;
+        }
+    }
 
-        try {
-            const auto attachment_recv = nlohmann::json::parse(message_recv.attachment);
-            auto info                  = _parse_text(message_recv.text);
-            if (info.text.empty() || attachment_recv.empty()) {
-                message_answer.text = api().curl().encode_url("Error! No text or photo is specified.");
-                api().messages().send(from_id, message_answer);
+    [[nodiscard]] inline static bool _is_network_stage(const graffiti_stage stage) noexcept {
+        return stage == graffiti_stage::fetch || stage == graffiti_stage::upload || stage == graffiti_stage::reply;
+    }
+
+    [[nodiscard]] static inline bool _has_character_sizes(const glyph_atlas& atlas,
+        const std::vector<unsigned>& sizes) noexcept {
+        return std::all_of(sizes.begin(), sizes.end(), [&atlas](const unsigned size) {
+            return atlas.has_character_size(size);
+        });
+    }
+
+    // Takes the atlas from the file if it has every warm-up size, otherwise renders it with rasterizer
+    // and saves it for the next start. Expects _shared->mutex to be locked.
+    inline void _prepare_glyph_atlas(text_rasterizer& rasterizer) {
+        auto& shared = *_shared;
+        if (shared.atlas && _has_character_sizes(*shared.atlas, shared.warm_up_sizes)) {
+            return;
+        }
+        shared.atlas.reset();
+
+        const auto start = std::chrono::steady_clock::now();
+        const auto elapsed_ms = [&start] {
+            return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        };
+        if (!shared.glyph_atlas_path.empty()) {
+            auto loaded = glyph_atlas::load(shared.glyph_atlas_path, rasterizer.get_font_hash(), _outline_thickness);
+            if (loaded && _has_character_sizes(*loaded, shared.warm_up_sizes)) {
+                shared.atlas = std::make_shared<const glyph_atlas>(std::move(*loaded));
+                log_info("glyph atlas loaded", log_field("glyphs", shared.atlas->get_glyphs_count()),
+                    log_field("bytes", shared.atlas->get_size_bytes()), log_field("ms", elapsed_ms()));
                 return;
             }
-            if (!info.character_size) {
-                info.character_size = _default_character_size;
+        }
+        if (shared.warm_up_sizes.empty()) {
+            return;
+        }
+
+        auto built = std::make_shared<const glyph_atlas>(
+            rasterizer.make_glyph_atlas(shared.warm_up_sizes, warm_up_characters()));
+        log_info("glyph atlas built", log_field("glyphs", built->get_glyphs_count()),
+            log_field("bytes", built->get_size_bytes()), log_field("ms", elapsed_ms()));
+        if (!shared.glyph_atlas_path.empty()) {
+            try {
+                built->save(shared.glyph_atlas_path);
+            } catch (const std::exception& ex) {
+                log_warning(ex.what());
+            }
+        }
+        shared.atlas = std::move(built);
+    }
+
+    // sf::Font renders a glyph the first time it is asked for it, the fill and the outline separately
+    static inline void _warm_up_font(sf::Font& font, const std::vector<unsigned>& sizes) {
+        const auto characters = warm_up_characters();
+        for (const unsigned size : sizes) {
+            for (const char32_t codepoint : characters) {
+                font.getGlyph(codepoint, size, false);
+                font.getGlyph(codepoint, size, false, _outline_thickness);
+            }
+        }
+    }
+
+    // expects _shared->mutex to be locked
+    inline void _create_shared_stages() {
+        auto& shared = *_shared;
+        if (shared.font_data.empty()) {
+            throw std::runtime_error(VK_GRAFFITI_BOT_FUNC_MSG("font is not loaded"));
+        }
+
+        std::vector<std::unique_ptr<_render_state>> render_states;
+        for (std::size_t i = 0; i < shared.render_concurrency; ++i) {
+            auto state = std::make_unique<_render_state>();
+            if (shared.mode == render_mode::cpu) {
+                state->rasterizer = std::make_unique<text_rasterizer>(
+                    shared.font_data.data(), shared.font_data.size(), _outline_thickness);
+            } else {
+                if (!state->font.loadFromMemory(shared.font_data.data(), shared.font_data.size())) {
+                    throw std::runtime_error(VK_GRAFFITI_BOT_FUNC_MSG("load font error"));
+                }
+                state->text.setFont(state->font);
+                state->text.setFillColor(sf::Color::White);
+                state->text.setOutlineThickness(_outline_thickness);
+                state->text.setOutlineColor(sf::Color::Black);
+                _warm_up_font(state->font, shared.warm_up_sizes);
+            }
+            render_states.push_back(std::move(state));
+        }
+        // one atlas is rendered and shared by all the rasterizers
+        if (shared.mode == render_mode::cpu) {
+            _prepare_glyph_atlas(*render_states.front()->rasterizer);
+            for (auto& state : render_states) {
+                state->rasterizer->set_glyph_atlas(shared.atlas);
+            }
+        }
+        shared.render_states = std::move(render_states);
+
+        for (std::size_t i = 0; i < stages_count; ++i) {
+            const auto stage = static_cast<graffiti_stage>(i);
+            shared.stages[i] = std::make_unique<pipeline_stage>(to_string(stage), _stage_concurrency(stage),
+                shared.stage_queue_capacity);
+        }
+    }
+
+    // An export holds the registry lock while _collect_metrics waits for _shared->mutex,
+    // so the collector is added without holding it. A handle replaced here belongs to stages
+    // torn down before this bot registered its own and is removed outside the lock as well.
+    inline void _register_metrics_collector() {
+        auto& shared = *_shared;
+        auto collector = global_metrics().add_collector([&shared](metrics_writer& writer) {
+            _collect_metrics(shared, writer);
+        });
+        {
+            std::lock_guard lock(shared.mutex);
+            std::swap(shared.metrics_collector, collector);
+        }
+    }
+
+    inline void on_start(const std::size_t workers_count) override {
+        bool created = false;
+        {
+            std::lock_guard lock(_shared->mutex);
+            if (_shared->running.empty()) {
+                _create_shared_stages();
+                created = true;
+            }
+            // the stages may have been started by another bot with other settings
+            for (std::size_t i = 0; i < stages_count; ++i) {
+                _stage_workers[i].clear();
+                if (_is_network_stage(static_cast<graffiti_stage>(i))) {
+                    for (std::size_t slot = 0; slot < _shared->stages[i]->get_concurrency(); ++slot) {
+                        _stage_workers[i].push_back(std::make_unique<bot_worker>(slot, api()));
+                    }
+                }
             }
+            _shared->running.push_back(this);
+        }
+        if (created) {
+            _register_metrics_collector();
+        }
+    }
+
+    inline void on_stop() override {
+        std::vector<std::unique_ptr<_render_state>> render_states;
+        std::array<std::unique_ptr<pipeline_stage>, stages_count> stages;
+        metrics_registry::collector_handle metrics_collector;
+        {
+            std::lock_guard lock(_shared->mutex);
+            auto& running = _shared->running;
+            const auto it = std::find(running.begin(), running.end(), this);
+            if (it == running.end()) {
+                return;
+            }
+            running.erase(it);
+            if (!running.empty()) {
+                return;
+            }
+            render_states     = std::move(_shared->render_states);
+            stages            = std::move(_shared->stages);
+            metrics_collector = std::move(_shared->metrics_collector);
+        }
+        // destroyed outside the lock an export may be waiting for,
+        // the collector goes first, then the idle stages and the render states they used
+        metrics_collector.reset();
+        for (auto& stage : stages) {
+            stage.reset();
+        }
+    }
+
+    // a message with photos, answered by the photo job that finishes last
+    struct _message_job {
+        long long request_id = 0;
+        int peer_id = 0;
+        std::vector<std::string> attachments;
+        std::vector<std::exception_ptr> errors;
+        std::atomic<std::size_t> remaining = 0;
+        std::shared_future<nlohmann::json> photo_received_answer;
+        message_done done;
+    };
+
+    // one photo of a message on its way from the download to the attachment
+    struct _photo_job {
+        long long request_id = 0;
+        int peer_id = 0;
+        std::shared_ptr<_message_job> message;
+        std::size_t index = 0;
+        photo_size size;
+        result_cache_key result_key;
+        _graffiti_info info;
+        std::vector<std::byte> data;
+        sf::Image image;
+        std::vector<unsigned char> jpeg;
+        std::string attachment;
+        std::exception_ptr error;
+    };
+
+    [[nodiscard]] inline bot_worker& _stage_worker(const graffiti_stage stage, const std::size_t slot) noexcept {
+        return *_stage_workers[static_cast<std::size_t>(stage)][slot];
+    }
 
-            const std::string photo_recv_url = _max_size_photo_url(attachment_recv[0]["photo"]["sizes"]);
-            sf::Image photo_recv;
-            api().curl().perform(photo_recv_url, photo_recv);
-            api().messages().send(from_id, api().curl().encode_url("Photo received! I'm starting work..."));
-            _process_image(photo_recv, info);
-            photo_recv.saveToFile(_img_cach_path);
-            message_answer.attachment = _get_img_cach_attachment(from_id);
-            if (!std::filesystem::remove(_img_cach_path)) {
-                log_warning("img cach remove error");
+    inline void _run_photo_stage(const graffiti_stage stage, _photo_job& job, const std::size_t slot) {
+        switch (stage) {
+        case graffiti_stage::fetch:
+            _stage_worker(stage, slot).curl().perform(job.size.url, job.data, _photo_download_limits);
+        break;
+        case graffiti_stage::decode: {
+            if (!job.image.loadFromMemory(static_cast<const void*>(job.data.data()), job.data.size())) {
+                throw std::runtime_error(VK_GRAFFITI_BOT_FUNC_MSG("photo decode error"));
+            }
+            std::vector<std::byte>().swap(job.data);
+            const auto image_size = job.image.getSize();
+            const float largest_side = static_cast<float>(std::max({ image_size.x, image_size.y, 1u }));
+            if (_target_photo_dimension != 0) {
+                // keep the text the same relative size whatever resolution was received
+                const float scale = largest_side / static_cast<float>(_target_photo_dimension);
+                job.info.character_size = std::round(*job.info.character_size * scale);
+            }
+            job.info.character_size = std::clamp(*job.info.character_size, 1.f,
+                std::min(largest_side, static_cast<float>(_max_character_size)));
+        }
+        break;
+        case graffiti_stage::composite:
+            if (_shared->mode == render_mode::cpu) {
+                _process_image_cpu(*_shared->render_states[slot]->rasterizer, job.image, job.info);
+            } else {
+                _process_image(_shared->render_states[slot]->text, job.image, job.info);
+            }
+        break;
+        case graffiti_stage::encode:
+            job.jpeg  = encode_jpeg(job.image, _jpeg_quality);
+            job.image = sf::Image();
+        break;
+        case graffiti_stage::upload:
+            job.attachment = _upload_photo_attachment(_stage_worker(stage, slot).api(), job.peer_id, job.jpeg);
+            std::vector<unsigned char>().swap(job.jpeg);
+            _result_cache.put(job.result_key, job.attachment);
+        break;
+        default:
+            throw std::logic_error(VK_GRAFFITI_BOT_FUNC_MSG("not a photo stage"));
+        }
+    }
+
+    // the job moves on to the next stage when this one is done, it is finished after the upload or on error
+    inline void _push_photo_job(const graffiti_stage stage, const std::shared_ptr<_photo_job>& job) {
+        try {
+            _shared->stages[static_cast<std::size_t>(stage)]->push([this, stage, job](const std::size_t slot) {
+                log_request_scope request_scope(job->request_id);
+                try {
+                    _run_photo_stage(stage, *job, slot);
+                } catch (...) {
+                    job->error = std::current_exception();
+                    _finish_photo_job(*job);
+                    return;
+                }
+                if (stage == graffiti_stage::upload) {
+                    _finish_photo_job(*job);
+                    return;
+                }
+                _push_photo_job(static_cast<graffiti_stage>(static_cast<std::size_t>(stage) + 1), job);
+            });
+        } catch (...) {
+            job->error = std::current_exception();
+            _finish_photo_job(*job);
+        }
+    }
+
+    // the last photo of the message to finish sends the answer
+    inline void _finish_photo_job(_photo_job& job) {
+        auto& message_job = *job.message;
+        message_job.attachments[job.index] = std::move(job.attachment);
+        message_job.errors[job.index]      = job.error;
+        if (message_job.remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            _answer_message(message_job);
+        }
+    }
+
+    inline void _answer_message(_message_job& message_job) {
+        message message_answer;
+        try {
+            std::size_t failed_count = 0;
+            std::string last_error;
+            for (std::size_t i = 0; i < message_job.attachments.size(); ++i) {
+                if (message_job.errors[i]) {
+                    try {
+                        std::rethrow_exception(message_job.errors[i]);
+                    } catch (const std::exception& ex) {
+                        last_error = ex.what();
+                        log_warning(last_error);
+                    }
+                    ++failed_count;
+                    continue;
+                }
+                if (!message_answer.attachment.empty()) {
+                    message_answer.attachment += ',';
+                }
+                message_answer.attachment += message_job.attachments[i];
+            }
+
+            if (message_answer.attachment.empty()) {
+                throw std::runtime_error(last_error.empty() ? "photo processing error" : last_error);
+            }
+            message_answer.text = message_job.attachments.size() == 1 ? "Here is your photo!" : "Here are your photos!";
+            if (failed_count != 0) {
+                message_answer.text += " " + std::to_string(failed_count) + " of them could not be processed.";
             }
-            message_answer.text       = api().curl().encode_url("Here is your photo!");
         } catch (const std::exception& ex) {
-            message_answer.text = api().curl().encode_url(std::string("Server error: \"") + ex.what() + '\"');
+            message_answer.text = std::string("Server error: \"") + ex.what() + '\"';
             message_answer.attachment.clear();
         }
+        _reply(message_job.peer_id, std::move(message_answer), call_priority::high,
+            std::move(message_job.photo_received_answer), std::move(message_job.done));
+    }
+
+    // Sent from the reply stage after the notice, if there is one. The message is done once the reply
+    // is sent, only then the next message of the same user starts, so replies to one user keep their order.
+    inline void _reply(const int peer_id, message message_answer, const call_priority priority,
+        std::shared_future<nlohmann::json> photo_received_answer, message_done done) {
+        _shared->stages[static_cast<std::size_t>(graffiti_stage::reply)]->push(
+            [this, peer_id, message_answer = std::move(message_answer), priority,
+                photo_received_answer = std::move(photo_received_answer), done = std::move(done),
+                request_id = details::current_request_id](const std::size_t slot) {
+                log_request_scope request_scope(request_id);
+                // the notice has to arrive before the result
+                if (photo_received_answer.valid()) {
+                    try {
+                        photo_received_answer.get();
+                    } catch (const std::exception& ex) {
+                        log_error(ex.what());
+                    }
+                }
+                try {
+                    _stage_worker(graffiti_stage::reply, slot).api().messages().send(
+                        peer_id, message_answer, priority);
+                } catch (const std::exception& ex) {
+                    log_error(ex.what());
+                }
+            });
+    }
+
+    // The worker only parses the message and hands its photos to the stages shared by all workers,
+    // so one message renders while another downloads or uploads. The photo that finishes last
+    // sends the answer, the worker does not wait for it and takes messages of other users meanwhile.
+    inline void on_new_message(bot_worker& worker, const incoming_message& message_recv,
+        message_done done) override {
+        vk_api& api       = worker.api();
+        const int from_id = message_recv.from_id;
 
         try {
-            api().messages().send(from_id, message_answer);
+            auto info = _parse_text(message_recv.text);
+            if (info.text.empty() || message_recv.photos.empty()) {
+                _reply(from_id, message("Error! No text or photo is specified."), call_priority::normal,
+                    {}, std::move(done));
+                return;
+            }
+            if (!info.character_size) {
+                info.character_size = _default_character_size;
+            }
+
+            auto message_job        = std::make_shared<_message_job>();
+            message_job->request_id = message_recv.id;
+            message_job->peer_id    = from_id;
+            message_job->attachments.resize(message_recv.photos.size());
+            message_job->errors.resize(message_recv.photos.size());
+
+            // forwarded photos with the same caption may be rendered and uploaded already
+            std::vector<std::shared_ptr<_photo_job>> jobs;
+            for (std::size_t i = 0; i < message_recv.photos.size(); ++i) {
+                const auto& photo = message_recv.photos[i];
+                auto job          = std::make_shared<_photo_job>();
+                job->request_id   = message_recv.id;
+                job->peer_id      = from_id;
+                job->index        = i;
+                job->size         = _select_photo_size(photo.sizes, _target_photo_dimension);
+                job->result_key   = _make_result_cache_key(photo, job->size, info);
+                job->info         = info;
+                if (auto attachment = _result_cache.get(job->result_key)) {
+                    message_job->attachments[i] = std::move(*attachment);
+                } else {
+                    job->message = message_job;
+                    jobs.push_back(std::move(job));
+                }
+            }
+            if (jobs.empty()) {
+                message_job->done = std::move(done);
+                _answer_message(*message_job);
+                return;
+            }
+
+            message_job->remaining = jobs.size();
+            // sent while the photos are being rendered, replies with photos of other users go first
+            message_job->photo_received_answer = api.messages().send_async(
+                from_id, message("Photo received! I'm starting work..."), call_priority::low).share();
+            message_job->done = std::move(done);
+            for (const auto& job : jobs) {
+                _push_photo_job(graffiti_stage::fetch, job);
+            }
         } catch (const std::exception& ex) {
-            log_error(ex.what());
+            // the message is done when done goes out of scope, unless it was handed to the jobs
+            if (done) {
+                try {
+                    _reply(from_id, message(std::string("Server error: \"") + ex.what() + '\"'),
+                        call_priority::high, {}, std::move(done));
+                } catch (const std::exception& reply_ex) {
+                    log_error(reply_ex.what());
+                }
+            } else {
+                log_error(ex.what());
+            }
         }
     }
 
 public:
-    inline graffiti_bot(vk_api& api, const int group_id) :
-        base_vk_bot(api, group_id) {
-        _text.setFont(_font);
-        _text.setFillColor(sf::Color::White);
-        _text.setOutlineThickness(1.5);
-        _text.setOutlineColor(sf::Color::Black);
-    }
+    inline graffiti_bot(vk_api& api, const int group_id, const render_mode mode = render_mode::render_texture) :
+        base_vk_bot(api, group_id),
+        _shared(std::make_shared<_shared_state>(mode)) {}
+
+    // Serves another group through api with the worker pool, the font, the caption cache and the stages
+    // of shared_bot, so every group added costs little memory and no threads. The rate limit comes with api,
+    // the photo settings, the result cache and the cursor stay separate for every group.
+    // Each bot is started from a thread of its own.
+    inline graffiti_bot(vk_api& api, const int group_id, const graffiti_bot& shared_bot) :
+        base_vk_bot(api, group_id, shared_bot),
+        _shared(shared_bot._shared) {}
 
-    [[nodiscard]] inline const sf::Font& get_font() const noexcept {
-        return _font;
+    [[nodiscard]] inline render_mode get_render_mode() const noexcept {
+        return _shared->mode;
     }
 
     [[nodiscard]] inline float get_default_charcter_size() const noexcept {
         return _default_character_size;
     }
 
-    [[nodiscard]] inline const std::filesystem::path& get_img_cach_path() const noexcept {
-        return _img_cach_path;
+    [[nodiscard]] inline int get_jpeg_quality() const noexcept {
+        return _jpeg_quality;
+    }
+
+    [[nodiscard]] inline std::size_t get_target_photo_dimension() const noexcept {
+        return _target_photo_dimension;
+    }
+
+    [[nodiscard]] inline const image_download_limits& get_photo_download_limits() const noexcept {
+        return _photo_download_limits;
+    }
+
+    // rendered captions, used by render_mode::cpu and shared with the bots of other groups
+    [[nodiscard]] inline text_mask_cache& get_text_mask_cache() noexcept {
+        return _shared->text_masks;
+    }
+
+    [[nodiscard]] inline std::size_t get_network_concurrency() const noexcept {
+        return _shared->network_concurrency;
+    }
+
+    [[nodiscard]] inline std::size_t get_render_concurrency() const noexcept {
+        return _shared->render_concurrency;
+    }
+
+    [[nodiscard]] inline std::size_t get_stage_queue_capacity() const noexcept {
+        return _shared->stage_queue_capacity;
+    }
+
+    [[nodiscard]] inline const std::vector<unsigned>& get_warm_up_character_sizes() const noexcept {
+        return _shared->warm_up_sizes;
+    }
+
+    [[nodiscard]] inline const std::filesystem::path& get_glyph_atlas_file() const noexcept {
+        return _shared->glyph_atlas_path;
+    }
+
+    // queue depth and latency histograms of a stage, the stages exist once the bot is started
+    [[nodiscard]] inline pipeline_stage& get_stage(const graffiti_stage stage) {
+        auto& stage_ptr = _shared->stages[static_cast<std::size_t>(stage)];
+        if (!stage_ptr) {
+            throw std::runtime_error(VK_GRAFFITI_BOT_FUNC_MSG("bot is not started"));
+        }
+        return *stage_ptr;
+    }
+
+    // attachments of rendered photos, reused for identical requests
+    [[nodiscard]] inline result_cache& get_result_cache() noexcept {
+        return _result_cache;
     }
 
-    inline void set_font(const sf::Font& font) {
-        _font = font;
+    // the font is loaded separately by every worker, so the file content is kept in memory,
+    // bots made with the sharing constructor use the same font
+    inline void load_font(const std::filesystem::path& path) {
+        _shared->font_data = read_file(path);
+        _shared->atlas.reset();
     }
 
     inline void set_default_character_size(const float size) noexcept {
         _default_character_size = size;
     }
 
-    inline void set_img_cach_path(const std::filesystem::path& path) {
-        _img_cach_path = path;
+    inline void set_target_photo_dimension(const std::size_t dimension) noexcept {
+        _target_photo_dimension = dimension;
+    }
+
+    inline void set_photo_download_limits(const image_download_limits& limits) noexcept {
+        _photo_download_limits = limits;
+    }
+
+    // concurrency of the fetch, upload and reply stages
+    inline void set_network_concurrency(const std::size_t concurrency) {
+        if (concurrency == 0) {
+            throw std::invalid_argument(VK_GRAFFITI_BOT_FUNC_MSG("network concurrency must be positive"));
+        }
+        _shared->network_concurrency = concurrency;
+    }
+
+    // concurrency of the decode, composite and encode stages
+    inline void set_render_concurrency(const std::size_t concurrency) {
+        if (concurrency == 0) {
+            throw std::invalid_argument(VK_GRAFFITI_BOT_FUNC_MSG("render concurrency must be positive"));
+        }
+        _shared->render_concurrency = concurrency;
+    }
+
+    inline void set_stage_queue_capacity(const std::size_t capacity) {
+        if (capacity == 0) {
+            throw std::invalid_argument(VK_GRAFFITI_BOT_FUNC_MSG("stage queue capacity must be positive"));
+        }
+        _shared->stage_queue_capacity = capacity;
+    }
+
+    // printable ascii and cyrillic glyphs are rendered at these character sizes when the bot starts,
+    // so the first captions of a common size do not wait for FreeType
+    inline void set_warm_up_character_sizes(std::vector<unsigned> sizes) {
+        if (std::find(sizes.begin(), sizes.end(), 0u) != sizes.end()) {
+            throw std::invalid_argument(VK_GRAFFITI_BOT_FUNC_MSG("character sizes must be positive"));
+        }
+        _shared->warm_up_sizes = std::move(sizes);
+    }
+
+    // render_mode::cpu saves the warmed up glyphs to the file, later starts map it instead of rendering them
+    inline void set_glyph_atlas_file(const std::filesystem::path& path) {
+        _shared->glyph_atlas_path = path;
+    }
+
+    inline void set_jpeg_quality(const int quality) {
+        if (quality < 1 || quality > 100) {
+            throw std::invalid_argument(VK_GRAFFITI_BOT_FUNC_MSG("jpeg quality must be in range [1, 100]"));
+        }
+        _jpeg_quality = quality;
     }
 };
 VK_GRAFFITI_BOT_END
@@ -0,0 +1,148 @@
+#ifndef VK_GRAFFITI_BOT_IMAGE_ENCODER_HPP
+#define VK_GRAFFITI_BOT_IMAGE_ENCODER_HPP
+
+#include "utils.hpp"
+
+#include <csetjmp>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <stdexcept>
+
+#include <jpeglib.h>
+#include <jerror.h>
+
+#include <SFML/Graphics/Image.hpp>
+
+VK_GRAFFITI_BOT_BEGIN
+namespace details {
+struct jpeg_error_manager {
+    jpeg_error_mgr base;
+    std::jmp_buf jump_buffer;
+};
+
+// the default libjpeg error handler calls exit(), so errors are turned into a longjmp back to the encoder
+[[noreturn]] inline void jpeg_error_exit(j_common_ptr info) {
+    std::longjmp(reinterpret_cast<jpeg_error_manager*>(info->err)->jump_buffer, 1);
+}
+
+// Writes the compressed data straight into a vector, which stays valid whatever happens to the
+// compressor, unlike the buffer of jpeg_mem_dest that libjpeg frees and replaces as it grows.
+struct jpeg_vector_destination {
+    jpeg_destination_mgr base;
+    std::vector<unsigned char>* output;
+};
+
+inline void jpeg_vector_init(j_compress_ptr info) {
+    auto& destination = *reinterpret_cast<jpeg_vector_destination*>(info->dest);
+    destination.base.next_output_byte = destination.output->data();
+    destination.base.free_in_buffer   = destination.output->size();
+}
+
+// called when the whole vector is written, it grows twice
+inline boolean jpeg_vector_empty(j_compress_ptr info) {
+    auto& destination = *reinterpret_cast<jpeg_vector_destination*>(info->dest);
+    const std::size_t used = destination.output->size();
+    bool grown = true;
+    try {
+        destination.output->resize(used * 2);
+    } catch (...) {
+        grown = false;
+    }
+    if (!grown) {
+        // outside the catch block, the error exit does not return
+        ERREXIT(info, JERR_OUT_OF_MEMORY);
+    }
+    destination.base.next_output_byte = destination.output->data() + used;
+    destination.base.free_in_buffer   = destination.output->size() - used;
+    return TRUE;
+}
+
+inline void jpeg_vector_term(j_compress_ptr info) {
+    auto& destination = *reinterpret_cast<jpeg_vector_destination*>(info->dest);
+    destination.output->resize(destination.output->size() - destination.base.free_in_buffer);
+}
+
+// No objects with destructors live in this frame, so the longjmp is safe. output must not be empty,
+// it holds the jpeg afterwards, or anything on failure.
+inline bool encode_jpeg_to_buffer(const unsigned char* pixels, const unsigned width, const unsigned height,
+    const int quality, std::vector<unsigned char>& output) {
+#if !defined(JCS_EXTENSIONS)
+    unsigned char* const row_rgb = static_cast<unsigned char*>(std::malloc(width * 3));
+    if (!row_rgb) {
+        return false;
+    }
+#endif
+    jpeg_compress_struct info;
+    jpeg_error_manager error;
+    info.err = jpeg_std_error(&error.base);
+    error.base.error_exit = jpeg_error_exit;
+    if (setjmp(error.jump_buffer)) {
+        jpeg_destroy_compress(&info);
+#if !defined(JCS_EXTENSIONS)
+        std::free(row_rgb);
+#endif
+        return false;
+    }
+
+    jpeg_create_compress(&info);
+    jpeg_vector_destination destination;
+    destination.base.init_destination    = jpeg_vector_init;
+    destination.base.empty_output_buffer = jpeg_vector_empty;
+    destination.base.term_destination    = jpeg_vector_term;
+    destination.output = &output;
+    info.dest = &destination.base;
+    info.image_width      = width;
+    info.image_height     = height;
+#if defined(JCS_EXTENSIONS)
+    info.input_components = 4;
+    info.in_color_space   = JCS_EXT_RGBX;
+#else
+    info.input_components = 3;
+    info.in_color_space   = JCS_RGB;
+#endif
+    jpeg_set_defaults(&info);
+    jpeg_set_quality(&info, quality, TRUE);
+    jpeg_start_compress(&info, TRUE);
+    while (info.next_scanline < info.image_height) {
+        const unsigned char* row_rgba = pixels + static_cast<std::size_t>(info.next_scanline) * width * 4;
+#if defined(JCS_EXTENSIONS)
+        JSAMPROW row = const_cast<JSAMPROW>(row_rgba);
+#else
+        for (unsigned x = 0; x < width; ++x) {
+            row_rgb[x * 3 + 0] = row_rgba[x * 4 + 0];
+            row_rgb[x * 3 + 1] = row_rgba[x * 4 + 1];
+            row_rgb[x * 3 + 2] = row_rgba[x * 4 + 2];
+        }
+        JSAMPROW row = row_rgb;
+#endif
+        jpeg_write_scanlines(&info, &row, 1);
+    }
+    jpeg_finish_compress(&info);
+    jpeg_destroy_compress(&info);
+#if !defined(JCS_EXTENSIONS)
+    std::free(row_rgb);
+#endif
+    return true;
+}
+} // details
+
+[[nodiscard]] inline std::vector<unsigned char> encode_jpeg(const sf::Image& image, const int quality) {
+    if (quality < 1 || quality > 100) {
+        throw std::invalid_argument(VK_GRAFFITI_BOT_FUNC_MSG("jpeg quality must be in range [1, 100]"));
+    }
+    const auto size = image.getSize();
+    if (size.x == 0 || size.y == 0) {
+        throw std::invalid_argument(VK_GRAFFITI_BOT_FUNC_MSG("image is empty"));
+    }
+
+    // about two bits per pixel, most photos fit without growing the buffer
+    std::vector<unsigned char> result(static_cast<std::size_t>(size.x) * size.y / 4 + 4096);
+    if (!details::encode_jpeg_to_buffer(image.getPixelsPtr(), size.x, size.y, quality, result)) {
+        throw std::runtime_error(VK_GRAFFITI_BOT_FUNC_MSG("jpeg encode error"));
+    }
+    return result;
+}
+VK_GRAFFITI_BOT_END
+
+#endif // !VK_GRAFFITI_BOT_IMAGE_ENCODER_HPP
@@ -0,0 +1,158 @@
+#ifndef VK_GRAFFITI_BOT_IMAGE_HEADER_HPP
+#define VK_GRAFFITI_BOT_IMAGE_HEADER_HPP
+
+#include "utils.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+VK_GRAFFITI_BOT_BEGIN
+enum class image_format {
+    unknown,
+    jpeg,
+    png,
+    gif,
+    bmp
+};
+
+struct image_header {
+    image_format format = image_format::unknown;
+    unsigned width  = 0;
+    unsigned height = 0;
+};
+
+enum class image_probe_status {
+    // the dimensions are not reached yet
+    need_more_data,
+    // the data does not start like any image format that can be decoded
+    unknown_format,
+    ok
+};
+
+namespace details {
+[[nodiscard]] inline unsigned read_be16(const std::byte* data) noexcept {
+    return (std::to_integer<unsigned>(data[0]) << 8) | std::to_integer<unsigned>(data[1]);
+}
+
+[[nodiscard]] inline unsigned read_be32(const std::byte* data) noexcept {
+    return (read_be16(data) << 16) | read_be16(data + 2);
+}
+
+[[nodiscard]] inline unsigned read_le16(const std::byte* data) noexcept {
+    return std::to_integer<unsigned>(data[0]) | (std::to_integer<unsigned>(data[1]) << 8);
+}
+
+[[nodiscard]] inline std::int32_t read_le32(const std::byte* data) noexcept {
+    return static_cast<std::int32_t>(read_le16(data) | (read_le16(data + 2) << 16));
+}
+
+[[nodiscard]] inline bool starts_with(const std::byte* data, const std::size_t size,
+    const unsigned char* prefix, const std::size_t prefix_size) noexcept {
+    const std::size_t count = size < prefix_size ? size : prefix_size;
+    for (std::size_t i = 0; i < count; ++i) {
+        if (std::to_integer<unsigned char>(data[i]) != prefix[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+[[nodiscard]] inline image_probe_status probe_jpeg(const std::byte* data, const std::size_t size,
+    image_header& header) noexcept {
+    std::size_t offset = 2;
+    while (true) {
+        // markers may be preceded by any number of 0xFF fill bytes
+        while (offset < size && std::to_integer<unsigned>(data[offset]) == 0xFF &&
+            offset + 1 < size && std::to_integer<unsigned>(data[offset + 1]) == 0xFF) {
+            ++offset;
+        }
+        if (offset + 4 > size) {
+            return image_probe_status::need_more_data;
+        }
+        if (std::to_integer<unsigned>(data[offset]) != 0xFF) {
+            return image_probe_status::unknown_format;
+        }
+
+        const unsigned marker = std::to_integer<unsigned>(data[offset + 1]);
+        if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) {
+            offset += 2;
+            continue;
+        }
+        if (marker == 0xD9 || marker == 0xDA) {
+            // end of image or start of scan before any frame header
+            return image_probe_status::unknown_format;
+        }
+
+        const unsigned length = read_be16(data + offset + 2);
+        if (length < 2) {
+            return image_probe_status::unknown_format;
+        }
+        const bool is_frame_header = marker >= 0xC0 && marker <= 0xCF &&
+            marker != 0xC4 && marker != 0xC8 && marker != 0xCC;
+        if (is_frame_header) {
+            if (offset + 9 > size) {
+                return image_probe_status::need_more_data;
+            }
+            header.height = read_be16(data + offset + 5);
+            header.width  = read_be16(data + offset + 7);
+            return image_probe_status::ok;
+        }
+        offset += 2 + length;
+    }
+}
+} // details
+
+// Reads the format and the dimensions from the first bytes of an image,
+// so a download can be rejected long before it is complete.
+[[nodiscard]] inline image_probe_status probe_image_header(const std::byte* data, const std::size_t size,
+    image_header& header) noexcept {
+    static constexpr unsigned char jpeg_signature[] = { 0xFF, 0xD8, 0xFF };
+    static constexpr unsigned char png_signature[]  = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    static constexpr unsigned char gif_signature[]  = { 'G', 'I', 'F', '8' };
+    static constexpr unsigned char bmp_signature[]  = { 'B', 'M' };
+
+    if (size == 0) {
+        return image_probe_status::need_more_data;
+    }
+
+    if (details::starts_with(data, size, jpeg_signature, sizeof(jpeg_signature))) {
+        header.format = image_format::jpeg;
+        return size < sizeof(jpeg_signature) ?
+            image_probe_status::need_more_data : details::probe_jpeg(data, size, header);
+    }
+    if (details::starts_with(data, size, png_signature, sizeof(png_signature))) {
+        header.format = image_format::png;
+        // the IHDR chunk always comes first
+        if (size < 24) {
+            return image_probe_status::need_more_data;
+        }
+        header.width  = details::read_be32(data + 16);
+        header.height = details::read_be32(data + 20);
+        return image_probe_status::ok;
+    }
+    if (details::starts_with(data, size, gif_signature, sizeof(gif_signature))) {
+        header.format = image_format::gif;
+        if (size < 10) {
+            return image_probe_status::need_more_data;
+        }
+        header.width  = details::read_le16(data + 6);
+        header.height = details::read_le16(data + 8);
+        return image_probe_status::ok;
+    }
+    if (details::starts_with(data, size, bmp_signature, sizeof(bmp_signature))) {
+        header.format = image_format::bmp;
+        if (size < 26) {
+            return image_probe_status::need_more_data;
+        }
+        const std::int32_t width  = details::read_le32(data + 18);
+        const std::int32_t height = details::read_le32(data + 22);
+        // negative height means a top-down bitmap
+        header.width  = static_cast<unsigned>(width < 0 ? -static_cast<std::int64_t>(width) : width);
+        header.height = static_cast<unsigned>(height < 0 ? -static_cast<std::int64_t>(height) : height);
+        return image_probe_status::ok;
+    }
+    return image_probe_status::unknown_format;
+}
+VK_GRAFFITI_BOT_END
+
+#endif // !VK_GRAFFITI_BOT_IMAGE_HEADER_HPP
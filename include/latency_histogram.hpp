@@ -0,0 +1,124 @@
+#ifndef VK_GRAFFITI_BOT_LATENCY_HISTOGRAM_HPP
+#define VK_GRAFFITI_BOT_LATENCY_HISTOGRAM_HPP
+
+#include "utils.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <algorithm>
+
+VK_GRAFFITI_BOT_BEGIN
+// Log-linear histogram of microsecond latencies in the spirit of HdrHistogram:
+// every power of two is split into 8 buckets, so any value is off by at most 12.5%.
+// Recording is a few relaxed atomic increments, readers get an approximate snapshot.
+class latency_histogram {
+public:
+    static constexpr std::size_t sub_buckets   = 8;
+    static constexpr std::size_t max_magnitude = 40;
+    static constexpr std::size_t buckets_count = (max_magnitude + 1) * sub_buckets;
+
+    struct snapshot {
+        std::array<std::uint64_t, buckets_count> buckets{};
+        std::uint64_t count  = 0;
+        std::uint64_t sum_us = 0;
+        std::uint64_t max_us = 0;
+
+        // upper bound of the bucket holding the q-th quantile, q in [0, 1]
+        [[nodiscard]] inline std::uint64_t quantile_us(const double q) const noexcept {
+            if (count == 0) {
+                return 0;
+            }
+            const auto rank = static_cast<std::uint64_t>(q * static_cast<double>(count - 1)) + 1;
+            std::uint64_t seen = 0;
+            for (std::size_t i = 0; i < buckets_count; ++i) {
+                seen += buckets[i];
+                if (seen >= rank) {
+                    return std::min(bucket_upper_bound_us(i), max_us);
+                }
+            }
+            return max_us;
+        }
+
+        [[nodiscard]] inline double mean_us() const noexcept {
+            return count ? static_cast<double>(sum_us) / static_cast<double>(count) : 0;
+        }
+    };
+
+private:
+    std::array<std::atomic<std::uint64_t>, buckets_count> _buckets{};
+    std::atomic<std::uint64_t> _sum_us = 0;
+    std::atomic<std::uint64_t> _max_us = 0;
+
+public:
+    [[nodiscard]] static inline std::size_t bucket_index(const std::uint64_t value_us) noexcept {
+        if (value_us < sub_buckets) {
+            return static_cast<std::size_t>(value_us);
+        }
+        std::size_t magnitude = 0;
+        for (std::uint64_t rest = value_us; rest >= 2 * sub_buckets; rest >>= 1) {
+            ++magnitude;
+        }
+        if (magnitude >= max_magnitude) {
+            return buckets_count - 1;
+        }
+        // values in [8 << m, 16 << m) land in the 8 buckets after the first m + 1 groups
+        const auto sub = static_cast<std::size_t>((value_us >> magnitude) - sub_buckets);
+        return (magnitude + 1) * sub_buckets + sub;
+    }
+
+    [[nodiscard]] static inline std::uint64_t bucket_upper_bound_us(const std::size_t index) noexcept {
+        if (index < sub_buckets) {
+            return index;
+        }
+        const std::size_t magnitude = index / sub_buckets - 1;
+        const std::size_t sub       = index % sub_buckets;
+        return ((sub_buckets + sub + 1) << magnitude) - 1;
+    }
+
+    inline void record_us(const std::uint64_t value_us) noexcept {
+        _buckets[bucket_index(value_us)].fetch_add(1, std::memory_order_relaxed);
+        _sum_us.fetch_add(value_us, std::memory_order_relaxed);
+        std::uint64_t max = _max_us.load(std::memory_order_relaxed);
+        while (value_us > max && !_max_us.compare_exchange_weak(max, value_us, std::memory_order_relaxed)) {}
+    }
+
+    template <typename Rep, typename Period>
+    inline void record(const std::chrono::duration<Rep, Period> duration) noexcept {
+        const auto value_us = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+        record_us(value_us > 0 ? static_cast<std::uint64_t>(value_us) : 0);
+    }
+
+    [[nodiscard]] inline snapshot get_snapshot() const noexcept {
+        snapshot result;
+        for (std::size_t i = 0; i < buckets_count; ++i) {
+            result.buckets[i] = _buckets[i].load(std::memory_order_relaxed);
+            result.count += result.buckets[i];
+        }
+        result.sum_us = _sum_us.load(std::memory_order_relaxed);
+        result.max_us = _max_us.load(std::memory_order_relaxed);
+        return result;
+    }
+};
+
+// records the time from its creation to its destruction
+class scoped_latency {
+private:
+    latency_histogram& _histogram;
+    std::chrono::steady_clock::time_point _start = std::chrono::steady_clock::now();
+
+public:
+    inline explicit scoped_latency(latency_histogram& histogram) noexcept :
+        _histogram(histogram) {}
+
+    scoped_latency(const scoped_latency&)            = delete;
+    scoped_latency& operator=(const scoped_latency&) = delete;
+
+    inline ~scoped_latency() {
+        _histogram.record(std::chrono::steady_clock::now() - _start);
+    }
+};
+VK_GRAFFITI_BOT_END
+
+#endif // !VK_GRAFFITI_BOT_LATENCY_HISTOGRAM_HPP
@@ -0,0 +1,302 @@
+#ifndef VK_GRAFFITI_BOT_LONG_POLL_PARSER_HPP
+#define VK_GRAFFITI_BOT_LONG_POLL_PARSER_HPP
+
+#include "utils.hpp"
+#include <nlohmann/json.hpp>
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <optional>
+#include <algorithm>
+#include <stdexcept>
+
+VK_GRAFFITI_BOT_BEGIN
+struct photo_size {
+    std::string url;
+    std::string type;
+    std::size_t width  = 0;
+    std::size_t height = 0;
+
+    [[nodiscard]] inline std::size_t max_dimension() const noexcept {
+        return std::max(width, height);
+    }
+
+    [[nodiscard]] inline std::size_t area() const noexcept {
+        return width * height;
+    }
+};
+
+struct photo_attachment {
+    long long owner_id = 0;
+    long long id       = 0;
+    std::string access_key;
+    std::vector<photo_size> sizes;
+};
+
+// the parts of a message_new update the bots use, photos are the photo attachments in order
+struct incoming_message {
+    long long id = 0;
+    int from_id  = 0;
+    std::string text;
+    std::vector<photo_attachment> photos;
+};
+
+struct long_poll_response {
+    // set when the server asks to refresh the key or the ts
+    std::optional<int> failed;
+    std::string ts;
+    std::vector<incoming_message> messages;
+};
+
+namespace details {
+// Collects a long_poll_response straight from the SAX events, without building any json nodes.
+// Only the paths below are read, everything else is skipped:
+// ts, failed, updates[].type, updates[].object.message.{id, from_id, text},
+// updates[].object.message.attachments[].{type, photo.{id, owner_id, access_key, sizes[]}}
+class long_poll_sax {
+public:
+    using number_integer_t  = nlohmann::json::number_integer_t;
+    using number_unsigned_t = nlohmann::json::number_unsigned_t;
+    using number_float_t    = nlohmann::json::number_float_t;
+    using string_t          = nlohmann::json::string_t;
+    using binary_t          = nlohmann::json::binary_t;
+
+private:
+    enum class _context {
+        root,
+        updates,
+        update,
+        update_object,
+        message,
+        attachments,
+        attachment,
+        photo,
+        sizes,
+        size,
+        skipped
+    };
+
+    long_poll_response& _response;
+    std::vector<_context> _contexts;
+    std::string _key;
+    std::string _error;
+
+    std::string _update_type;
+    incoming_message _message;
+    std::string _attachment_type;
+    photo_attachment _photo;
+
+    [[nodiscard]] inline _context _top() const noexcept {
+        return _contexts.empty() ? _context::skipped : _contexts.back();
+    }
+
+    [[nodiscard]] inline _context _child(const bool is_array) const noexcept {
+        switch (_top()) {
+        case _context::root:
+            return is_array && _key == "updates" ? _context::updates : _context::skipped;
+        case _context::updates:
+            return is_array ? _context::skipped : _context::update;
+        case _context::update:
+            return !is_array && _key == "object" ? _context::update_object : _context::skipped;
+        case _context::update_object:
+            return !is_array && _key == "message" ? _context::message : _context::skipped;
+        case _context::message:
+            return is_array && _key == "attachments" ? _context::attachments : _context::skipped;
+        case _context::attachments:
+            return is_array ? _context::skipped : _context::attachment;
+        case _context::attachment:
+            return !is_array && _key == "photo" ? _context::photo : _context::skipped;
+        case _context::photo:
+            return is_array && _key == "sizes" ? _context::sizes : _context::skipped;
+        case _context::sizes:
+            return is_array ? _context::skipped : _context::size;
+        default:
+            return _context::skipped;
+        }
+    }
+
+    inline void _push(const bool is_array) {
+        const _context context = _contexts.empty() ? _context::root : _child(is_array);
+        switch (context) {
+        case _context::update:
+            _update_type.clear();
+            _message = incoming_message();
+        break;
+        case _context::attachment:
+            _attachment_type.clear();
+            _photo = photo_attachment();
+        break;
+        case _context::size:
+            _photo.sizes.emplace_back();
+        break;
+        default:
+        break;
+        }
+        _contexts.push_back(context);
+    }
+
+    inline void _pop() {
+        const _context context = _top();
+        _contexts.pop_back();
+        if (context == _context::attachment && _attachment_type == "photo") {
+            _message.photos.push_back(std::move(_photo));
+        } else if (context == _context::update && _update_type == "message_new") {
+            _response.messages.push_back(std::move(_message));
+        }
+    }
+
+    template <typename Integer>
+    inline void _integer(const Integer value) {
+        switch (_top()) {
+        case _context::root:
+            if (_key == "failed") {
+                _response.failed = static_cast<int>(value);
+            } else if (_key == "ts") {
+                _response.ts = std::to_string(value);
+            }
+        break;
+        case _context::message:
+            if (_key == "id") {
+                _message.id = static_cast<long long>(value);
+            } else if (_key == "from_id") {
+                _message.from_id = static_cast<int>(value);
+            }
+        break;
+        case _context::photo:
+            if (_key == "id") {
+                _photo.id = static_cast<long long>(value);
+            } else if (_key == "owner_id") {
+                _photo.owner_id = static_cast<long long>(value);
+            }
+        break;
+        case _context::size:
+            if (_key == "width") {
+                _photo.sizes.back().width = static_cast<std::size_t>(value);
+            } else if (_key == "height") {
+                _photo.sizes.back().height = static_cast<std::size_t>(value);
+            }
+        break;
+        default:
+        break;
+        }
+    }
+
+public:
+    inline explicit long_poll_sax(long_poll_response& response) noexcept :
+        _response(response) {}
+
+    [[nodiscard]] inline const std::string& get_error() const noexcept {
+        return _error;
+    }
+
+    inline bool null() {
+        return true;
+    }
+
+    inline bool boolean(bool) {
+        return true;
+    }
+
+    inline bool number_integer(const number_integer_t value) {
+        _integer(value);
+        return true;
+    }
+
+    inline bool number_unsigned(const number_unsigned_t value) {
+        _integer(value);
+        return true;
+    }
+
+    inline bool number_float(number_float_t, const string_t&) {
+        return true;
+    }
+
+    inline bool string(string_t& value) {
+        switch (_top()) {
+        case _context::root:
+            if (_key == "ts") {
+                _response.ts = std::move(value);
+            }
+        break;
+        case _context::update:
+            if (_key == "type") {
+                _update_type = std::move(value);
+            }
+        break;
+        case _context::message:
+            if (_key == "text") {
+                _message.text = std::move(value);
+            }
+        break;
+        case _context::attachment:
+            if (_key == "type") {
+                _attachment_type = std::move(value);
+            }
+        break;
+        case _context::photo:
+            if (_key == "access_key") {
+                _photo.access_key = std::move(value);
+            }
+        break;
+        case _context::size:
+            // old api versions name it src
+            if (_key == "url" || _key == "src") {
+                _photo.sizes.back().url = std::move(value);
+            } else if (_key == "type") {
+                _photo.sizes.back().type = std::move(value);
+            }
+        break;
+        default:
+        break;
+        }
+        return true;
+    }
+
+    inline bool binary(binary_t&) {
+        return true;
+    }
+
+    inline bool start_object(std::size_t) {
+        _push(false);
+        return true;
+    }
+
+    inline bool key(string_t& value) {
+        _key = std::move(value);
+        return true;
+    }
+
+    inline bool end_object() {
+        _pop();
+        return true;
+    }
+
+    inline bool start_array(std::size_t) {
+        _push(true);
+        return true;
+    }
+
+    inline bool end_array() {
+        _pop();
+        return true;
+    }
+
+    inline bool parse_error(std::size_t, const std::string&, const nlohmann::detail::exception& ex) {
+        _error = ex.what();
+        return false;
+    }
+};
+} // details
+
+[[nodiscard]] inline long_poll_response parse_long_poll_response(const std::string& answer) {
+    long_poll_response response;
+    details::long_poll_sax sax(response);
+    if (!nlohmann::json::sax_parse(answer, &sax)) {
+        throw std::runtime_error(VK_GRAFFITI_BOT_FUNC_MSG("long poll answer parse error: " + sax.get_error()));
+    }
+    return response;
+}
+VK_GRAFFITI_BOT_END
+
+#endif // !VK_GRAFFITI_BOT_LONG_POLL_PARSER_HPP
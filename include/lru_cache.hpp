@@ -0,0 +1,100 @@
+#ifndef VK_GRAFFITI_BOT_LRU_CACHE_HPP
+#define VK_GRAFFITI_BOT_LRU_CACHE_HPP
+
+#include "utils.hpp"
+
+#include <list>
+#include <optional>
+#include <functional>
+#include <unordered_map>
+
+VK_GRAFFITI_BOT_BEGIN
+// Least recently used cache limited by the total weight of its values.
+// Not thread-safe, users guard it themselves.
+template <typename Key, typename Value, typename Hash = std::hash<Key>>
+class lru_cache {
+private:
+    struct _entry {
+        Key key;
+        Value value;
+        std::size_t weight;
+    };
+
+    using _entries_type = std::list<_entry>;
+
+    _entries_type _entries;
+    std::unordered_map<Key, typename _entries_type::iterator, Hash> _index;
+    std::size_t _max_weight = 0;
+    std::size_t _weight     = 0;
+
+    inline void _evict_to(const std::size_t max_weight) {
+        while (_weight > max_weight && !_entries.empty()) {
+            const auto& last = _entries.back();
+            _weight -= last.weight;
+            _index.erase(last.key);
+            _entries.pop_back();
+        }
+    }
+
+public:
+    inline explicit lru_cache(const std::size_t max_weight) :
+        _max_weight(max_weight) {}
+
+    [[nodiscard]] inline std::size_t size() const noexcept {
+        return _entries.size();
+    }
+
+    [[nodiscard]] inline std::size_t get_weight() const noexcept {
+        return _weight;
+    }
+
+    [[nodiscard]] inline std::size_t get_max_weight() const noexcept {
+        return _max_weight;
+    }
+
+    inline void set_max_weight(const std::size_t max_weight) {
+        _max_weight = max_weight;
+        _evict_to(_max_weight);
+    }
+
+    // marks the entry as the most recently used one
+    [[nodiscard]] inline std::optional<Value> get(const Key& key) {
+        const auto index_it = _index.find(key);
+        if (index_it == _index.end()) {
+            return std::nullopt;
+        }
+        _entries.splice(_entries.begin(), _entries, index_it->second);
+        return index_it->second->value;
+    }
+
+    // values heavier than the whole cache are not stored
+    inline void put(const Key& key, Value value, const std::size_t weight = 1) {
+        erase(key);
+        if (weight > _max_weight) {
+            return;
+        }
+        _evict_to(_max_weight - weight);
+        _entries.push_front({ key, std::move(value), weight });
+        _index.emplace(key, _entries.begin());
+        _weight += weight;
+    }
+
+    inline void erase(const Key& key) {
+        const auto index_it = _index.find(key);
+        if (index_it == _index.end()) {
+            return;
+        }
+        _weight -= index_it->second->weight;
+        _entries.erase(index_it->second);
+        _index.erase(index_it);
+    }
+
+    inline void clear() noexcept {
+        _entries.clear();
+        _index.clear();
+        _weight = 0;
+    }
+};
+VK_GRAFFITI_BOT_END
+
+#endif // !VK_GRAFFITI_BOT_LRU_CACHE_HPP
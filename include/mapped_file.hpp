@@ -0,0 +1,230 @@
+#ifndef VK_GRAFFITI_BOT_MAPPED_FILE_HPP
+#define VK_GRAFFITI_BOT_MAPPED_FILE_HPP
+
+#include "utils.hpp"
+
+#include <cstddef>
+#include <utility>
+#include <stdexcept>
+#include <filesystem>
+
+#if defined(_WIN32)
+# ifndef NOMINMAX
+#  define NOMINMAX
+# endif
+# include <windows.h>
+#else
+# include <fcntl.h>
+# include <unistd.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+#endif
+
+VK_GRAFFITI_BOT_BEGIN
+// A file mapped into memory for reading and writing, changes go back to the file,
+// or for reading only.
+class mapped_file {
+private:
+    void* _data       = nullptr;
+    std::size_t _size = 0;
+#if defined(_WIN32)
+    HANDLE _file    = INVALID_HANDLE_VALUE;
+    HANDLE _mapping = nullptr;
+#else
+    int _fd = -1;
+#endif
+
+    inline void _close() noexcept {
+#if defined(_WIN32)
+        if (_data) {
+            UnmapViewOfFile(_data);
+        }
+        if (_mapping) {
+            CloseHandle(_mapping);
+        }
+        if (_file != INVALID_HANDLE_VALUE) {
+            CloseHandle(_file);
+        }
+        _file    = INVALID_HANDLE_VALUE;
+        _mapping = nullptr;
+#else
+        if (_data) {
+            munmap(_data, _size);
+        }
+        if (_fd != -1) {
+            ::close(_fd);
+        }
+        _fd = -1;
+#endif
+        _data = nullptr;
+        _size = 0;
+    }
+
+    inline void _swap(mapped_file& other) noexcept {
+        std::swap(_data, other._data);
+        std::swap(_size, other._size);
+#if defined(_WIN32)
+        std::swap(_file, other._file);
+        std::swap(_mapping, other._mapping);
+#else
+        std::swap(_fd, other._fd);
+#endif
+    }
+
+    inline void _fail(const std::string& msg, const std::filesystem::path& path) {
+        _close();
+        throw std::runtime_error(VK_GRAFFITI_BOT_FUNC_MSG(msg + ": " + path.string()));
+    }
+
+public:
+    inline mapped_file() noexcept = default;
+
+    // opens or creates the file, a file shorter than size is extended with zeros
+    inline mapped_file(const std::filesystem::path& path, const std::size_t size) {
+        if (size == 0) {
+            throw std::invalid_argument(VK_GRAFFITI_BOT_FUNC_MSG("mapped size must be positive"));
+        }
+#if defined(_WIN32)
+        _file = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+            OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (_file == INVALID_HANDLE_VALUE) {
+            _fail("open file error", path);
+        }
+        LARGE_INTEGER file_size;
+        if (!GetFileSizeEx(_file, &file_size)) {
+            _fail("get file size error", path);
+        }
+        if (static_cast<unsigned long long>(file_size.QuadPart) < size) {
+            LARGE_INTEGER new_size;
+            new_size.QuadPart = static_cast<LONGLONG>(size);
+            if (!SetFilePointerEx(_file, new_size, nullptr, FILE_BEGIN) || !SetEndOfFile(_file)) {
+                _fail("resize file error", path);
+            }
+        }
+        const auto size_value = static_cast<unsigned long long>(size);
+        _mapping = CreateFileMappingW(_file, nullptr, PAGE_READWRITE,
+            static_cast<DWORD>(size_value >> 32), static_cast<DWORD>(size_value & 0xFFFFFFFFull), nullptr);
+        if (!_mapping) {
+            _fail("map file error", path);
+        }
+        _data = MapViewOfFile(_mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+        if (!_data) {
+            _fail("map file error", path);
+        }
+#else
+        _fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (_fd == -1) {
+            _fail("open file error", path);
+        }
+        struct stat file_stat;
+        if (fstat(_fd, &file_stat) != 0) {
+            _fail("get file size error", path);
+        }
+        if (static_cast<std::size_t>(file_stat.st_size) < size && ftruncate(_fd, static_cast<off_t>(size)) != 0) {
+            _fail("resize file error", path);
+        }
+        void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+        if (data == MAP_FAILED) {
+            _fail("map file error", path);
+        }
+        _data = data;
+#endif
+        _size = size;
+    }
+
+    // maps the whole of an existing file for reading only, the data must not be written
+    inline explicit mapped_file(const std::filesystem::path& path) {
+#if defined(_WIN32)
+        _file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (_file == INVALID_HANDLE_VALUE) {
+            _fail("open file error", path);
+        }
+        LARGE_INTEGER file_size;
+        if (!GetFileSizeEx(_file, &file_size)) {
+            _fail("get file size error", path);
+        }
+        if (file_size.QuadPart == 0) {
+            _fail("empty file", path);
+        }
+        _mapping = CreateFileMappingW(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!_mapping) {
+            _fail("map file error", path);
+        }
+        _data = MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0);
+        if (!_data) {
+            _fail("map file error", path);
+        }
+        _size = static_cast<std::size_t>(file_size.QuadPart);
+#else
+        _fd = ::open(path.c_str(), O_RDONLY);
+        if (_fd == -1) {
+            _fail("open file error", path);
+        }
+        struct stat file_stat;
+        if (fstat(_fd, &file_stat) != 0) {
+            _fail("get file size error", path);
+        }
+        if (file_stat.st_size == 0) {
+            _fail("empty file", path);
+        }
+        const auto size = static_cast<std::size_t>(file_stat.st_size);
+        void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, _fd, 0);
+        if (data == MAP_FAILED) {
+            _fail("map file error", path);
+        }
+        _data = data;
+        _size = size;
+#endif
+    }
+
+    mapped_file(const mapped_file&)            = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    inline mapped_file(mapped_file&& other) noexcept {
+        _swap(other);
+    }
+
+    inline mapped_file& operator=(mapped_file&& other) noexcept {
+        if (this != &other) {
+            _close();
+            _swap(other);
+        }
+        return *this;
+    }
+
+    inline ~mapped_file() {
+        _close();
+    }
+
+    [[nodiscard]] inline bool is_open() const noexcept {
+        return _data != nullptr;
+    }
+
+    [[nodiscard]] inline void* data() noexcept {
+        return _data;
+    }
+
+    [[nodiscard]] inline const void* data() const noexcept {
+        return _data;
+    }
+
+    [[nodiscard]] inline std::size_t size() const noexcept {
+        return _size;
+    }
+
+    // asks the system to write the changed pages back without waiting for it
+    inline void flush() noexcept {
+        if (!_data) {
+            return;
+        }
+#if defined(_WIN32)
+        FlushViewOfFile(_data, 0);
+#else
+        msync(_data, _size, MS_ASYNC);
+#endif
+    }
+};
+VK_GRAFFITI_BOT_END
+
+#endif // !VK_GRAFFITI_BOT_MAPPED_FILE_HPP
@@ -0,0 +1,320 @@
+#ifndef VK_GRAFFITI_BOT_METRICS_HPP
+#define VK_GRAFFITI_BOT_METRICS_HPP
+
+#include "latency_histogram.hpp"
+
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <filesystem>
+#include <string_view>
+#include <shared_mutex>
+
+VK_GRAFFITI_BOT_BEGIN
+class metrics_counter {
+private:
+    std::atomic<std::uint64_t> _value = 0;
+
+public:
+    inline void add(const std::uint64_t value = 1) noexcept {
+        _value.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] inline std::uint64_t get() const noexcept {
+        return _value.load(std::memory_order_relaxed);
+    }
+};
+
+// name="value" with the value escaped as the prometheus text format requires
+[[nodiscard]] inline std::string metrics_label(const std::string_view name, const std::string_view value) {
+    std::string result;
+    result.reserve(name.size() + value.size() + 3);
+    result += name;
+    result += "=\"";
+    for (const char c : value) {
+        switch (c) {
+        case '\\':
+            result += "\\\\";
+        break;
+        case '"':
+            result += "\\\"";
+        break;
+        case '\n':
+            result += "\\n";
+        break;
+        default:
+            result += c;
+        }
+    }
+    result += '"';
+    return result;
+}
+
+// Writes samples in the prometheus text format, the samples of one family must be written one after another.
+class metrics_writer {
+private:
+    struct _bound {
+        std::uint64_t us;
+        const char* text;
+    };
+
+    // the latency histograms are much finer, they are folded into these buckets on export
+    static constexpr _bound _bounds[] = {
+        { 500, "0.0005" }, { 1000, "0.001" }, { 2500, "0.0025" }, { 5000, "0.005" }, { 10000, "0.01" },
+        { 25000, "0.025" }, { 50000, "0.05" }, { 100000, "0.1" }, { 250000, "0.25" }, { 500000, "0.5" },
+        { 1000000, "1" }, { 2500000, "2.5" }, { 5000000, "5" }, { 10000000, "10" }, { 30000000, "30" }
+    };
+
+    std::string& _out;
+    std::string _family;
+
+    inline void _header(const std::string_view name, const std::string_view help, const char* type) {
+        if (_family == name) {
+            return;
+        }
+        _family = name;
+        _out += "# HELP ";
+        _out += name;
+        _out += ' ';
+        _out += help;
+        _out += "\n# TYPE ";
+        _out += name;
+        _out += ' ';
+        _out += type;
+        _out += '\n';
+    }
+
+    inline void _sample(const std::string_view name, const std::string_view suffix,
+        const std::string_view labels, const std::string_view extra_label, const std::string_view value) {
+        _out += name;
+        _out += suffix;
+        if (!labels.empty() || !extra_label.empty()) {
+            _out += '{';
+            _out += labels;
+            if (!labels.empty() && !extra_label.empty()) {
+                _out += ',';
+            }
+            _out += extra_label;
+            _out += '}';
+        }
+        _out += ' ';
+        _out += value;
+        _out += '\n';
+    }
+
+    [[nodiscard]] static inline std::string _format(const double value) {
+        char buffer[32];
+        const int size = std::snprintf(buffer, sizeof(buffer), "%.9g", value);
+        return std::string(buffer, size > 0 ? static_cast<std::size_t>(size) : 0);
+    }
+
+public:
+    inline explicit metrics_writer(std::string& out) noexcept :
+        _out(out) {}
+
+    inline void counter(const std::string_view name, const std::string_view help,
+        const std::string_view labels, const std::uint64_t value) {
+        _header(name, help, "counter");
+        _sample(name, "", labels, "", std::to_string(value));
+    }
+
+    inline void gauge(const std::string_view name, const std::string_view help,
+        const std::string_view labels, const double value) {
+        _header(name, help, "gauge");
+        _sample(name, "", labels, "", _format(value));
+    }
+
+    // name should end with _seconds, the histogram itself counts microseconds
+    inline void histogram(const std::string_view name, const std::string_view help,
+        const std::string_view labels, const latency_histogram::snapshot& snapshot) {
+        _header(name, help, "histogram");
+        std::uint64_t cumulative = 0;
+        std::size_t bucket       = 0;
+        for (const auto& bound : _bounds) {
+            for (; bucket < latency_histogram::buckets_count &&
+                latency_histogram::bucket_upper_bound_us(bucket) <= bound.us; ++bucket) {
+                cumulative += snapshot.buckets[bucket];
+            }
+            _sample(name, "_bucket", labels, "le=\"" + std::string(bound.text) + '"', std::to_string(cumulative));
+        }
+        _sample(name, "_bucket", labels, "le=\"+Inf\"", std::to_string(snapshot.count));
+        _sample(name, "_sum", labels, "", _format(static_cast<double>(snapshot.sum_us) / 1e6));
+        _sample(name, "_count", labels, "", std::to_string(snapshot.count));
+    }
+};
+
+// Counters and latency histograms looked up by name and labels, recording into them is a few relaxed
+// atomic operations. Hot paths should keep the returned references, they stay valid as long as the registry.
+// State owned elsewhere (queue depths, cache hits) is exported through collectors called on every export.
+class metrics_registry {
+public:
+    using collector_type = std::function<void(metrics_writer&)>;
+
+    // removes its collector when destroyed, waiting for a running export to finish
+    class collector_handle {
+    private:
+        metrics_registry* _registry = nullptr;
+        std::size_t _id = 0;
+
+    public:
+        inline collector_handle() noexcept = default;
+
+        inline collector_handle(metrics_registry* registry, const std::size_t id) noexcept :
+            _registry(registry),
+            _id(id) {}
+
+        collector_handle(const collector_handle&)            = delete;
+        collector_handle& operator=(const collector_handle&) = delete;
+
+        inline collector_handle(collector_handle&& other) noexcept {
+            std::swap(_registry, other._registry);
+            std::swap(_id, other._id);
+        }
+
+        inline collector_handle& operator=(collector_handle&& other) noexcept {
+            if (this != &other) {
+                reset();
+                std::swap(_registry, other._registry);
+                std::swap(_id, other._id);
+            }
+            return *this;
+        }
+
+        inline ~collector_handle() {
+            reset();
+        }
+
+        inline void reset() noexcept {
+            if (_registry) {
+                std::lock_guard lock(_registry->_collectors_mutex);
+                _registry->_collectors.erase(_id);
+                _registry = nullptr;
+            }
+        }
+    };
+
+private:
+    struct _family {
+        std::string help;
+        bool is_histogram = false;
+        std::map<std::string, std::unique_ptr<metrics_counter>, std::less<>> counters;
+        std::map<std::string, std::unique_ptr<latency_histogram>, std::less<>> histograms;
+    };
+
+    mutable std::shared_mutex _mutex;
+    std::map<std::string, _family, std::less<>> _families;
+    mutable std::mutex _collectors_mutex;
+    std::map<std::size_t, collector_type> _collectors;
+    std::size_t _next_collector_id = 0;
+
+    template <typename Series>
+    [[nodiscard]] inline Series& _get(const std::string_view name, const std::string_view help,
+        const std::string_view labels, const bool is_histogram,
+        std::map<std::string, std::unique_ptr<Series>, std::less<>> _family::* series_map) {
+        {
+            std::shared_lock lock(_mutex);
+            const auto family_it = _families.find(name);
+            if (family_it != _families.end() && family_it->second.is_histogram == is_histogram) {
+                const auto& series = family_it->second.*series_map;
+                const auto series_it = series.find(labels);
+                if (series_it != series.end()) {
+                    return *series_it->second;
+                }
+            }
+        }
+
+        std::unique_lock lock(_mutex);
+        auto family_it = _families.find(name);
+        if (family_it == _families.end()) {
+            family_it = _families.emplace(std::string(name), _family()).first;
+            family_it->second.help         = help;
+            family_it->second.is_histogram = is_histogram;
+        } else if (family_it->second.is_histogram != is_histogram) {
+            throw std::invalid_argument(VK_GRAFFITI_BOT_FUNC_MSG("metric " + std::string(name) + " has another type"));
+        }
+        auto& series = family_it->second.*series_map;
+        auto series_it = series.find(labels);
+        if (series_it == series.end()) {
+            series_it = series.emplace(std::string(labels), std::make_unique<Series>()).first;
+        }
+        return *series_it->second;
+    }
+
+public:
+    inline metrics_registry() = default;
+
+    metrics_registry(const metrics_registry&)            = delete;
+    metrics_registry& operator=(const metrics_registry&) = delete;
+
+    // labels are a comma separated list made with metrics_label, the same labels give the same series
+    [[nodiscard]] inline metrics_counter& counter(const std::string_view name, const std::string_view help,
+        const std::string_view labels = {}) {
+        return _get(name, help, labels, false, &_family::counters);
+    }
+
+    [[nodiscard]] inline latency_histogram& histogram(const std::string_view name, const std::string_view help,
+        const std::string_view labels = {}) {
+        return _get(name, help, labels, true, &_family::histograms);
+    }
+
+    [[nodiscard]] inline collector_handle add_collector(collector_type collector) {
+        std::lock_guard lock(_collectors_mutex);
+        const std::size_t id = _next_collector_id++;
+        _collectors.emplace(id, std::move(collector));
+        return collector_handle(this, id);
+    }
+
+    [[nodiscard]] inline std::string to_prometheus() const {
+        std::string result;
+        metrics_writer writer(result);
+        {
+            std::shared_lock lock(_mutex);
+            for (const auto& [name, family] : _families) {
+                for (const auto& [labels, counter] : family.counters) {
+                    writer.counter(name, family.help, labels, counter->get());
+                }
+                for (const auto& [labels, histogram] : family.histograms) {
+                    writer.histogram(name, family.help, labels, histogram->get_snapshot());
+                }
+            }
+        }
+        std::lock_guard lock(_collectors_mutex);
+        for (const auto& [id, collector] : _collectors) {
+            try {
+                collector(writer);
+            } catch (const std::exception& ex) {
+                log_error(ex.what());
+            }
+        }
+        return result;
+    }
+
+    // written to a temporary file first, so a reader never sees half of an export
+    inline void dump(const std::filesystem::path& path) const {
+        const std::string text = to_prometheus();
+        auto tmp_path = path;
+        tmp_path += ".tmp";
+        {
+            std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+            if (!file.is_open() || !file.write(text.data(), static_cast<std::streamsize>(text.size()))) {
+                throw std::runtime_error(VK_GRAFFITI_BOT_FUNC_MSG("write metrics file error: " + tmp_path.string()));
+            }
+        }
+        std::filesystem::rename(tmp_path, path);
+    }
+};
+
+// the registry the bot, the api and the curl wrappers record to
+[[nodiscard]] inline metrics_registry& global_metrics() {
+    static metrics_registry registry;
+    return registry;
+}
+VK_GRAFFITI_BOT_END
+
+#endif // !VK_GRAFFITI_BOT_METRICS_HPP
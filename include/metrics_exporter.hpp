@@ -0,0 +1,286 @@
+#ifndef VK_GRAFFITI_BOT_METRICS_EXPORTER_HPP
+#define VK_GRAFFITI_BOT_METRICS_EXPORTER_HPP
+
+#include "metrics.hpp"
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <condition_variable>
+
+#if defined(_WIN32)
+# ifndef NOMINMAX
+#  define NOMINMAX
+# endif
+# include <winsock2.h>
+# include <ws2tcpip.h>
+#else
+# include <poll.h>
+# include <unistd.h>
+# include <arpa/inet.h>
+# include <netinet/in.h>
+# include <sys/socket.h>
+#endif
+
+VK_GRAFFITI_BOT_BEGIN
+// Serves the registry in the prometheus text format to any GET request.
+// Requests are answered one at a time on a single thread, which is plenty for a scraper.
+class metrics_server {
+private:
+#if defined(_WIN32)
+    using _socket_type = SOCKET;
+    static constexpr _socket_type _invalid_socket = INVALID_SOCKET;
+
+    static inline void _close_socket(const _socket_type socket) noexcept {
+        closesocket(socket);
+    }
+
+    static inline int _poll(pollfd* fds, const unsigned long count, const int timeout_ms) noexcept {
+        return WSAPoll(fds, count, timeout_ms);
+    }
+
+    [[nodiscard]] static inline bool _is_interrupted() noexcept {
+        return WSAGetLastError() == WSAEINTR;
+    }
+
+    [[nodiscard]] static inline std::string _last_error() {
+        return "socket error " + std::to_string(WSAGetLastError());
+    }
+#else
+    using _socket_type = int;
+    static constexpr _socket_type _invalid_socket = -1;
+
+    static inline void _close_socket(const _socket_type socket) noexcept {
+        ::close(socket);
+    }
+
+    static inline int _poll(pollfd* fds, const nfds_t count, const int timeout_ms) noexcept {
+        return ::poll(fds, count, timeout_ms);
+    }
+
+    [[nodiscard]] static inline bool _is_interrupted() noexcept {
+        return errno == EINTR;
+    }
+
+    [[nodiscard]] static inline std::string _last_error() {
+        return std::strerror(errno);
+    }
+#endif
+
+#if defined(MSG_NOSIGNAL)
+    // a scraper hanging up early must not kill the process with SIGPIPE
+    static constexpr int _send_flags = MSG_NOSIGNAL;
+#else
+    static constexpr int _send_flags = 0;
+#endif
+
+    // how often the serving thread checks whether it has to stop
+    static constexpr int _poll_timeout_ms = 200;
+
+    const metrics_registry& _registry;
+    _socket_type _listener = _invalid_socket;
+    std::atomic<bool> _stopped = false;
+    std::thread _thread;
+
+    [[nodiscard]] inline bool _wait_readable(const _socket_type socket) {
+        pollfd fd{};
+        fd.fd     = socket;
+        fd.events = POLLIN;
+        while (!_stopped) {
+            const int result = _poll(&fd, 1, _poll_timeout_ms);
+            if (result > 0) {
+                return true;
+            }
+            // a signal, such as the SIGUSR1 of metrics_signal_dumper, landed on this thread
+            if (result < 0 && !_is_interrupted()) {
+                log_error(VK_GRAFFITI_BOT_FUNC_MSG("poll error: " + _last_error()));
+                return false;
+            }
+        }
+        return false;
+    }
+
+    inline void _serve(const _socket_type client) {
+        // the request itself does not matter, it only has to arrive before the answer is sent
+        std::string request;
+        char buffer[1024];
+        while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192) {
+            if (!_wait_readable(client)) {
+                return;
+            }
+            const auto received = recv(client, buffer, sizeof(buffer), 0);
+            if (received <= 0) {
+                return;
+            }
+            request.append(buffer, static_cast<std::size_t>(received));
+        }
+
+        const std::string body = _registry.to_prometheus();
+        std::string answer = "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: ";
+        answer += std::to_string(body.size());
+        answer += "\r\nConnection: close\r\n\r\n";
+        answer += body;
+        std::size_t sent_total = 0;
+        while (sent_total < answer.size()) {
+            const auto sent = send(client, answer.data() + sent_total,
+                static_cast<int>(answer.size() - sent_total), _send_flags);
+            if (sent <= 0) {
+                return;
+            }
+            sent_total += static_cast<std::size_t>(sent);
+        }
+    }
+
+    inline void _run() {
+        while (_wait_readable(_listener)) {
+            const _socket_type client = accept(_listener, nullptr, nullptr);
+            if (client == _invalid_socket) {
+                continue;
+            }
+            try {
+                _serve(client);
+            } catch (const std::exception& ex) {
+                log_error(ex.what());
+            }
+            _close_socket(client);
+        }
+    }
+
+    inline void _fail(const std::string& msg) {
+        if (_listener != _invalid_socket) {
+            _close_socket(_listener);
+        }
+#if defined(_WIN32)
+        WSACleanup();
+#endif
+        throw std::runtime_error(VK_GRAFFITI_BOT_FUNC_MSG(msg));
+    }
+
+public:
+    // listens on the loopback interface unless another address is given
+    inline metrics_server(const metrics_registry& registry, const std::uint16_t port,
+        const std::string& address = "127.0.0.1") :
+        _registry(registry) {
+#if defined(_WIN32)
+        WSADATA wsa_data;
+        if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0) {
+            throw std::runtime_error(VK_GRAFFITI_BOT_FUNC_MSG("winsock init error"));
+        }
+#endif
+        sockaddr_in listen_address{};
+        listen_address.sin_family = AF_INET;
+        listen_address.sin_port   = htons(port);
+        if (inet_pton(AF_INET, address.c_str(), &listen_address.sin_addr) != 1) {
+            _fail("not correct metrics address: " + address);
+        }
+        _listener = socket(AF_INET, SOCK_STREAM, 0);
+        if (_listener == _invalid_socket) {
+            _fail("socket error");
+        }
+        const int reuse = 1;
+        setsockopt(_listener, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse), sizeof(reuse));
+        if (bind(_listener, reinterpret_cast<const sockaddr*>(&listen_address), sizeof(listen_address)) != 0) {
+            _fail("bind error on port " + std::to_string(port));
+        }
+        if (listen(_listener, 16) != 0) {
+            _fail("listen error");
+        }
+        _thread = std::thread(&metrics_server::_run, this);
+    }
+
+    metrics_server(const metrics_server&)            = delete;
+    metrics_server& operator=(const metrics_server&) = delete;
+
+    inline ~metrics_server() {
+        _stopped = true;
+        if (_thread.joinable()) {
+            _thread.join();
+        }
+        _close_socket(_listener);
+#if defined(_WIN32)
+        WSACleanup();
+#endif
+    }
+};
+
+namespace details {
+inline volatile std::sig_atomic_t metrics_dump_requested = 0;
+
+inline void request_metrics_dump(int) {
+    metrics_dump_requested = 1;
+}
+} // details
+
+// Writes the registry to a file every time the process receives the signal (SIGUSR1 where it exists).
+// The handler only sets a flag, the file is written from a thread of its own.
+class metrics_signal_dumper {
+public:
+#if defined(SIGUSR1)
+    static constexpr int default_signal = SIGUSR1;
+#else
+    static constexpr int default_signal = SIGBREAK;
+#endif
+
+private:
+    static constexpr auto _check_interval = std::chrono::milliseconds(200);
+
+    const metrics_registry& _registry;
+    std::filesystem::path _path;
+    int _signal;
+    std::mutex _mutex;
+    std::condition_variable _stop_requested;
+    bool _stopped = false;
+    std::thread _thread;
+
+    inline void _run() {
+        std::unique_lock lock(_mutex);
+        while (!_stopped) {
+            _stop_requested.wait_for(lock, _check_interval);
+            if (!details::metrics_dump_requested) {
+                continue;
+            }
+            details::metrics_dump_requested = 0;
+            try {
+                _registry.dump(_path);
+            } catch (const std::exception& ex) {
+                log_error(ex.what());
+            }
+        }
+    }
+
+public:
+    inline metrics_signal_dumper(const metrics_registry& registry, const std::filesystem::path& path,
+        const int signal = default_signal) :
+        _registry(registry),
+        _path(path),
+        _signal(signal) {
+        if (std::signal(_signal, details::request_metrics_dump) == SIG_ERR) {
+            throw std::runtime_error(VK_GRAFFITI_BOT_FUNC_MSG("set signal handler error"));
+        }
+        _thread = std::thread(&metrics_signal_dumper::_run, this);
+    }
+
+    metrics_signal_dumper(const metrics_signal_dumper&)            = delete;
+    metrics_signal_dumper& operator=(const metrics_signal_dumper&) = delete;
+
+    inline ~metrics_signal_dumper() {
+        std::signal(_signal, SIG_DFL);
+        {
+            std::lock_guard lock(_mutex);
+            _stopped = true;
+        }
+        _stop_requested.notify_all();
+        if (_thread.joinable()) {
+            _thread.join();
+        }
+    }
+};
+VK_GRAFFITI_BOT_END
+
+#endif // !VK_GRAFFITI_BOT_METRICS_EXPORTER_HPP
@@ -0,0 +1,150 @@
+#ifndef VK_GRAFFITI_BOT_PIPELINE_STAGE_HPP
+#define VK_GRAFFITI_BOT_PIPELINE_STAGE_HPP
+
+#include "latency_histogram.hpp"
+
+#include <deque>
+#include <mutex>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdexcept>
+#include <functional>
+#include <condition_variable>
+
+VK_GRAFFITI_BOT_BEGIN
+// One step of a processing pipeline: a bounded queue served by a fixed number of threads.
+// push blocks while the queue is full, so a slow stage holds back the stages feeding it.
+// Stages must only push forward, a cycle of full queues would never drain.
+class pipeline_stage {
+public:
+    using clock     = std::chrono::steady_clock;
+    // slot is the index of the stage thread, so tasks can use per-thread state
+    using task_type = std::function<void(std::size_t slot)>;
+
+private:
+    struct _queued_task {
+        clock::time_point enqueued;
+        task_type task;
+    };
+
+    std::string _name;
+    std::size_t _capacity;
+    std::mutex _mutex;
+    std::condition_variable _not_empty;
+    std::condition_variable _not_full;
+    std::deque<_queued_task> _queue;
+    std::size_t _active = 0;
+    bool _stopped = false;
+    latency_histogram _wait_time;
+    latency_histogram _run_time;
+    std::vector<std::thread> _threads;
+
+    inline void _run(const std::size_t slot) {
+        while (true) {
+            _queued_task queued;
+            {
+                std::unique_lock lock(_mutex);
+                _not_empty.wait(lock, [this] { return _stopped || !_queue.empty(); });
+                if (_queue.empty()) {
+                    return;
+                }
+                queued = std::move(_queue.front());
+                _queue.pop_front();
+                ++_active;
+            }
+            _not_full.notify_one();
+
+            const auto start = clock::now();
+            _wait_time.record(start - queued.enqueued);
+            try {
+                queued.task(slot);
+            } catch (const std::exception& ex) {
+                log_error(ex.what());
+            } catch (...) {
+                log_error(VK_GRAFFITI_BOT_FUNC_MSG("unknown exception in task"));
+            }
+            _run_time.record(clock::now() - start);
+
+            std::lock_guard lock(_mutex);
+            --_active;
+        }
+    }
+
+public:
+    inline pipeline_stage(std::string name, const std::size_t concurrency, const std::size_t capacity) :
+        _name(std::move(name)),
+        _capacity(capacity) {
+        if (concurrency == 0 || capacity == 0) {
+            throw std::invalid_argument(VK_GRAFFITI_BOT_FUNC_MSG("stage concurrency and capacity must be positive"));
+        }
+        _threads.reserve(concurrency);
+        for (std::size_t slot = 0; slot < concurrency; ++slot) {
+            _threads.emplace_back(&pipeline_stage::_run, this, slot);
+        }
+    }
+
+    pipeline_stage(const pipeline_stage&)            = delete;
+    pipeline_stage& operator=(const pipeline_stage&) = delete;
+
+    // the queued tasks are still run
+    inline ~pipeline_stage() {
+        {
+            std::lock_guard lock(_mutex);
+            _stopped = true;
+        }
+        _not_empty.notify_all();
+        _not_full.notify_all();
+        for (auto& thread : _threads) {
+            thread.join();
+        }
+    }
+
+    inline void push(task_type task) {
+        {
+            std::unique_lock lock(_mutex);
+            _not_full.wait(lock, [this] { return _stopped || _queue.size() < _capacity; });
+            if (_stopped) {
+                throw std::runtime_error(VK_GRAFFITI_BOT_FUNC_MSG("stage " + _name + " is stopped"));
+            }
+            _queue.push_back({ clock::now(), std::move(task) });
+        }
+        _not_empty.notify_one();
+    }
+
+    [[nodiscard]] inline const std::string& get_name() const noexcept {
+        return _name;
+    }
+
+    [[nodiscard]] inline std::size_t get_concurrency() const noexcept {
+        return _threads.size();
+    }
+
+    [[nodiscard]] inline std::size_t get_capacity() const noexcept {
+        return _capacity;
+    }
+
+    [[nodiscard]] inline std::size_t get_queue_depth() {
+        std::lock_guard lock(_mutex);
+        return _queue.size();
+    }
+
+    [[nodiscard]] inline std::size_t get_active_count() {
+        std::lock_guard lock(_mutex);
+        return _active;
+    }
+
+    // time tasks spend in the queue
+    [[nodiscard]] inline const latency_histogram& get_wait_time() const noexcept {
+        return _wait_time;
+    }
+
+    // time tasks spend running
+    [[nodiscard]] inline const latency_histogram& get_run_time() const noexcept {
+        return _run_time;
+    }
+};
+VK_GRAFFITI_BOT_END
+
+#endif // !VK_GRAFFITI_BOT_PIPELINE_STAGE_HPP
@@ -0,0 +1,155 @@
+#ifndef VK_GRAFFITI_BOT_QUERY_BUILDER_HPP
+#define VK_GRAFFITI_BOT_QUERY_BUILDER_HPP
+
+#include "utils.hpp"
+
+#include <string>
+#include <charconv>
+#include <string_view>
+#include <type_traits>
+
+VK_GRAFFITI_BOT_BEGIN
+namespace details {
+[[nodiscard]] inline bool is_url_unreserved(const unsigned char c) noexcept {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+        c == '-' || c == '_' || c == '.' || c == '~';
+}
+
+[[nodiscard]] inline int hex_digit_value(const char c) noexcept {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+} // details
+
+// percent-encodes everything except the unreserved characters of RFC 3986
+inline void append_url_encoded(std::string& out, const std::string_view value) {
+    static constexpr char hex_digits[] = "0123456789ABCDEF";
+    for (const char c : value) {
+        const auto byte = static_cast<unsigned char>(c);
+        if (details::is_url_unreserved(byte)) {
+            out += c;
+            continue;
+        }
+        const char encoded[] = { '%', hex_digits[byte >> 4], hex_digits[byte & 0x0F] };
+        out.append(encoded, sizeof(encoded));
+    }
+}
+
+// '+' is decoded as a space, as in form data
+inline void append_url_decoded(std::string& out, const std::string_view value) {
+    for (std::size_t i = 0; i < value.size(); ++i) {
+        if (value[i] == '+') {
+            out += ' ';
+            continue;
+        }
+        if (value[i] == '%' && i + 2 < value.size()) {
+            const int high = details::hex_digit_value(value[i + 1]);
+            const int low  = details::hex_digit_value(value[i + 2]);
+            if (high >= 0 && low >= 0) {
+                out += static_cast<char>((high << 4) | low);
+                i += 2;
+                continue;
+            }
+        }
+        out += value[i];
+    }
+}
+
+template <typename Integer, typename = std::enable_if_t<std::is_integral_v<Integer>>>
+inline void append_integer(std::string& out, const Integer value) {
+    char digits[24];
+    const auto result = std::to_chars(digits, digits + sizeof(digits), value);
+    out.append(digits, result.ptr);
+}
+
+// Builds "name=value&name=value" in one buffer, values are percent-encoded on the way in.
+// Once the buffer has grown to the usual query size, building another query does not allocate.
+class query_builder {
+private:
+    std::string _query;
+
+    inline void _begin_param(const std::string_view name) {
+        if (!_query.empty()) {
+            _query += '&';
+        }
+        _query.append(name);
+        _query += '=';
+    }
+
+public:
+    inline explicit query_builder(const std::size_t capacity = 256) {
+        _query.reserve(capacity);
+    }
+
+    inline query_builder& add(const std::string_view name, const std::string_view value) {
+        _begin_param(name);
+        append_url_encoded(_query, value);
+        return *this;
+    }
+
+    inline query_builder& add(const std::string_view name, const char* value) {
+        return add(name, std::string_view(value));
+    }
+
+    inline query_builder& add(const std::string_view name, const std::string& value) {
+        return add(name, std::string_view(value));
+    }
+
+    template <typename Integer, typename = std::enable_if_t<std::is_integral_v<Integer>>>
+    inline query_builder& add(const std::string_view name, const Integer value) {
+        _begin_param(name);
+        append_integer(_query, value);
+        return *this;
+    }
+
+    // for values that are known to be encoded already
+    inline query_builder& add_encoded(const std::string_view name, const std::string_view value) {
+        _begin_param(name);
+        _query.append(value);
+        return *this;
+    }
+
+    // keeps the capacity
+    inline void clear() noexcept {
+        _query.clear();
+    }
+
+    [[nodiscard]] inline bool empty() const noexcept {
+        return _query.empty();
+    }
+
+    [[nodiscard]] inline const std::string& str() const noexcept {
+        return _query;
+    }
+
+    // calls func(name, encoded value) for every parameter
+    template <typename Func>
+    inline void for_each_param(Func&& func) const {
+        std::size_t begin = 0;
+        while (begin < _query.size()) {
+            std::size_t end = _query.find('&', begin);
+            if (end == std::string::npos) {
+                end = _query.size();
+            }
+            const std::string_view param(_query.data() + begin, end - begin);
+            const std::size_t equal = param.find('=');
+            if (equal == std::string_view::npos) {
+                func(param, std::string_view());
+            } else {
+                func(param.substr(0, equal), param.substr(equal + 1));
+            }
+            begin = end + 1;
+        }
+    }
+};
+VK_GRAFFITI_BOT_END
+
+#endif // !VK_GRAFFITI_BOT_QUERY_BUILDER_HPP
@@ -0,0 +1,221 @@
+#ifndef VK_GRAFFITI_BOT_RESULT_CACHE_HPP
+#define VK_GRAFFITI_BOT_RESULT_CACHE_HPP
+
+#include "lru_cache.hpp"
+#include "mapped_file.hpp"
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string_view>
+
+VK_GRAFFITI_BOT_BEGIN
+// 128-bit digest of everything that decides how a rendered photo looks
+struct result_cache_key {
+    std::uint64_t high = 0;
+    std::uint64_t low  = 0;
+
+    [[nodiscard]] inline bool operator==(const result_cache_key& other) const noexcept {
+        return high == other.high && low == other.low;
+    }
+};
+
+struct result_cache_key_hash {
+    [[nodiscard]] inline std::size_t operator()(const result_cache_key& key) const noexcept {
+        return static_cast<std::size_t>(key.high ^ (key.low * 0x9E3779B97F4A7C15ull));
+    }
+};
+
+// Feeds the parts of the key into two FNV-1a hashes with different offsets,
+// every part is followed by its length so "ab" + "c" and "a" + "bc" differ.
+class result_cache_key_builder {
+private:
+    std::uint64_t _high = 0xCBF29CE484222325ull;
+    std::uint64_t _low  = 0x84222325CBF29CE4ull;
+
+    inline void _add_bytes(const void* data, const std::size_t size) noexcept {
+        constexpr std::uint64_t prime = 0x100000001B3ull;
+        const auto bytes = static_cast<const unsigned char*>(data);
+        for (std::size_t i = 0; i < size; ++i) {
+            _high = (_high ^ bytes[i]) * prime;
+            _low  = (_low ^ bytes[i]) * prime;
+            _low ^= _low >> 29;
+        }
+    }
+
+public:
+    inline result_cache_key_builder& add(const std::string_view value) noexcept {
+        _add_bytes(value.data(), value.size());
+        const std::uint64_t size = value.size();
+        _add_bytes(&size, sizeof(size));
+        return *this;
+    }
+
+    inline result_cache_key_builder& add(const long long value) noexcept {
+        _add_bytes(&value, sizeof(value));
+        return *this;
+    }
+
+    [[nodiscard]] inline result_cache_key get() const noexcept {
+        return { _high, _low };
+    }
+};
+
+namespace details {
+// Open addressing table of fixed size slots stored in a mapped file, a full probe window
+// overwrites its first slot since losing an old entry only costs one more render.
+class result_cache_index {
+public:
+    static constexpr std::size_t max_attachment_size = 47;
+
+private:
+    static constexpr char _magic[8]            = { 'V', 'K', 'G', 'B', 'R', 'C', '0', '1' };
+    static constexpr std::size_t _max_probes   = 16;
+
+    struct _header {
+        char magic[8];
+        std::uint64_t slots_count;
+        std::uint64_t reserved[6];
+    };
+
+    struct _slot {
+        std::uint64_t high;
+        std::uint64_t low;
+        std::uint8_t size;
+        char attachment[max_attachment_size];
+    };
+
+    static_assert(sizeof(_header) == 64 && sizeof(_slot) == 64, "index layout must not depend on the compiler");
+
+    mapped_file _file;
+    _slot* _slots = nullptr;
+    std::size_t _slots_count = 0;
+
+    [[nodiscard]] inline std::size_t _home(const result_cache_key& key) const noexcept {
+        return static_cast<std::size_t>(key.low % _slots_count);
+    }
+
+public:
+    // an index created with another number of slots is cleared
+    inline result_cache_index(const std::filesystem::path& path, const std::size_t slots_count) :
+        _file(path, sizeof(_header) + slots_count * sizeof(_slot)),
+        _slots_count(slots_count) {
+        auto header = static_cast<_header*>(_file.data());
+        _slots = reinterpret_cast<_slot*>(static_cast<char*>(_file.data()) + sizeof(_header));
+        if (std::memcmp(header->magic, _magic, sizeof(_magic)) != 0 || header->slots_count != slots_count) {
+            std::memset(_file.data(), 0, _file.size());
+            std::memcpy(header->magic, _magic, sizeof(_magic));
+            header->slots_count = slots_count;
+        }
+    }
+
+    inline ~result_cache_index() {
+        _file.flush();
+    }
+
+    [[nodiscard]] inline std::optional<std::string> get(const result_cache_key& key) const {
+        const std::size_t home = _home(key);
+        for (std::size_t probe = 0; probe < _max_probes && probe < _slots_count; ++probe) {
+            const _slot& slot = _slots[(home + probe) % _slots_count];
+            if (slot.size == 0) {
+                return std::nullopt;
+            }
+            if (slot.high == key.high && slot.low == key.low) {
+                return std::string(slot.attachment, std::min<std::size_t>(slot.size, max_attachment_size));
+            }
+        }
+        return std::nullopt;
+    }
+
+    inline void put(const result_cache_key& key, const std::string& attachment) {
+        if (attachment.empty() || attachment.size() > max_attachment_size) {
+            return;
+        }
+        const std::size_t home = _home(key);
+        _slot* target = &_slots[home];
+        for (std::size_t probe = 0; probe < _max_probes && probe < _slots_count; ++probe) {
+            _slot& slot = _slots[(home + probe) % _slots_count];
+            if (slot.size == 0 || (slot.high == key.high && slot.low == key.low)) {
+                target = &slot;
+                break;
+            }
+        }
+        // the size goes last, so a reader never sees a half written attachment as valid
+        target->size = 0;
+        target->high = key.high;
+        target->low  = key.low;
+        std::memcpy(target->attachment, attachment.data(), attachment.size());
+        target->size = static_cast<std::uint8_t>(attachment.size());
+    }
+
+    inline void flush() noexcept {
+        _file.flush();
+    }
+};
+} // details
+
+// Attachments of already rendered and uploaded photos, so an identical request
+// (the same photo, text and size) is answered with a single messages.send.
+// The in-memory lru is backed by an optional index file that survives restarts.
+class result_cache {
+private:
+    std::mutex _mutex;
+    lru_cache<result_cache_key, std::string, result_cache_key_hash> _memory;
+    std::unique_ptr<details::result_cache_index> _index;
+    std::atomic<std::size_t> _hits   = 0;
+    std::atomic<std::size_t> _misses = 0;
+
+public:
+    inline explicit result_cache(const std::size_t max_entries = 4096) :
+        _memory(max_entries) {}
+
+    inline void open_index(const std::filesystem::path& path, const std::size_t slots_count = 65536) {
+        if (slots_count == 0) {
+            throw std::invalid_argument(VK_GRAFFITI_BOT_FUNC_MSG("slots count must be positive"));
+        }
+        auto index = std::make_unique<details::result_cache_index>(path, slots_count);
+        std::lock_guard lock(_mutex);
+        _index = std::move(index);
+    }
+
+    [[nodiscard]] inline std::optional<std::string> get(const result_cache_key& key) {
+        std::lock_guard lock(_mutex);
+        auto attachment = _memory.get(key);
+        if (!attachment && _index) {
+            attachment = _index->get(key);
+            if (attachment) {
+                _memory.put(key, *attachment);
+            }
+        }
+        ++(attachment ? _hits : _misses);
+        return attachment;
+    }
+
+    inline void put(const result_cache_key& key, const std::string& attachment) {
+        std::lock_guard lock(_mutex);
+        _memory.put(key, attachment);
+        if (_index) {
+            _index->put(key, attachment);
+        }
+    }
+
+    [[nodiscard]] inline std::size_t get_hits() const noexcept {
+        return _hits;
+    }
+
+    [[nodiscard]] inline std::size_t get_misses() const noexcept {
+        return _misses;
+    }
+
+    inline void set_max_entries(const std::size_t max_entries) {
+        std::lock_guard lock(_mutex);
+        _memory.set_max_weight(max_entries);
+    }
+};
+VK_GRAFFITI_BOT_END
+
+#endif // !VK_GRAFFITI_BOT_RESULT_CACHE_HPP
@@ -0,0 +1,98 @@
+#ifndef VK_GRAFFITI_BOT_TEXT_MASK_CACHE_HPP
+#define VK_GRAFFITI_BOT_TEXT_MASK_CACHE_HPP
+
+#include "lru_cache.hpp"
+#include "text_rasterizer.hpp"
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+
+VK_GRAFFITI_BOT_BEGIN
+struct text_mask_key {
+    std::u32string text;
+    unsigned character_size = 0;
+    float outline_thickness = 0;
+
+    [[nodiscard]] inline bool operator==(const text_mask_key& other) const noexcept {
+        return character_size == other.character_size &&
+            outline_thickness == other.outline_thickness && text == other.text;
+    }
+};
+
+struct text_mask_key_hash {
+    [[nodiscard]] inline std::size_t operator()(const text_mask_key& key) const noexcept {
+        std::size_t hash = std::hash<std::u32string>()(key.text);
+        hash ^= std::hash<unsigned>()(key.character_size) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+        hash ^= std::hash<float>()(key.outline_thickness) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+        return hash;
+    }
+};
+
+// Rendered captions shared by all workers, limited by the memory taken by the coverage masks.
+class text_mask_cache {
+public:
+    using mask_ptr = std::shared_ptr<const text_mask>;
+
+private:
+    std::mutex _mutex;
+    lru_cache<text_mask_key, mask_ptr, text_mask_key_hash> _cache;
+    std::atomic<std::size_t> _hits   = 0;
+    std::atomic<std::size_t> _misses = 0;
+
+    [[nodiscard]] static inline std::size_t _mask_weight(const text_mask& mask) noexcept {
+        return sizeof(text_mask) + mask.fill.size() + mask.outline.size();
+    }
+
+public:
+    inline explicit text_mask_cache(const std::size_t max_bytes = 64 * 1024 * 1024) :
+        _cache(max_bytes) {}
+
+    // rasterizes the text only when it is not cached yet, max_pixels is passed to text_rasterizer::rasterize
+    [[nodiscard]] inline mask_ptr get_or_rasterize(text_rasterizer& rasterizer,
+        const std::u32string& text, const unsigned character_size, const std::size_t max_pixels = 0) {
+        text_mask_key key{ text, character_size, rasterizer.get_outline_thickness() };
+        {
+            std::lock_guard lock(_mutex);
+            if (auto mask = _cache.get(key)) {
+                ++_hits;
+                return *mask;
+            }
+        }
+        ++_misses;
+
+        // rasterize outside the lock, two workers may rarely render the same text at once
+        auto mask = std::make_shared<const text_mask>(rasterizer.rasterize(text, character_size, max_pixels));
+        const auto weight = _mask_weight(*mask);
+        std::lock_guard lock(_mutex);
+        _cache.put(std::move(key), mask, weight);
+        return mask;
+    }
+
+    [[nodiscard]] inline std::size_t get_hits() const noexcept {
+        return _hits;
+    }
+
+    [[nodiscard]] inline std::size_t get_misses() const noexcept {
+        return _misses;
+    }
+
+    [[nodiscard]] inline std::size_t get_max_bytes() {
+        std::lock_guard lock(_mutex);
+        return _cache.get_max_weight();
+    }
+
+    inline void set_max_bytes(const std::size_t max_bytes) {
+        std::lock_guard lock(_mutex);
+        _cache.set_max_weight(max_bytes);
+    }
+
+    inline void clear() {
+        std::lock_guard lock(_mutex);
+        _cache.clear();
+    }
+};
+VK_GRAFFITI_BOT_END
+
+#endif // !VK_GRAFFITI_BOT_TEXT_MASK_CACHE_HPP
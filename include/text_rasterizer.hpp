@@ -0,0 +1,335 @@
+#ifndef VK_GRAFFITI_BOT_TEXT_RASTERIZER_HPP
+#define VK_GRAFFITI_BOT_TEXT_RASTERIZER_HPP
+
+#include "blend.hpp"
+#include "glyph_atlas.hpp"
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#include FT_GLYPH_H
+#include FT_STROKER_H
+
+#include <cmath>
+#include <string>
+#include <vector>
+#include <memory>
+#include <optional>
+#include <cstdint>
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+
+#include <SFML/Graphics/Image.hpp>
+
+VK_GRAFFITI_BOT_BEGIN
+// Fill and outline coverage of a whole text.
+// left and top are the position of the mask relative to the text origin, the same origin sf::Text uses.
+struct text_mask {
+    int left   = 0;
+    int top    = 0;
+    int width  = 0;
+    int height = 0;
+    std::vector<std::uint8_t> fill;
+    std::vector<std::uint8_t> outline;
+};
+
+// Lays out and rasterizes text with FreeType on the CPU, without any OpenGL context.
+// Like FreeType itself it is not thread-safe, every thread needs its own rasterizer.
+class text_rasterizer {
+private:
+    static constexpr std::size_t _glyph_cache_max_size  = 4096;
+    static constexpr std::size_t _glyph_cache_max_bytes = 64 * 1024 * 1024;
+
+    FT_Library _library = nullptr;
+    FT_Face _face       = nullptr;
+    FT_Stroker _stroker = nullptr;
+    float _outline_thickness = 0;
+    std::uint64_t _font_hash = 0;
+    unsigned _current_size   = 0;
+    std::unordered_map<std::uint64_t, rasterized_glyph> _glyphs;
+    std::size_t _glyphs_bytes = 0;
+    // glyphs rendered before, looked up before FreeType is asked
+    std::shared_ptr<const glyph_atlas> _atlas;
+
+    static inline void _check_error(const FT_Error error, const char* msg) {
+        if (error) {
+            throw std::runtime_error(VK_GRAFFITI_BOT_FUNC_MSG(msg));
+        }
+    }
+
+    [[nodiscard]] static inline std::uint64_t _glyph_key(const char32_t codepoint, const unsigned character_size) {
+        return (static_cast<std::uint64_t>(character_size) << 32) | codepoint;
+    }
+
+    inline void _set_size(const unsigned character_size) {
+        if (_current_size != character_size) {
+            _check_error(FT_Set_Pixel_Sizes(_face, 0, character_size), "set character size error");
+            _current_size = character_size;
+        }
+    }
+
+    [[nodiscard]] static inline glyph_bitmap _to_bitmap(FT_Glyph& glyph) {
+        _check_error(FT_Glyph_To_Bitmap(&glyph, FT_RENDER_MODE_NORMAL, nullptr, 1), "glyph to bitmap error");
+        const auto bitmap_glyph = reinterpret_cast<FT_BitmapGlyph>(glyph);
+        const FT_Bitmap& bitmap = bitmap_glyph->bitmap;
+
+        glyph_bitmap result;
+        result.left   = bitmap_glyph->left;
+        result.top    = bitmap_glyph->top;
+        result.width  = static_cast<int>(bitmap.width);
+        result.height = static_cast<int>(bitmap.rows);
+        result.coverage.resize(static_cast<std::size_t>(result.width) * result.height);
+        for (int y = 0; y < result.height; ++y) {
+            const unsigned char* row = bitmap.buffer + static_cast<std::ptrdiff_t>(y) * bitmap.pitch;
+            std::copy(row, row + result.width, result.coverage.begin() + static_cast<std::ptrdiff_t>(y) * result.width);
+        }
+        return result;
+    }
+
+    [[nodiscard]] inline rasterized_glyph _rasterize_glyph(const char32_t codepoint, const unsigned character_size) {
+        _set_size(character_size);
+        _check_error(FT_Load_Char(_face, codepoint, FT_LOAD_TARGET_NORMAL | FT_LOAD_FORCE_AUTOHINT),
+            "load glyph error");
+
+        rasterized_glyph result;
+        result.advance = static_cast<float>(_face->glyph->advance.x) / 64.f;
+
+        FT_Glyph glyph = nullptr;
+        _check_error(FT_Get_Glyph(_face->glyph, &glyph), "get glyph error");
+        FT_Glyph outline_glyph = nullptr;
+        try {
+            if (_outline_thickness > 0) {
+                _check_error(FT_Glyph_Copy(glyph, &outline_glyph), "copy glyph error");
+                _check_error(FT_Glyph_Stroke(&outline_glyph, _stroker, 1), "stroke glyph error");
+                result.outline = _to_bitmap(outline_glyph);
+            }
+            result.fill = _to_bitmap(glyph);
+        } catch (...) {
+            FT_Done_Glyph(glyph);
+            if (outline_glyph) {
+                FT_Done_Glyph(outline_glyph);
+            }
+            throw;
+        }
+        FT_Done_Glyph(glyph);
+        if (outline_glyph) {
+            FT_Done_Glyph(outline_glyph);
+        }
+        return result;
+    }
+
+    static inline void _draw_coverage(std::vector<std::uint8_t>& dst, const int dst_width,
+        const glyph_bitmap& bitmap, const int x, const int y) {
+        for (int row = 0; row < bitmap.height; ++row) {
+            const auto src_first = bitmap.coverage.begin() + static_cast<std::ptrdiff_t>(row) * bitmap.width;
+            const auto dst_first = dst.begin() + static_cast<std::ptrdiff_t>(y + row) * dst_width + x;
+            std::transform(src_first, src_first + bitmap.width, dst_first, dst_first,
+                [](const std::uint8_t src, const std::uint8_t dst) { return std::max(src, dst); });
+        }
+    }
+
+public:
+    // font_data must stay alive while the rasterizer is used
+    inline text_rasterizer(const void* font_data, const std::size_t font_data_size, const float outline_thickness) :
+        _outline_thickness(outline_thickness),
+        _font_hash(glyph_atlas_font_hash(font_data, font_data_size)) {
+        _check_error(FT_Init_FreeType(&_library), "freetype init error");
+        try {
+            _check_error(FT_New_Memory_Face(_library, static_cast<const FT_Byte*>(font_data),
+                static_cast<FT_Long>(font_data_size), 0, &_face), "load font error");
+            _check_error(FT_Select_Charmap(_face, FT_ENCODING_UNICODE), "select unicode charmap error");
+            _check_error(FT_Stroker_New(_library, &_stroker), "stroker init error");
+            FT_Stroker_Set(_stroker, static_cast<FT_Fixed>(outline_thickness * 64.f),
+                FT_STROKER_LINECAP_ROUND, FT_STROKER_LINEJOIN_ROUND, 0);
+        } catch (...) {
+            FT_Done_FreeType(_library);
+            throw;
+        }
+    }
+
+    text_rasterizer(const text_rasterizer&)            = delete;
+    text_rasterizer& operator=(const text_rasterizer&) = delete;
+
+    inline ~text_rasterizer() {
+        if (_stroker) {
+            FT_Stroker_Done(_stroker);
+        }
+        // also releases the face
+        FT_Done_FreeType(_library);
+    }
+
+    [[nodiscard]] inline float get_outline_thickness() const noexcept {
+        return _outline_thickness;
+    }
+
+    [[nodiscard]] inline std::uint64_t get_font_hash() const noexcept {
+        return _font_hash;
+    }
+
+    [[nodiscard]] inline const std::shared_ptr<const glyph_atlas>& get_glyph_atlas() const noexcept {
+        return _atlas;
+    }
+
+    // glyphs found in the atlas are copied from it instead of being rendered, nullptr stops using it
+    inline void set_glyph_atlas(std::shared_ptr<const glyph_atlas> atlas) {
+        if (atlas && !atlas->empty() &&
+            (atlas->get_font_hash() != _font_hash || atlas->get_outline_thickness() != _outline_thickness)) {
+            throw std::invalid_argument(VK_GRAFFITI_BOT_FUNC_MSG("atlas was made for another font"));
+        }
+        _atlas = std::move(atlas);
+    }
+
+    // renders the characters at the sizes with FreeType, whatever the atlas and the cache hold
+    [[nodiscard]] inline glyph_atlas make_glyph_atlas(const std::vector<unsigned>& character_sizes,
+        const std::u32string& characters) {
+        return glyph_atlas::build(_font_hash, _outline_thickness, character_sizes, characters,
+            [this](const char32_t codepoint, const unsigned character_size) {
+                return _rasterize_glyph(codepoint, character_size);
+            });
+    }
+
+    // glyphs are rasterized once per character size and reused afterwards
+    [[nodiscard]] inline const rasterized_glyph& glyph(const char32_t codepoint, const unsigned character_size) {
+        const auto key = _glyph_key(codepoint, character_size);
+        const auto glyph_it = _glyphs.find(key);
+        if (glyph_it != _glyphs.end()) {
+            return glyph_it->second;
+        }
+        std::optional<rasterized_glyph> atlas_glyph;
+        if (_atlas) {
+            atlas_glyph = _atlas->find(codepoint, character_size);
+        }
+        const auto& result = _glyphs.emplace(key, atlas_glyph ? std::move(*atlas_glyph) :
+            _rasterize_glyph(codepoint, character_size)).first->second;
+        _glyphs_bytes += result.fill.coverage.size() + result.outline.coverage.size();
+        return result;
+    }
+
+    // The layout follows sf::Text: the first baseline is at character_size, lines are split by '\n'.
+    // A text whose mask would cover more than max_pixels (0 is no limit) is rejected while it is laid out,
+    // before its masks and the rest of its glyphs are allocated.
+    [[nodiscard]] inline text_mask rasterize(const std::u32string& text, const unsigned character_size,
+        const std::size_t max_pixels = 0) {
+        struct placed_glyph {
+            const rasterized_glyph* glyph;
+            int x;
+            int y;
+        };
+
+        // the cache is only trimmed here, so glyph references stay valid during the layout
+        if (_glyphs.size() + text.size() > _glyph_cache_max_size || _glyphs_bytes > _glyph_cache_max_bytes) {
+            _glyphs.clear();
+            _glyphs_bytes = 0;
+        }
+        _set_size(character_size);
+        const float line_spacing = static_cast<float>(_face->size->metrics.height) / 64.f;
+        const bool has_kerning   = FT_HAS_KERNING(_face);
+
+        std::vector<placed_glyph> placed;
+        placed.reserve(text.size());
+        float pen_x = 0;
+        float pen_y = static_cast<float>(character_size);
+        char32_t prev_codepoint = 0;
+        int min_x = 0, min_y = 0, max_x = 0, max_y = 0;
+        bool has_pixels = false;
+        for (const char32_t codepoint : text) {
+            if (codepoint == U'\r') {
+                continue;
+            }
+            if (codepoint == U'\n') {
+                pen_x = 0;
+                pen_y += line_spacing;
+                prev_codepoint = 0;
+                continue;
+            }
+
+            if (has_kerning && prev_codepoint) {
+                FT_Vector kerning;
+                FT_Get_Kerning(_face, FT_Get_Char_Index(_face, prev_codepoint),
+                    FT_Get_Char_Index(_face, codepoint), FT_KERNING_DEFAULT, &kerning);
+                pen_x += static_cast<float>(kerning.x) / 64.f;
+            }
+            prev_codepoint = codepoint;
+
+            const rasterized_glyph& current = glyph(codepoint, character_size);
+            const int x = static_cast<int>(std::floor(pen_x));
+            const int y = static_cast<int>(std::floor(pen_y));
+            pen_x += current.advance;
+            const glyph_bitmap& extent = current.outline.width ? current.outline : current.fill;
+            if (extent.width == 0 || extent.height == 0) {
+                continue;
+            }
+
+            const int left   = x + extent.left;
+            const int top    = y - extent.top;
+            const int right  = left + extent.width;
+            const int bottom = top + extent.height;
+            if (!has_pixels) {
+                min_x = left, min_y = top, max_x = right, max_y = bottom;
+                has_pixels = true;
+            } else {
+                min_x = std::min(min_x, left);
+                min_y = std::min(min_y, top);
+                max_x = std::max(max_x, right);
+                max_y = std::max(max_y, bottom);
+            }
+            if (max_pixels != 0 && static_cast<std::size_t>(max_x - min_x) * (max_y - min_y) > max_pixels) {
+                throw std::runtime_error(VK_GRAFFITI_BOT_FUNC_MSG("text is too large"));
+            }
+            placed.push_back({ &current, x, y });
+        }
+
+        text_mask mask;
+        if (!has_pixels) {
+            return mask;
+        }
+        mask.left   = min_x;
+        mask.top    = min_y;
+        mask.width  = max_x - min_x;
+        mask.height = max_y - min_y;
+        const auto mask_size = static_cast<std::size_t>(mask.width) * mask.height;
+        mask.fill.assign(mask_size, 0);
+        if (_outline_thickness > 0) {
+            mask.outline.assign(mask_size, 0);
+        }
+
+        for (const auto& [current, x, y] : placed) {
+            const auto& fill = current->fill;
+            _draw_coverage(mask.fill, mask.width, fill, x + fill.left - min_x, y - fill.top - min_y);
+            if (!mask.outline.empty()) {
+                const auto& outline = current->outline;
+                _draw_coverage(mask.outline, mask.width, outline, x + outline.left - min_x, y - outline.top - min_y);
+            }
+        }
+        return mask;
+    }
+};
+
+// Draws the outline and then the fill of the mask straight into the image pixels,
+// x and y are the position of the text origin, only the mask rectangle is touched.
+inline void blend_text_mask(sf::Image& image, const text_mask& mask, const int x, const int y,
+    const sf::Color& fill_color, const sf::Color& outline_color) {
+    const auto image_size = image.getSize();
+    const int first_x = std::max(x + mask.left, 0);
+    const int first_y = std::max(y + mask.top, 0);
+    const int last_x  = std::min(x + mask.left + mask.width, static_cast<int>(image_size.x));
+    const int last_y  = std::min(y + mask.top + mask.height, static_cast<int>(image_size.y));
+    if (first_x >= last_x || first_y >= last_y) {
+        return;
+    }
+
+    const blend_color fill{ fill_color.r, fill_color.g, fill_color.b, fill_color.a };
+    const blend_color outline{ outline_color.r, outline_color.g, outline_color.b, outline_color.a };
+    // sf::Image keeps its pixels in a mutable buffer but only exposes it as const
+    auto pixels = const_cast<std::uint8_t*>(image.getPixelsPtr());
+    for (int image_y = first_y; image_y < last_y; ++image_y) {
+        const auto mask_offset = static_cast<std::size_t>(image_y - y - mask.top) * mask.width +
+            (first_x - x - mask.left);
+        blend_coverage_row(pixels + (static_cast<std::size_t>(image_y) * image_size.x + first_x) * 4,
+            mask.fill.data() + mask_offset, mask.outline.empty() ? nullptr : mask.outline.data() + mask_offset,
+            static_cast<std::size_t>(last_x - first_x), fill, outline);
+    }
+}
+VK_GRAFFITI_BOT_END
+
+#endif // !VK_GRAFFITI_BOT_TEXT_RASTERIZER_HPP
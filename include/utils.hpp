@@ -2,7 +2,25 @@
 #define VK_GRAFFITI_BOT_UTILS_HPP
 
 #include <iostream>
+#include <fstream>
+#include <array>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <memory>
 #include <string>
+#include <thread>
+#include <vector>
+#include <cstdlib>
+#include <cstddef>
+#include <stdexcept>
+#include <filesystem>
+#include <string_view>
+#include <type_traits>
+#include <initializer_list>
+#include <condition_variable>
 
 #define VK_GRAFFITI_BOT_BEGIN namespace vk_graffiti_bot {
 #define VK_GRAFFITI_BOT_END   }
@@ -33,11 +51,12 @@ inline void current_function_helper() noexcept {
 #endif
 }
 
-[[nodiscard]] inline std::string dynamic_func_msg(const std::string& msg, const std::string& func) {
-    constexpr const char func_prefix[] = "Function: ";
-    constexpr const char msg_prefix[]  = "Msg: ";
-    constexpr const char separator[]   = " | ";
+[[nodiscard]] inline std::string dynamic_func_msg(const std::string_view msg, const std::string_view func) {
+    constexpr std::string_view func_prefix = "Function: ";
+    constexpr std::string_view msg_prefix  = "Msg: ";
+    constexpr std::string_view separator   = " | ";
     std::string result;
+    result.reserve(func_prefix.size() + func.size() + separator.size() + msg_prefix.size() + msg.size());
     result += func_prefix;
     result += func;
     result += separator;
@@ -46,21 +65,459 @@ inline void current_function_helper() noexcept {
     return result;
 }
 
-inline void log_base(const std::string& name, const std::string& msg) {
-    std::cerr << name + ": \"" << msg << "\"" << std::endl; 
+inline void append_json_string(std::string& out, const std::string_view value) {
+    constexpr char hex[] = "0123456789abcdef";
+    out += '"';
+    for (const char c : value) {
+        switch (c) {
+        case '"':
+            out += "\\\"";
+        break;
+        case '\\':
+            out += "\\\\";
+        break;
+        case '\n':
+            out += "\\n";
+        break;
+        case '\r':
+            out += "\\r";
+        break;
+        case '\t':
+            out += "\\t";
+        break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+                out += "\\u00";
+                out += hex[(c >> 4) & 0xF];
+                out += hex[c & 0xF];
+            } else {
+                out += c;
+            }
+        }
+    }
+    out += '"';
 }
+
+// id of the request the current thread works on, 0 when there is none
+inline thread_local long long current_request_id = 0;
 } // details
 
-inline void log_warning(const std::string& msg) {
-    details::log_base("Warning", msg);
+enum class log_level {
+    debug,
+    info,
+    warning,
+    error,
+    off
+};
+
+[[nodiscard]] inline const char* to_string(const log_level level) noexcept {
+    static constexpr const char* names[] = { "debug", "info", "warning", "error", "off" };
+    return names[static_cast<std::size_t>(level)];
+}
+
+[[nodiscard]] inline log_level log_level_from_string(const std::string_view name) {
+    for (const auto level : { log_level::debug, log_level::info, log_level::warning, log_level::error, log_level::off }) {
+        if (name == to_string(level)) {
+            return level;
+        }
+    }
+    throw std::invalid_argument(details::dynamic_func_msg("unknown log level: " + std::string(name),
+        VK_GRAFFITI_BOT_CURRENT_FUNCTION));
+}
+
+// A key and a value added to a log record, keys must be string literals.
+class log_field {
+public:
+    enum class kind {
+        integer,
+        floating,
+        string
+    };
+
+private:
+    const char* _key = "";
+    kind _kind = kind::integer;
+    long long _integer = 0;
+    double _floating = 0;
+    std::string _string;
+
+public:
+    inline log_field() noexcept = default;
+
+    template <typename Integer, std::enable_if_t<std::is_integral_v<Integer>, int> = 0>
+    inline log_field(const char* key, const Integer value) noexcept :
+        _key(key),
+        _kind(kind::integer),
+        _integer(static_cast<long long>(value)) {}
+
+    inline log_field(const char* key, const double value) noexcept :
+        _key(key),
+        _kind(kind::floating),
+        _floating(value) {}
+
+    inline log_field(const char* key, const std::string_view value) :
+        _key(key),
+        _kind(kind::string),
+        _string(value) {}
+
+    inline log_field(const char* key, const char* value) :
+        log_field(key, std::string_view(value)) {}
+
+    inline log_field(const char* key, const std::string& value) :
+        log_field(key, std::string_view(value)) {}
+
+    inline void append_json(std::string& out) const {
+        details::append_json_string(out, _key);
+        out += ':';
+        switch (_kind) {
+        case kind::integer:
+            out += std::to_string(_integer);
+        break;
+        case kind::floating: {
+            char buffer[32];
+            const int size = std::snprintf(buffer, sizeof(buffer), "%.9g", _floating);
+            out.append(buffer, size > 0 ? static_cast<std::size_t>(size) : 0);
+        }
+        break;
+        default:
+            details::append_json_string(out, _string);
+        }
+    }
+};
+
+// Writes JSON lines ({"ts", "level", "thread", "request_id", "msg", fields...}) from a background thread.
+// Records go through a bounded lock-free ring, a record below the level is dropped before anything
+// is copied, and all formatting (timestamps, escaping, numbers) happens on the writer thread.
+// When the ring is full records are dropped instead of blocking, the writer reports how many.
+class logger {
+public:
+    static constexpr std::size_t max_fields = 6;
+
+private:
+    struct _record {
+        log_level level = log_level::info;
+        std::chrono::system_clock::time_point time;
+        std::size_t thread = 0;
+        long long request_id = 0;
+        std::string msg;
+        std::array<log_field, max_fields> fields;
+        std::size_t fields_count = 0;
+    };
+
+    struct _cell {
+        std::atomic<std::size_t> sequence = 0;
+        _record record;
+    };
+
+    static constexpr auto _idle_wait = std::chrono::milliseconds(50);
+
+    std::unique_ptr<_cell[]> _cells;
+    std::size_t _mask;
+    alignas(64) std::atomic<std::size_t> _enqueue_pos = 0;
+    alignas(64) std::size_t _dequeue_pos = 0;
+    std::atomic<std::size_t> _dropped = 0;
+    std::atomic<log_level> _level = log_level::info;
+    std::atomic<bool> _stopped = false;
+    std::atomic<bool> _writer_sleeping = false;
+    std::mutex _wake_mutex;
+    std::condition_variable _wake;
+    // guards the output and the formatting buffer, only contended while the log file is changed
+    std::mutex _out_mutex;
+    std::FILE* _out = stderr;
+    std::string _buffer;
+    std::thread _thread;
+
+    [[nodiscard]] static inline std::size_t _thread_number() noexcept {
+        static std::atomic<std::size_t> next = 1;
+        thread_local const std::size_t number = next.fetch_add(1, std::memory_order_relaxed);
+        return number;
+    }
+
+    // bounded multi-producer queue after Dmitry Vyukov, every cell carries the position it is ready for
+    [[nodiscard]] inline bool _try_push(_record& record) noexcept {
+        std::size_t pos = _enqueue_pos.load(std::memory_order_relaxed);
+        _cell* cell = nullptr;
+        while (true) {
+            cell = &_cells[pos & _mask];
+            const std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            const auto diff = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos);
+            if (diff == 0) {
+                if (_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = _enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        std::swap(cell->record, record);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // only ever called by one thread at a time
+    [[nodiscard]] inline bool _try_pop(_record& record) noexcept {
+        _cell& cell = _cells[_dequeue_pos & _mask];
+        const std::size_t sequence = cell.sequence.load(std::memory_order_acquire);
+        if (static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(_dequeue_pos + 1) < 0) {
+            return false;
+        }
+        std::swap(record, cell.record);
+        cell.sequence.store(_dequeue_pos + _mask + 1, std::memory_order_release);
+        ++_dequeue_pos;
+        return true;
+    }
+
+    inline void _format(const _record& record) {
+        const std::time_t seconds = std::chrono::system_clock::to_time_t(record.time);
+        const auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(
+            record.time.time_since_epoch()).count() % 1000;
+        std::tm utc{};
+#if defined(_WIN32)
+        gmtime_s(&utc, &seconds);
+#else
+        gmtime_r(&seconds, &utc);
+#endif
+        char time_buffer[32];
+        const std::size_t time_size = std::strftime(time_buffer, sizeof(time_buffer), "%Y-%m-%dT%H:%M:%S", &utc);
+        char millis_buffer[8];
+        std::snprintf(millis_buffer, sizeof(millis_buffer), ".%03dZ", static_cast<int>(millis));
+
+        _buffer += "{\"ts\":\"";
+        _buffer.append(time_buffer, time_size);
+        _buffer += millis_buffer;
+        _buffer += "\",\"level\":\"";
+        _buffer += to_string(record.level);
+        _buffer += "\",\"thread\":";
+        _buffer += std::to_string(record.thread);
+        if (record.request_id != 0) {
+            _buffer += ",\"request_id\":";
+            _buffer += std::to_string(record.request_id);
+        }
+        _buffer += ",\"msg\":";
+        details::append_json_string(_buffer, record.msg);
+        for (std::size_t i = 0; i < record.fields_count; ++i) {
+            _buffer += ',';
+            record.fields[i].append_json(_buffer);
+        }
+        _buffer += "}\n";
+    }
+
+    inline void _write_buffer() {
+        if (_buffer.empty()) {
+            return;
+        }
+        std::fwrite(_buffer.data(), 1, _buffer.size(), _out);
+        std::fflush(_out);
+        _buffer.clear();
+    }
+
+    // true when anything was written
+    inline bool _drain() {
+        std::lock_guard lock(_out_mutex);
+        _record record;
+        bool written = false;
+        while (_try_pop(record)) {
+            _format(record);
+            written = true;
+            // keeps the buffer small under a storm
+            if (_buffer.size() > 64 * 1024) {
+                _write_buffer();
+            }
+        }
+        if (const std::size_t dropped = _dropped.exchange(0, std::memory_order_relaxed)) {
+            _record dropped_record;
+            dropped_record.level = log_level::warning;
+            dropped_record.time  = std::chrono::system_clock::now();
+            dropped_record.msg   = "log records were dropped";
+            dropped_record.fields[0]    = log_field("count", dropped);
+            dropped_record.fields_count = 1;
+            _format(dropped_record);
+            written = true;
+        }
+        _write_buffer();
+        return written;
+    }
+
+    inline void _run() {
+        while (!_stopped.load(std::memory_order_acquire)) {
+            if (_drain()) {
+                continue;
+            }
+            std::unique_lock lock(_wake_mutex);
+            _writer_sleeping.store(true, std::memory_order_seq_cst);
+            _wake.wait_for(lock, _idle_wait);
+            _writer_sleeping.store(false, std::memory_order_relaxed);
+        }
+        _drain();
+    }
+
+    inline void _push(_record& record) {
+        if (_stopped.load(std::memory_order_acquire)) {
+            // after shutdown the records are written in place
+            std::lock_guard lock(_out_mutex);
+            _format(record);
+            _write_buffer();
+            return;
+        }
+        if (!_try_push(record)) {
+            _dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        if (_writer_sleeping.load(std::memory_order_seq_cst)) {
+            _wake.notify_one();
+        }
+    }
+
+public:
+    // capacity is rounded up to a power of two
+    inline explicit logger(const std::size_t capacity = 8192) {
+        std::size_t size = 2;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        _mask  = size - 1;
+        _cells = std::make_unique<_cell[]>(size);
+        for (std::size_t i = 0; i < size; ++i) {
+            _cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        _thread = std::thread(&logger::_run, this);
+    }
+
+    logger(const logger&)            = delete;
+    logger& operator=(const logger&) = delete;
+
+    inline ~logger() {
+        shutdown();
+        if (_out != stderr && _out != stdout) {
+            std::fclose(_out);
+        }
+    }
+
+    // writes everything queued and stops the writer thread, later records are written in place
+    inline void shutdown() {
+        if (_stopped.exchange(true)) {
+            return;
+        }
+        _wake.notify_one();
+        if (_thread.joinable()) {
+            _thread.join();
+        }
+        _drain();
+    }
+
+    [[nodiscard]] inline bool is_enabled(const log_level level) const noexcept {
+        return level >= _level.load(std::memory_order_relaxed) && level != log_level::off;
+    }
+
+    [[nodiscard]] inline log_level get_level() const noexcept {
+        return _level.load(std::memory_order_relaxed);
+    }
+
+    inline void set_level(const log_level level) noexcept {
+        _level.store(level, std::memory_order_relaxed);
+    }
+
+    // records are appended to the file instead of stderr
+    inline void set_file(const std::filesystem::path& path) {
+        std::FILE* file = std::fopen(path.string().c_str(), "a");
+        if (!file) {
+            throw std::runtime_error(details::dynamic_func_msg("open log file error: " + path.string(),
+                VK_GRAFFITI_BOT_CURRENT_FUNCTION));
+        }
+        std::lock_guard lock(_out_mutex);
+        if (_out != stderr && _out != stdout) {
+            std::fclose(_out);
+        }
+        _out = file;
+    }
+
+    template <typename... Fields>
+    inline void log(const log_level level, const std::string_view msg, Fields&&... fields) {
+        static_assert(sizeof...(Fields) <= max_fields, "too many log fields");
+        if (!is_enabled(level)) {
+            return;
+        }
+        _record record;
+        record.level      = level;
+        record.time       = std::chrono::system_clock::now();
+        record.thread     = _thread_number();
+        record.request_id = details::current_request_id;
+        record.msg        = msg;
+        ((record.fields[record.fields_count++] = log_field(std::forward<Fields>(fields))), ...);
+        _push(record);
+    }
+};
+
+// the logger lives until the process ends, so records made while statics are destroyed are not lost
+[[nodiscard]] inline logger& global_logger() {
+    static logger* instance = [] {
+        auto created = new logger();
+        std::atexit([] {
+            global_logger().shutdown();
+        });
+        return created;
+    }();
+    return *instance;
 }
 
-inline void log_error(const std::string& msg) {
-    details::log_base("Error", msg);
+// records made on this thread while it exists carry the request id
+class log_request_scope {
+private:
+    long long _previous;
+
+public:
+    inline explicit log_request_scope(const long long request_id) noexcept :
+        _previous(details::current_request_id) {
+        details::current_request_id = request_id;
+    }
+
+    log_request_scope(const log_request_scope&)            = delete;
+    log_request_scope& operator=(const log_request_scope&) = delete;
+
+    inline ~log_request_scope() {
+        details::current_request_id = _previous;
+    }
+};
+
+template <typename... Fields>
+inline void log_debug(const std::string_view msg, Fields&&... fields) {
+    global_logger().log(log_level::debug, msg, std::forward<Fields>(fields)...);
+}
+
+template <typename... Fields>
+inline void log_info(const std::string_view msg, Fields&&... fields) {
+    global_logger().log(log_level::info, msg, std::forward<Fields>(fields)...);
+}
+
+template <typename... Fields>
+inline void log_warning(const std::string_view msg, Fields&&... fields) {
+    global_logger().log(log_level::warning, msg, std::forward<Fields>(fields)...);
+}
+
+template <typename... Fields>
+inline void log_error(const std::string_view msg, Fields&&... fields) {
+    global_logger().log(log_level::error, msg, std::forward<Fields>(fields)...);
 }
 VK_GRAFFITI_BOT_END
 
 #define VK_GRAFFITI_BOT_FUNC_MSG(message)\
  (VK_GRAFFITI_BOT details::dynamic_func_msg(message, VK_GRAFFITI_BOT_CURRENT_FUNCTION))
 
+VK_GRAFFITI_BOT_BEGIN
+[[nodiscard]] inline std::vector<char> read_file(const std::filesystem::path& path) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file.is_open()) {
+        throw std::runtime_error(VK_GRAFFITI_BOT_FUNC_MSG("open file error: " + path.string()));
+    }
+    std::vector<char> data(static_cast<std::size_t>(file.tellg()));
+    file.seekg(0);
+    if (!file.read(data.data(), data.size())) {
+        throw std::runtime_error(VK_GRAFFITI_BOT_FUNC_MSG("read file error: " + path.string()));
+    }
+    return data;
+}
+VK_GRAFFITI_BOT_END
+
 #endif // VK_GRAFFITI_BOT_UTILS_HPP
\ No newline at end of file
@@ -2,10 +2,26 @@
 #define VK_GRAFFITI_BOT_VK_API_HPP
 
 #include "curl_wrapper.hpp"
+#include "lru_cache.hpp"
+#include "api_scheduler.hpp"
+#include "query_builder.hpp"
+#include "long_poll_parser.hpp"
 #include <nlohmann/json.hpp>
 
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
 #include <utility>
+#include <iterator>
 #include <optional>
+#include <string_view>
+#include <unordered_map>
+#include <condition_variable>
 
 VK_GRAFFITI_BOT_BEGIN
 struct vk_api_version {
@@ -19,44 +35,98 @@ struct vk_api_version {
 
 class method {
 private:
-    std::string _string;
+    std::string _name;
+    query_builder _query;
 
 public:
-    inline method() noexcept = default;
+    inline method() = default;
 
     inline method(const std::string& name) :
-        _string("method/" + name + '?') {}
+        _name(name) {}
 
-    inline method(const std::string& name, const std::initializer_list<std::pair<std::string, std::string>>& params) :
+    inline method(const std::string& name,
+        const std::initializer_list<std::pair<std::string_view, std::string_view>>& params) :
         method(name) {
         for (const auto& param : params) {
             add_param(param);
         }
     }
 
-    inline void add_param(const std::string name, const std::string& value) {
-        _string += name + '=' + value + '&';
+    // values are percent-encoded here, callers pass them as they are
+    template <typename Value>
+    inline void add_param(const std::string_view name, const Value& value) {
+        _query.add(name, value);
     }
 
-    inline void add_param(const std::pair<std::string, std::string>& param) {
+    inline void add_param(const std::pair<std::string_view, std::string_view>& param) {
         add_param(param.first, param.second);
     }
 
-    [[nodiscard]] inline const std::string& to_string() const noexcept {
-        return _string;
+    [[nodiscard]] inline const std::string& get_name() const noexcept {
+        return _name;
+    }
+
+    [[nodiscard]] inline const query_builder& get_query() const noexcept {
+        return _query;
     }
 };
 
+inline constexpr std::string_view default_api_url = "https://api.vk.com/method/";
+
+// Methods are posted, so the parameters and the token stay out of the url (and out of logged urls).
+// Both functions append, so reused buffers do not allocate.
+inline void append_method_url(std::string& url, const method& method, const std::string_view api_url = default_api_url) {
+    url.append(api_url).append(method.get_name());
+}
+
+inline void append_method_body(std::string& body, const method& method,
+    const std::string& token, const vk_api_version& version) {
+    body.append(method.get_query().str());
+    if (!method.get_query().empty()) {
+        body += '&';
+    }
+    body.append("access_token=").append(token).append("&v=");
+    append_integer(body, version.major);
+    body += '.';
+    append_integer(body, version.minor);
+}
+
 struct long_poll_server {
     std::string server;
     std::string key;
     std::string ts;
 };
 
+inline void append_long_poll_url(std::string& url, const long_poll_server& server, const std::size_t wait) {
+    url.append(server.server).append("?act=a_check&key=").append(server.key);
+    url.append("&ts=").append(server.ts).append("&wait=");
+    append_integer(url, wait);
+}
+
+namespace details {
+// ids are handed out in sequence from a random start, so they do not repeat within a run
+// and two runs are unlikely to overlap in the window vk remembers them for
+[[nodiscard]] inline int next_message_random_id() {
+    static std::atomic<std::uint32_t> next = [] {
+        std::random_device random;
+        return static_cast<std::uint32_t>(random());
+    }();
+    while (true) {
+        const auto id = static_cast<int>(next.fetch_add(1, std::memory_order_relaxed) & 0x7FFFFFFFu);
+        if (id != 0) {
+            return id;
+        }
+    }
+}
+} // details
+
 class message {
 public:
     std::string text;
     std::string attachment;
+    // vk drops a second message with the same random_id, 0 gets a fresh id when the message is sent,
+    // retries of that call keep it so a reply that reached vk before a timeout is not sent twice
+    int random_id = 0;
 
     inline message() noexcept = default;
 
@@ -65,26 +135,205 @@ public:
         attachment(attachment) {}
 };
 
+struct messages_upload_server {
+    std::string upload_url;
+    int album_id = 0;
+    int user_id  = 0;
+    int group_id = 0;
+};
+
+// Upload urls stay valid for a long time, so they are reused until the ttl passes or an upload fails.
+class messages_upload_server_cache {
+public:
+    using clock_type = std::chrono::steady_clock;
+
+private:
+    struct _entry {
+        messages_upload_server server;
+        clock_type::time_point expires_at;
+    };
+
+    std::mutex _mutex;
+    lru_cache<int, _entry> _servers;
+    clock_type::duration _ttl = std::chrono::hours(1);
+
+public:
+    inline explicit messages_upload_server_cache(const std::size_t max_size = 4096) :
+        _servers(max_size) {}
+
+    [[nodiscard]] inline std::optional<messages_upload_server> get(const int peer_id) {
+        std::lock_guard lock(_mutex);
+        const auto entry = _servers.get(peer_id);
+        if (!entry) {
+            return std::nullopt;
+        }
+        if (entry->expires_at <= clock_type::now()) {
+            _servers.erase(peer_id);
+            return std::nullopt;
+        }
+        return entry->server;
+    }
+
+    inline void put(const int peer_id, const messages_upload_server& server) {
+        std::lock_guard lock(_mutex);
+        _servers.put(peer_id, { server, clock_type::now() + _ttl });
+    }
+
+    inline void invalidate(const int peer_id) {
+        std::lock_guard lock(_mutex);
+        _servers.erase(peer_id);
+    }
+
+    [[nodiscard]] inline clock_type::duration get_ttl() {
+        std::lock_guard lock(_mutex);
+        return _ttl;
+    }
+
+    inline void set_ttl(const clock_type::duration ttl) {
+        std::lock_guard lock(_mutex);
+        _ttl = ttl;
+    }
+};
+
+namespace details {
+struct vk_method_metrics {
+    latency_histogram& duration;
+    metrics_counter& errors;
+};
+
+// every thread keeps the series of the methods it called, so the registry is only locked the first time
+[[nodiscard]] inline vk_method_metrics& get_vk_method_metrics(const std::string& method_name) {
+    thread_local std::unordered_map<std::string, vk_method_metrics> cache;
+    auto it = cache.find(method_name);
+    if (it == cache.end()) {
+        auto& registry     = global_metrics();
+        const auto labels  = metrics_label("method", method_name);
+        it = cache.emplace(method_name, vk_method_metrics{
+            registry.histogram("vk_graffiti_bot_vk_method_seconds",
+                "VK API call time with rate limit waits and retries.", labels),
+            registry.counter("vk_graffiti_bot_vk_method_errors_total",
+                "VK API calls that failed or returned an error.", labels) }).first;
+    }
+    return it->second;
+}
+
+inline void record_vk_method(const std::string& method_name, const std::chrono::steady_clock::time_point start,
+    const bool failed) {
+    auto& metrics = get_vk_method_metrics(method_name);
+    metrics.duration.record(std::chrono::steady_clock::now() - start);
+    if (failed) {
+        metrics.errors.add();
+    }
+}
+} // details
+
+class method_batcher;
+
 class base_vk_api {
 private:
     curl_wrapper& _curl;
     std::string _token;
     vk_api_version _version;
+    std::string _api_url{ default_api_url };
+    // shared by every api created from this one
+    std::shared_ptr<messages_upload_server_cache> _upload_server_cache;
+    std::shared_ptr<method_batcher> _batcher;
+    std::shared_ptr<api_scheduler> _scheduler;
+    retry_policy _retry_policy;
+
+    inline void _append_method_body(std::string& body, const method& method) const {
+        append_method_body(body, method, _token, _version);
+    }
 
-    [[nodiscard]] inline std::string _construct_url_from_method(const method& method) const {
-        return "https://api.vk.com/" + method.to_string() + "access_token=" + _token + "&v=" + _version.to_string();
+    // too many requests per second and internal server error are worth another try
+    [[nodiscard]] static inline bool _is_transient_error(const nlohmann::json& answer, bool& rate_limited) {
+        rate_limited = false;
+        if (!answer.is_object() || !answer.contains("error")) {
+            return false;
+        }
+        const auto& error = answer["error"];
+        const int code    = error.contains("error_code") ? error["error_code"].get<int>() : 0;
+        rate_limited      = code == 6;
+        return code == 6 || code == 10;
+    }
+
+    struct _async_call {
+        std::string method_name;
+        std::chrono::steady_clock::time_point start;
+        std::string url;
+        std::string body;
+        call_priority priority;
+        retry_policy policy;
+        std::size_t attempt = 0;
+        curl_multi_engine* engine;
+        std::shared_ptr<api_scheduler> scheduler;
+        std::promise<nlohmann::json> promise;
+    };
+
+    // runs on the engine and scheduler threads only, so nothing here blocks
+    static inline void _start_async_call(const std::shared_ptr<_async_call>& call,
+        const std::chrono::milliseconds delay = std::chrono::milliseconds(0)) {
+        call->scheduler->schedule(call->priority, [call] {
+            call->engine->post_async(call->url, call->body, [call](const CURLcode code, std::string&& answer_str) {
+                try {
+                    bool rate_limited = false;
+                    bool retry        = code != CURLE_OK;
+                    nlohmann::json answer;
+                    if (!retry) {
+                        answer = nlohmann::json::parse(answer_str, nullptr, false);
+                        retry  = answer.is_discarded() || _is_transient_error(answer, rate_limited);
+                    }
+                    if (retry && ++call->attempt < call->policy.max_attempts) {
+                        call->scheduler->record_retry(rate_limited);
+                        _start_async_call(call, call->policy.delay(call->attempt));
+                        return;
+                    }
+                    if (code != CURLE_OK) {
+                        throw std::runtime_error(VK_GRAFFITI_BOT_FUNC_MSG(curl_easy_strerror(code)));
+                    }
+                    if (answer.is_discarded()) {
+                        throw std::runtime_error(VK_GRAFFITI_BOT_FUNC_MSG("answer is not a valid json"));
+                    }
+                    details::record_vk_method(call->method_name, call->start, answer.contains("error"));
+                    call->promise.set_value(std::move(answer));
+                } catch (...) {
+                    details::record_vk_method(call->method_name, call->start, true);
+                    call->promise.set_exception(std::current_exception());
+                }
+            });
+        }, delay);
     }
 
 public:
     inline base_vk_api(curl_wrapper& curl, const std::string& token, const vk_api_version& version = vk_api_version()) :
         _curl(curl),
         _token(token),
-        _version(version) {}
+        _version(version),
+        _upload_server_cache(std::make_shared<messages_upload_server_cache>()),
+        _scheduler(std::make_shared<api_scheduler>()) {}
+
+    // makes calls through another curl wrapper but shares the token, version and caches of shared_api
+    inline base_vk_api(curl_wrapper& curl, const base_vk_api& shared_api) :
+        _curl(curl),
+        _token(shared_api._token),
+        _version(shared_api._version),
+        _api_url(shared_api._api_url),
+        _upload_server_cache(shared_api._upload_server_cache),
+        _batcher(shared_api._batcher),
+        _scheduler(shared_api._scheduler),
+        _retry_policy(shared_api._retry_policy) {}
+
+    base_vk_api(const base_vk_api&)            = delete;
+    base_vk_api& operator=(const base_vk_api&) = delete;
 
     [[nodiscard]] inline curl_wrapper& curl() noexcept {
         return _curl;
     }
 
+    [[nodiscard]] inline const curl_wrapper& curl() const noexcept {
+        return _curl;
+    }
+
     [[nodiscard]] inline const std::string& get_token() const noexcept {
         return _token;
     }
@@ -101,13 +350,282 @@ public:
         _version = version;
     }
 
-    inline nlohmann::json call_method(const method& method) {
-        std::string answer_str;
-        _curl.perform(_construct_url_from_method(method), answer_str);
-        return nlohmann::json::parse(answer_str);
+    [[nodiscard]] inline const std::string& get_api_url() const noexcept {
+        return _api_url;
+    }
+
+    // the url method names are appended to, another one points the api at a stand-in server
+    inline void set_api_url(const std::string& api_url) {
+        if (api_url.empty()) {
+            throw std::invalid_argument(VK_GRAFFITI_BOT_FUNC_MSG("api url is empty"));
+        }
+        _api_url = api_url;
+    }
+
+    [[nodiscard]] inline messages_upload_server_cache& upload_server_cache() noexcept {
+        return *_upload_server_cache;
+    }
+
+    // the rate limit is shared with every api created from this one
+    [[nodiscard]] inline api_scheduler& scheduler() noexcept {
+        return *_scheduler;
+    }
+
+    [[nodiscard]] inline const retry_policy& get_retry_policy() const noexcept {
+        return _retry_policy;
+    }
+
+    inline void set_retry_policy(const retry_policy& policy) {
+        if (policy.max_attempts == 0) {
+            throw std::invalid_argument(VK_GRAFFITI_BOT_FUNC_MSG("max attempts must be positive"));
+        }
+        _retry_policy = policy;
+    }
+
+    // Calls made through call_method_batched within the window are sent as one execute request.
+    // Apis created from this one afterwards share the batcher.
+    inline void enable_batching(const std::chrono::milliseconds window);
+
+    inline void disable_batching() noexcept {
+        _batcher.reset();
+    }
+
+    [[nodiscard]] inline bool is_batching_enabled() const noexcept {
+        return static_cast<bool>(_batcher);
+    }
+
+    // the answer has the same form as the answer of call_method: either "response" or "error"
+    [[nodiscard]] inline std::future<nlohmann::json> call_method_batched(const method& method,
+        const call_priority priority = call_priority::normal);
+
+    // waits for the rate limit and retries network failures, broken answers and transient vk errors
+    inline nlohmann::json call_method(const method& method, const call_priority priority = call_priority::normal) {
+        // every thread keeps its url and body buffers, so building them does not allocate once they are warm
+        // and calls from several threads to one api do not share them
+        thread_local std::string url;
+        thread_local std::string body;
+        url.clear();
+        append_method_url(url, method, _api_url);
+        body.clear();
+        _append_method_body(body, method);
+        const auto start = std::chrono::steady_clock::now();
+        for (std::size_t attempt = 1;; ++attempt) {
+            const bool last_attempt = attempt >= _retry_policy.max_attempts;
+            bool rate_limited = false;
+            _scheduler->acquire(priority);
+            try {
+                std::string answer_str;
+                _curl.perform_post(url, body, answer_str);
+                auto answer = nlohmann::json::parse(answer_str);
+                if (last_attempt || !_is_transient_error(answer, rate_limited)) {
+                    details::record_vk_method(method.get_name(), start, answer.contains("error"));
+                    return answer;
+                }
+            } catch (const std::exception& ex) {
+                if (last_attempt) {
+                    details::record_vk_method(method.get_name(), start, true);
+                    throw;
+                }
+                log_warning(ex.what());
+            }
+            _scheduler->record_retry(rate_limited);
+            std::this_thread::sleep_for(_retry_policy.delay(attempt));
+        }
+    }
+
+    // does not block when the curl wrapper is attached to an engine, otherwise the call is made in place
+    [[nodiscard]] inline std::future<nlohmann::json> call_method_async(const method& method,
+        const call_priority priority = call_priority::normal) {
+        curl_multi_engine* engine = _curl.get_engine();
+        if (!engine) {
+            std::promise<nlohmann::json> promise;
+            try {
+                promise.set_value(call_method(method, priority));
+            } catch (...) {
+                promise.set_exception(std::current_exception());
+            }
+            return promise.get_future();
+        }
+
+        auto call = std::make_shared<_async_call>();
+        call->method_name = method.get_name();
+        call->start       = std::chrono::steady_clock::now();
+        append_method_url(call->url, method, _api_url);
+        _append_method_body(call->body, method);
+        call->priority  = priority;
+        call->policy    = _retry_policy;
+        call->engine    = engine;
+        call->scheduler = _scheduler;
+        auto future = call->promise.get_future();
+        _start_async_call(call);
+        return future;
+    }
+};
+
+// Collects methods over a short window and sends up to 25 of them as one execute call.
+class method_batcher {
+public:
+    static constexpr std::size_t max_batch_size = 25;
+
+private:
+    struct _pending {
+        vk_graffiti_bot::method call;
+        call_priority priority;
+        std::promise<nlohmann::json> promise;
+    };
+
+    curl_wrapper _curl;
+    base_vk_api _api;
+    std::chrono::milliseconds _window;
+    std::mutex _mutex;
+    std::condition_variable _has_pending;
+    std::vector<_pending> _pending_calls;
+    bool _stopped = false;
+    std::thread _thread;
+
+    // method values are url encoded, the script needs them as plain json strings
+    [[nodiscard]] static inline std::string _make_code(const std::vector<_pending>& batch) {
+        std::string code = "return [";
+        std::string value;
+        for (std::size_t i = 0; i < batch.size(); ++i) {
+            nlohmann::json params = nlohmann::json::object();
+            batch[i].call.get_query().for_each_param([&](const std::string_view name, const std::string_view encoded) {
+                value.clear();
+                append_url_decoded(value, encoded);
+                params[std::string(name)] = value;
+            });
+            if (i != 0) {
+                code += ',';
+            }
+            code += "API." + batch[i].call.get_name() + '(' + params.dump() + ')';
+        }
+        code += "];";
+        return code;
+    }
+
+    // the batch is ordered by priority, so the first call sets the priority of the whole request
+    inline void _send(std::vector<_pending>& batch) {
+        const call_priority priority = batch.front().priority;
+        if (batch.size() == 1) {
+            try {
+                batch.front().promise.set_value(_api.call_method(batch.front().call, priority));
+            } catch (...) {
+                batch.front().promise.set_exception(std::current_exception());
+            }
+            return;
+        }
+
+        nlohmann::json answer;
+        try {
+            method execute("execute");
+            execute.add_param("code", _make_code(batch));
+            answer = _api.call_method(execute, priority);
+        } catch (...) {
+            for (auto& call : batch) {
+                call.promise.set_exception(std::current_exception());
+            }
+            return;
+        }
+
+        if (answer.contains("error")) {
+            for (auto& call : batch) {
+                call.promise.set_value(answer);
+            }
+            return;
+        }
+
+        // failed calls give false in the response, their errors follow in order in execute_errors
+        const auto& responses = answer["response"];
+        const nlohmann::json no_errors = nlohmann::json::array();
+        const auto& errors = answer.contains("execute_errors") ? answer["execute_errors"] : no_errors;
+        std::size_t error_index = 0;
+        for (std::size_t i = 0; i < batch.size(); ++i) {
+            const bool failed = i >= responses.size() || responses[i] == false;
+            if (!failed) {
+                batch[i].promise.set_value({ { "response", responses[i] } });
+                continue;
+            }
+            nlohmann::json error = error_index < errors.size() ? errors[error_index++] :
+                nlohmann::json{ { "error_code", 0 }, { "error_msg", "execute call failed" } };
+            batch[i].promise.set_value({ { "error", std::move(error) } });
+        }
+    }
+
+    inline void _run() {
+        while (true) {
+            std::vector<_pending> batch;
+            {
+                std::unique_lock lock(_mutex);
+                _has_pending.wait(lock, [this] { return _stopped || !_pending_calls.empty(); });
+                if (_pending_calls.empty()) {
+                    return;
+                }
+                const auto deadline = std::chrono::steady_clock::now() + _window;
+                _has_pending.wait_until(lock, deadline, [this] {
+                    return _stopped || _pending_calls.size() >= max_batch_size;
+                });
+                std::stable_sort(_pending_calls.begin(), _pending_calls.end(),
+                    [](const _pending& lhs, const _pending& rhs) { return lhs.priority < rhs.priority; });
+                const std::size_t count = std::min(_pending_calls.size(), max_batch_size);
+                std::move(_pending_calls.begin(), _pending_calls.begin() + count, std::back_inserter(batch));
+                _pending_calls.erase(_pending_calls.begin(), _pending_calls.begin() + count);
+            }
+            _send(batch);
+        }
+    }
+
+public:
+    inline method_batcher(const base_vk_api& shared_api, const std::chrono::milliseconds window) :
+        _curl(shared_api.curl().get_handle_pool(), shared_api.curl().get_engine()),
+        _api(_curl, shared_api),
+        _window(window) {
+        _api.disable_batching();
+        _thread = std::thread(&method_batcher::_run, this);
+    }
+
+    method_batcher(const method_batcher&)            = delete;
+    method_batcher& operator=(const method_batcher&) = delete;
+
+    // sends the calls still waiting
+    inline ~method_batcher() {
+        {
+            std::lock_guard lock(_mutex);
+            _stopped = true;
+        }
+        _has_pending.notify_all();
+        if (_thread.joinable()) {
+            _thread.join();
+        }
+    }
+
+    [[nodiscard]] inline std::chrono::milliseconds get_window() const noexcept {
+        return _window;
+    }
+
+    [[nodiscard]] inline std::future<nlohmann::json> push(const method& call, const call_priority priority) {
+        std::promise<nlohmann::json> promise;
+        auto future = promise.get_future();
+        {
+            std::lock_guard lock(_mutex);
+            _pending_calls.push_back({ call, priority, std::move(promise) });
+        }
+        _has_pending.notify_one();
+        return future;
     }
 };
 
+inline void base_vk_api::enable_batching(const std::chrono::milliseconds window) {
+    _batcher = std::make_shared<method_batcher>(*this, window);
+}
+
+inline std::future<nlohmann::json> base_vk_api::call_method_batched(const method& method,
+    const call_priority priority) {
+    if (!_batcher) {
+        return call_method_async(method, priority);
+    }
+    return _batcher->push(method, priority);
+}
+
 class base_sub_vk_api {
 private:
     base_vk_api& _api;
@@ -147,38 +665,53 @@ class messages : public base_sub_vk_api {
 public:
     using base_sub_vk_api::base_sub_vk_api;
 
-    inline nlohmann::json send(const int user_id, const message& message) {
+private:
+    [[nodiscard]] static inline method _make_send_method(const int user_id, const message& message) {
         if (message.text.empty() && message.attachment.empty()) {
             throw std::runtime_error(VK_GRAFFITI_BOT_FUNC_MSG(
                 "you must specify at least one of the parameters when sending a message: text, attachment"));
         }
 
         method method("messages.send");
-        method.add_param("user_id", std::to_string(user_id));
-        method.add_param("random_id", "0");
+        method.add_param("user_id", user_id);
+        method.add_param("random_id", message.random_id != 0 ? message.random_id : details::next_message_random_id());
         if (!message.text.empty()) {
             method.add_param("message", message.text);
         }
         if (!message.attachment.empty()) {
             method.add_param("attachment", message.attachment);
         }
+        return method;
+    }
 
-        return api().call_method(method);
+public:
+    // batched with other messages when batching is enabled on the api
+    inline nlohmann::json send(const int user_id, const message& message,
+        const call_priority priority = call_priority::normal) {
+        const method method = _make_send_method(user_id, message);
+        return api().is_batching_enabled() ?
+            api().call_method_batched(method, priority).get() : api().call_method(method, priority);
+    }
+
+    // the message is sent without waiting for the answer when the api curl wrapper has an engine
+    [[nodiscard]] inline std::future<nlohmann::json> send_async(const int user_id, const message& message,
+        const call_priority priority = call_priority::normal) {
+        return api().call_method_batched(_make_send_method(user_id, message), priority);
     }
 };
 
 class photos : public base_sub_vk_api {
 public:
-    struct messages_upload_server {
-        std::string upload_url;
-        int album_id = 0;
-        int user_id  = 0;
-        int group_id = 0;
-    };
+    using messages_upload_server = vk_graffiti_bot::messages_upload_server;
 
     using base_sub_vk_api::base_sub_vk_api;
 
+    // answered from the upload server cache while the cached url is fresh
     [[nodiscard]] inline messages_upload_server get_messages_upload_server(const int peer_id) {
+        if (auto cached = api().upload_server_cache().get(peer_id)) {
+            return *cached;
+        }
+
         const method method("photos.getMessagesUploadServer", {
             { "peer_id", std::to_string(peer_id) }
         });
@@ -193,9 +726,15 @@ public:
         server.album_id   = response["album_id"];
         server.user_id    = response["user_id"];
         server.group_id   = response["group_id"];
+        api().upload_server_cache().put(peer_id, server);
         return server;
     }
 
+    // to be called when an upload to the cached url fails
+    inline void invalidate_messages_upload_server(const int peer_id) {
+        api().upload_server_cache().invalidate(peer_id);
+    }
+
     [[nodiscard]] inline nlohmann::json save_messages_photo(
         const std::string& photo, const int server, const std::string& hash) {
         const method method("photos.saveMessagesPhoto", {
@@ -208,18 +747,37 @@ public:
 };
 
 class vk_api : public base_vk_api {
+private:
+    // the server answers after wait seconds at the latest, a poll taking much longer has stalled
+    [[nodiscard]] static inline std::chrono::milliseconds _long_poll_timeout(const std::size_t wait) noexcept {
+        return std::chrono::seconds(wait + 15);
+    }
+
 public:
     using base_vk_api::base_vk_api;
 
     [[nodiscard]] inline nlohmann::json connect_to_long_poll_server(
         const long_poll_server& server, const std::size_t wait) {
+        // the url is rebuilt for every poll, a per-thread buffer keeps that from allocating
+        thread_local std::string request;
+        request.clear();
+        append_long_poll_url(request, server, wait);
         std::string answer_str;
-        const std::string request =
-            server.server + "?act=a_check&key=" + server.key + "&ts=" + server.ts + "&wait=" + std::to_string(wait);
-        curl().perform(request, answer_str);
+        curl().perform(request, answer_str, _long_poll_timeout(wait));
         return nlohmann::json::parse(answer_str);
     }
 
+    // reads only the fields the bots need, without building a json document
+    [[nodiscard]] inline long_poll_response poll_long_poll_server(
+        const long_poll_server& server, const std::size_t wait) {
+        thread_local std::string request;
+        request.clear();
+        append_long_poll_url(request, server, wait);
+        std::string answer_str;
+        curl().perform(request, answer_str, _long_poll_timeout(wait));
+        return parse_long_poll_response(answer_str);
+    }
+
     [[nodiscard]] inline vk_graffiti_bot::groups groups() {
         return vk_graffiti_bot::groups(*this);
     }
@@ -0,0 +1,182 @@
+#ifndef VK_GRAFFITI_BOT_WORKER_POOL_HPP
+#define VK_GRAFFITI_BOT_WORKER_POOL_HPP
+
+#include "utils.hpp"
+
+#include <mutex>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <stdexcept>
+#include <unordered_map>
+#include <condition_variable>
+
+VK_GRAFFITI_BOT_BEGIN
+// Bounded task queue served by a fixed number of threads.
+// Tasks pushed with the same key are never run concurrently and keep their push order.
+class worker_pool {
+public:
+    using key_type = long long;
+
+private:
+    // frees the key of a task once the last copy is destroyed
+    struct _key_hold {
+        worker_pool* pool;
+        key_type key;
+
+        inline _key_hold(worker_pool* pool, const key_type key) noexcept :
+            pool(pool),
+            key(key) {}
+
+        _key_hold(const _key_hold&)            = delete;
+        _key_hold& operator=(const _key_hold&) = delete;
+
+        inline ~_key_hold() {
+            pool->_release_key(key);
+        }
+    };
+
+public:
+    // Copies of it may be handed to other threads by a deferred task, the next task of the key
+    // starts once the task has returned and every copy is destroyed.
+    using key_release        = std::shared_ptr<const _key_hold>;
+    using task_type          = std::function<void(const std::size_t worker_index)>;
+    using deferred_task_type = std::function<void(const std::size_t worker_index, key_release release)>;
+
+private:
+    struct _key_tasks {
+        std::deque<deferred_task_type> tasks;
+    };
+
+    std::mutex _mutex;
+    std::condition_variable _has_ready;
+    std::condition_variable _has_space;
+    // a key is present here while it has pending tasks or one of its tasks is running
+    std::unordered_map<key_type, _key_tasks> _tasks_by_key;
+    std::deque<key_type> _ready_keys;
+    std::size_t _pending_count  = 0;
+    std::size_t _queue_capacity = 0;
+    bool _stopped               = false;
+    std::vector<std::thread> _threads;
+
+    inline void _run(const std::size_t worker_index) {
+        while (true) {
+            key_type key = 0;
+            deferred_task_type task;
+            {
+                std::unique_lock lock(_mutex);
+                // a stopped pool still waits for the keys held by deferred tasks
+                _has_ready.wait(lock, [this] {
+                    return !_ready_keys.empty() || (_stopped && _tasks_by_key.empty());
+                });
+                if (_ready_keys.empty()) {
+                    return;
+                }
+                key = _ready_keys.front();
+                _ready_keys.pop_front();
+                auto& key_tasks = _tasks_by_key[key].tasks;
+                task = std::move(key_tasks.front());
+                key_tasks.pop_front();
+                --_pending_count;
+            }
+            _has_space.notify_one();
+
+            try {
+                task(worker_index, std::make_shared<const _key_hold>(this, key));
+            } catch (const std::exception& ex) {
+                log_error(ex.what());
+            } catch (...) {
+                // anything escaping the thread would terminate the process
+                log_error(VK_GRAFFITI_BOT_FUNC_MSG("unknown exception in task"));
+            }
+            // the task and whatever it captured are destroyed before the next one is taken
+            task = nullptr;
+        }
+    }
+
+    inline void _release_key(const key_type key) noexcept {
+        std::lock_guard lock(_mutex);
+        const auto key_it = _tasks_by_key.find(key);
+        if (!key_it->second.tasks.empty()) {
+            _ready_keys.push_back(key);
+            _has_ready.notify_one();
+            return;
+        }
+        _tasks_by_key.erase(key_it);
+        if (_stopped && _tasks_by_key.empty()) {
+            _has_ready.notify_all();
+        }
+    }
+
+public:
+    inline worker_pool(const std::size_t workers_count, const std::size_t queue_capacity) :
+        _queue_capacity(queue_capacity) {
+        if (workers_count == 0 || queue_capacity == 0) {
+            throw std::invalid_argument(VK_GRAFFITI_BOT_FUNC_MSG("workers count and queue capacity must be positive"));
+        }
+        _threads.reserve(workers_count);
+        for (std::size_t i = 0; i < workers_count; ++i) {
+            _threads.emplace_back(&worker_pool::_run, this, i);
+        }
+    }
+
+    worker_pool(const worker_pool&)            = delete;
+    worker_pool& operator=(const worker_pool&) = delete;
+
+    inline ~worker_pool() {
+        stop();
+    }
+
+    [[nodiscard]] inline std::size_t get_workers_count() const noexcept {
+        return _threads.size();
+    }
+
+    [[nodiscard]] inline std::size_t get_queue_capacity() const noexcept {
+        return _queue_capacity;
+    }
+
+    // blocks while the queue is full
+    inline void push(const key_type key, task_type task) {
+        push_deferred(key, [task = std::move(task)](const std::size_t worker_index, key_release) {
+            task(worker_index);
+        });
+    }
+
+    // the task may pass release on to work it starts elsewhere, the key stays busy until that work is done
+    inline void push_deferred(const key_type key, deferred_task_type task) {
+        std::unique_lock lock(_mutex);
+        _has_space.wait(lock, [this] { return _stopped || _pending_count < _queue_capacity; });
+        if (_stopped) {
+            throw std::runtime_error(VK_GRAFFITI_BOT_FUNC_MSG("pool is stopped"));
+        }
+
+        auto [key_it, inserted] = _tasks_by_key.try_emplace(key);
+        key_it->second.tasks.push_back(std::move(task));
+        ++_pending_count;
+        if (inserted) {
+            _ready_keys.push_back(key);
+            lock.unlock();
+            _has_ready.notify_one();
+        }
+    }
+
+    // finishes already queued tasks, waits for the keys still held and joins the threads
+    inline void stop() {
+        {
+            std::lock_guard lock(_mutex);
+            _stopped = true;
+        }
+        _has_ready.notify_all();
+        _has_space.notify_all();
+        for (auto& thread : _threads) {
+            if (thread.joinable()) {
+                thread.join();
+            }
+        }
+    }
+};
+VK_GRAFFITI_BOT_END
+
+#endif // !VK_GRAFFITI_BOT_WORKER_POOL_HPP
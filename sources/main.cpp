@@ -1,9 +1,84 @@
 #include <iostream>
 #include <fstream>
+#include <thread>
 #include "graffiti_bot.hpp"
+#include "metrics_exporter.hpp"
 
 using namespace vk_graffiti_bot;
 
+namespace {
+// a group gets its own token, api and rate limit, the threads, font and caches are shared by all groups
+struct group_bot {
+    std::unique_ptr<curl_wrapper> curl;
+    std::unique_ptr<vk_api> api;
+    std::unique_ptr<graffiti_bot> bot;
+};
+
+// a setting of a group, the top level of group_data.json gives the value for groups without their own
+const nlohmann::json* find_group_setting(const nlohmann::json& group, const nlohmann::json& group_data,
+    const char* name) {
+    if (group.contains(name)) {
+        return &group[name];
+    }
+    if (group_data.contains(name)) {
+        return &group_data[name];
+    }
+    return nullptr;
+}
+
+std::unique_ptr<vk_api> make_group_api(curl_wrapper& curl, const nlohmann::json& group,
+    const nlohmann::json& group_data) {
+    auto api = std::make_unique<vk_api>(curl, group["access_token"].get<std::string>());
+    if (const auto api_url = find_group_setting(group, group_data, "api_url")) {
+        api->set_api_url(api_url->get<std::string>());
+    }
+    if (const auto ttl = find_group_setting(group, group_data, "upload_server_ttl_s")) {
+        api->upload_server_cache().set_ttl(std::chrono::seconds(ttl->get<long long>()));
+    }
+    if (const auto requests_per_second = find_group_setting(group, group_data, "requests_per_second")) {
+        api->scheduler().set_requests_per_second(requests_per_second->get<double>());
+    }
+    // replies to different users are sent together within this window, 0 turns it off
+    const auto batch_window = find_group_setting(group, group_data, "batch_window_ms");
+    const long long batch_window_ms = batch_window ? batch_window->get<long long>() : 20;
+    if (batch_window_ms > 0) {
+        api->enable_batching(std::chrono::milliseconds(batch_window_ms));
+    }
+    return api;
+}
+
+void set_group_settings(graffiti_bot& bot, const nlohmann::json& group, const nlohmann::json& group_data) {
+    if (const auto dimension = find_group_setting(group, group_data, "target_photo_dimension")) {
+        bot.set_target_photo_dimension(dimension->get<std::size_t>());
+    }
+    if (const auto max_size = find_group_setting(group, group_data, "max_photo_size_mb")) {
+        auto limits      = bot.get_photo_download_limits();
+        limits.max_bytes = max_size->get<std::size_t>() * 1024 * 1024;
+        bot.set_photo_download_limits(limits);
+    }
+    if (const auto max_dimension = find_group_setting(group, group_data, "max_photo_dimension")) {
+        auto limits       = bot.get_photo_download_limits();
+        limits.max_width  = max_dimension->get<unsigned>();
+        limits.max_height = limits.max_width;
+        bot.set_photo_download_limits(limits);
+    }
+    if (const auto quality = find_group_setting(group, group_data, "jpeg_quality")) {
+        bot.set_jpeg_quality(quality->get<int>());
+    }
+    if (const auto entries = find_group_setting(group, group_data, "result_cache_entries")) {
+        bot.get_result_cache().set_max_entries(entries->get<std::size_t>());
+    }
+    // files are never shared, two groups writing one file would break it
+    if (group.contains("result_cache_file")) {
+        bot.get_result_cache().open_index(group["result_cache_file"].get<std::string>(),
+            group.value("result_cache_slots", group_data.value("result_cache_slots", std::size_t(65536))));
+    }
+    if (group.contains("cursor_file")) {
+        bot.set_cursor_file(group["cursor_file"].get<std::string>());
+    }
+}
+} // namespace
+
 int main() {
     try {
         nlohmann::json group_data;
@@ -14,25 +89,116 @@ int main() {
         file >> group_data;
         file.close();
 
-        const std::string access_token = group_data["access_token"];
-        const int group_id             = group_data["group_id"];
+        if (group_data.contains("log_file")) {
+            global_logger().set_file(group_data["log_file"].get<std::string>());
+        }
+        if (group_data.contains("log_level")) {
+            global_logger().set_level(log_level_from_string(group_data["log_level"].get<std::string>()));
+        }
 
-        curl_wrapper curl;
-        vk_api api(curl, access_token);
-        graffiti_bot bot(api, group_id);
-        sf::Font font;
-        if (!font.loadFromFile("../fonts/ImpactRegular.ttf")) {
-            throw std::runtime_error(VK_GRAFFITI_BOT_FUNC_MSG("load font error"));
+        // either a list of groups or a single group given at the top level
+        const nlohmann::json groups = group_data.contains("groups") ?
+            group_data["groups"] : nlohmann::json::array({ group_data });
+        if (!groups.is_array() || groups.empty()) {
+            throw std::runtime_error(VK_GRAFFITI_BOT_FUNC_MSG("groups must be a non-empty list"));
+        }
+
+        curl_multi_engine engine;
+        // a stalled transfer fails after these limits and the call is retried
+        curl_timeouts timeouts = engine.get_handle_pool()->get_timeouts();
+        if (group_data.contains("connect_timeout_s")) {
+            timeouts.connect = std::chrono::seconds(group_data["connect_timeout_s"].get<long long>());
+        }
+        if (group_data.contains("transfer_timeout_s")) {
+            timeouts.total = std::chrono::seconds(group_data["transfer_timeout_s"].get<long long>());
+        }
+        engine.get_handle_pool()->set_timeouts(timeouts);
+        const bool cpu_render = group_data.contains("render_mode") && group_data["render_mode"] == "cpu";
+        std::vector<group_bot> bots;
+        for (const auto& group : groups) {
+            group_bot bot;
+            bot.curl = std::make_unique<curl_wrapper>(&engine);
+            bot.api  = make_group_api(*bot.curl, group, group_data);
+            const int group_id = group["group_id"];
+            if (bots.empty()) {
+                bot.bot = std::make_unique<graffiti_bot>(*bot.api, group_id,
+                    cpu_render ? render_mode::cpu : render_mode::render_texture);
+                // the settings of the shared threads, font and caches are taken by the other groups
+                auto& shared_bot = *bot.bot;
+                shared_bot.load_font("../fonts/ImpactRegular.ttf");
+                if (group_data.contains("text_cache_size_mb")) {
+                    shared_bot.get_text_mask_cache().set_max_bytes(
+                        group_data["text_cache_size_mb"].get<std::size_t>() * 1024 * 1024);
+                }
+                if (group_data.contains("workers_count")) {
+                    shared_bot.set_workers_count(group_data["workers_count"].get<std::size_t>());
+                }
+                if (group_data.contains("queue_capacity")) {
+                    shared_bot.set_queue_capacity(group_data["queue_capacity"].get<std::size_t>());
+                }
+                if (group_data.contains("network_concurrency")) {
+                    shared_bot.set_network_concurrency(group_data["network_concurrency"].get<std::size_t>());
+                }
+                if (group_data.contains("render_concurrency")) {
+                    shared_bot.set_render_concurrency(group_data["render_concurrency"].get<std::size_t>());
+                }
+                if (group_data.contains("stage_queue_capacity")) {
+                    shared_bot.set_stage_queue_capacity(group_data["stage_queue_capacity"].get<std::size_t>());
+                }
+                if (group_data.contains("warm_up_character_sizes")) {
+                    shared_bot.set_warm_up_character_sizes(
+                        group_data["warm_up_character_sizes"].get<std::vector<unsigned>>());
+                }
+                if (group_data.contains("glyph_atlas_file")) {
+                    shared_bot.set_glyph_atlas_file(group_data["glyph_atlas_file"].get<std::string>());
+                }
+            } else {
+                bot.bot = std::make_unique<graffiti_bot>(*bot.api, group_id, *bots.front().bot);
+            }
+            set_group_settings(*bot.bot, group, group_data);
+            bots.push_back(std::move(bot));
+        }
+
+        // latency and throughput metrics in the prometheus text format
+        std::unique_ptr<metrics_server> metrics_http;
+        if (group_data.contains("metrics_port")) {
+            metrics_http = std::make_unique<metrics_server>(global_metrics(),
+                group_data["metrics_port"].get<std::uint16_t>());
+        }
+        std::unique_ptr<metrics_signal_dumper> metrics_dumper;
+        if (group_data.contains("metrics_file")) {
+            metrics_dumper = std::make_unique<metrics_signal_dumper>(global_metrics(),
+                group_data["metrics_file"].get<std::string>());
         }
-        bot.set_font(font);
-        bot.set_img_cach_path("img.bmp");
 
         std::cout << "Bot started." << std::endl;
-        bot.start();
+        if (bots.size() == 1) {
+            bots.front().bot->start();
+        } else {
+            // every group polls on a thread of its own, a group that fails does not stop the others
+            std::atomic<bool> failed = false;
+            std::vector<std::thread> threads;
+            for (auto& bot : bots) {
+                threads.emplace_back([&bot, &failed] {
+                    try {
+                        bot.bot->start();
+                    } catch (const std::exception& ex) {
+                        log_error(ex.what(), log_field("group_id", bot.bot->get_group_id()));
+                        failed = true;
+                    }
+                });
+            }
+            for (auto& thread : threads) {
+                thread.join();
+            }
+            if (failed) {
+                return EXIT_FAILURE;
+            }
+        }
     } catch (const std::exception& ex) {
         log_error(ex.what());
         return EXIT_FAILURE;
     }
 
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
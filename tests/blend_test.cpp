@@ -0,0 +1,112 @@
+#include "blend.hpp"
+
+#include <random>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+
+// Checks that every SIMD kernel supported by the running CPU gives the same pixels as the scalar one.
+// Widths 1..33 run the scalar tails of the SIMD loops, rows start at unaligned addresses
+// and are followed by guard bytes, so a write past the end of the row is caught as well.
+
+using namespace vk_graffiti_bot;
+
+namespace {
+constexpr std::size_t max_width = 33;
+// bytes after the row that no kernel may touch
+constexpr std::size_t guard_size = 64;
+constexpr std::uint8_t guard_value = 0xA5;
+
+const char* kernel_name(const blend_kernel kernel) {
+    switch (kernel) {
+    case blend_kernel::sse2:
+        return "sse2";
+    case blend_kernel::avx2:
+        return "avx2";
+    default:
+        return "scalar";
+    }
+}
+
+// a quarter of the values are 0 and a quarter are 255, the edges the kernels treat separately
+std::vector<std::uint8_t> random_coverage(const std::size_t size, std::mt19937& random) {
+    std::uniform_int_distribution<int> value(0, 255);
+    std::uniform_int_distribution<int> kind(0, 3);
+    std::vector<std::uint8_t> coverage(size);
+    for (auto& byte : coverage) {
+        const int current = kind(random);
+        byte = static_cast<std::uint8_t>(current == 0 ? 0 : current == 1 ? 255 : value(random));
+    }
+    return coverage;
+}
+
+std::vector<std::uint8_t> random_bytes(const std::size_t size, std::mt19937& random) {
+    std::uniform_int_distribution<int> value(0, 255);
+    std::vector<std::uint8_t> bytes(size);
+    for (auto& byte : bytes) {
+        byte = static_cast<std::uint8_t>(value(random));
+    }
+    return bytes;
+}
+
+blend_color random_color(const std::uint8_t alpha, std::mt19937& random) {
+    std::uniform_int_distribution<int> value(0, 255);
+    return { static_cast<std::uint8_t>(value(random)), static_cast<std::uint8_t>(value(random)),
+        static_cast<std::uint8_t>(value(random)), alpha };
+}
+
+// the pixels of a row placed offset bytes into a buffer, followed by the guard
+std::vector<std::uint8_t> make_row(const std::vector<std::uint8_t>& pixels, const std::size_t offset) {
+    std::vector<std::uint8_t> row(offset + pixels.size() + guard_size, guard_value);
+    std::copy(pixels.begin(), pixels.end(), row.begin() + static_cast<std::ptrdiff_t>(offset));
+    return row;
+}
+} // namespace
+
+int main() {
+    std::mt19937 random(42);
+    const std::uint8_t alphas[] = { 0, 255, 77 };
+    std::size_t checks   = 0;
+    std::size_t failures = 0;
+
+    for (const auto kernel : { blend_kernel::sse2, blend_kernel::avx2 }) {
+        if (!is_blend_kernel_supported(kernel)) {
+            std::printf("%s is not supported, skipped\n", kernel_name(kernel));
+            continue;
+        }
+        for (std::size_t width = 1; width <= max_width; ++width) {
+            for (const bool has_outline : { false, true }) {
+                for (const std::uint8_t fill_alpha : alphas) {
+                    for (const std::uint8_t outline_alpha : alphas) {
+                        const auto pixels     = random_bytes(width * 4, random);
+                        const auto fill       = make_row(random_coverage(width, random), width % 3);
+                        const auto outline    = make_row(random_coverage(width, random), width % 5);
+                        const auto fill_color    = random_color(fill_alpha, random);
+                        const auto outline_color = random_color(outline_alpha, random);
+                        const std::size_t pixels_offset = (width % 4) * 4 + 1;
+
+                        auto expected = make_row(pixels, pixels_offset);
+                        auto actual   = expected;
+                        const std::uint8_t* fill_row    = fill.data() + width % 3;
+                        const std::uint8_t* outline_row = has_outline ? outline.data() + width % 5 : nullptr;
+                        blend_coverage_row(blend_kernel::scalar, expected.data() + pixels_offset, fill_row,
+                            outline_row, width, fill_color, outline_color);
+                        blend_coverage_row(kernel, actual.data() + pixels_offset, fill_row,
+                            outline_row, width, fill_color, outline_color);
+
+                        ++checks;
+                        if (actual != expected) {
+                            ++failures;
+                            std::printf("FAIL %s: width %zu, %s outline, fill alpha %d, outline alpha %d\n",
+                                kernel_name(kernel), width, has_outline ? "with" : "without",
+                                fill_alpha, outline_alpha);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    std::printf("%zu checks, %zu failed\n", checks, failures);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}